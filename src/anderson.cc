@@ -0,0 +1,293 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software 
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "snap.h"
+#include "anderson.h"
+
+#include <vector>
+
+extern Legion::Logger log_snap;
+
+//------------------------------------------------------------------------------
+AndersonResidual::AndersonResidual(const Snap &snap, const Predicate &pred,
+                                   const SnapArray<3> &flux0,
+                                   const SnapArray<3> &flux0po,
+                                   const SnapArray<3> &f_prev,
+                                   const SnapArray<3> &g_prev,
+                                   const SnapArray<3> &df,
+                                   const SnapArray<3> &dg, bool history)
+  : SnapTask<AndersonResidual, Snap::ANDERSON_RESIDUAL_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), has_history(history)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&has_history, sizeof(has_history));
+  flux0.add_projection_requirement(READ_ONLY, *this);
+  flux0po.add_projection_requirement(READ_ONLY, *this);
+  f_prev.add_projection_requirement(READ_WRITE, *this);
+  g_prev.add_projection_requirement(READ_WRITE, *this);
+  // The first outer iteration has nothing to take a difference with
+  if (has_history) {
+    df.add_projection_requirement(WRITE_DISCARD, *this);
+    dg.add_projection_requirement(WRITE_DISCARD, *this);
+  } else {
+    df.add_projection_requirement(NO_ACCESS, *this);
+    dg.add_projection_requirement(NO_ACCESS, *this);
+  }
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void AndersonResidual::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 6; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void AndersonResidual::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running Anderson Residual");
+
+  const bool has_history = *((bool*)task->args);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  for (std::set<FieldID>::const_iterator it = 
+        task->regions[0].privilege_fields.begin(); it !=
+        task->regions[0].privilege_fields.end(); it++)
+  {
+    AccessorRO<double,3> fa_flux0(regions[0], *it);
+    AccessorRO<double,3> fa_flux0po(regions[1], *it);
+    AccessorRW<double,3> fa_f(regions[2], *it);
+    AccessorRW<double,3> fa_g(regions[3], *it);
+    if (has_history) {
+      AccessorWO<double,3> fa_df(regions[4], *it);
+      AccessorWO<double,3> fa_dg(regions[5], *it);
+      for (DomainIterator<3> itr(dom); itr(); itr++)
+      {
+        const double g = fa_flux0[*itr];
+        const double f = g - fa_flux0po[*itr];
+        fa_df[*itr] = f - fa_f[*itr];
+        fa_dg[*itr] = g - fa_g[*itr];
+        fa_f[*itr] = f;
+        fa_g[*itr] = g;
+      }
+    } else {
+      for (DomainIterator<3> itr(dom); itr(); itr++)
+      {
+        const double g = fa_flux0[*itr];
+        fa_f[*itr] = g - fa_flux0po[*itr];
+        fa_g[*itr] = g;
+      }
+    }
+  }
+#endif
+}
+
+//------------------------------------------------------------------------------
+AndersonDot::AndersonDot(const Snap &snap, const Predicate &pred,
+                         const SnapArray<3> &x, const SnapArray<3> &y,
+                         const Future &zero_future)
+  : SnapTask<AndersonDot, Snap::ANDERSON_DOT_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred)
+//------------------------------------------------------------------------------
+{
+  x.add_projection_requirement(READ_ONLY, *this);
+  y.add_projection_requirement(READ_ONLY, *this);
+  predicate_false_future = zero_future;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void AndersonDot::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 2; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double AndersonDot::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running Anderson Dot");
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  // All the groups go into one least squares problem
+  double dot = 0.0;
+  for (std::set<FieldID>::const_iterator it = 
+        task->regions[0].privilege_fields.begin(); it !=
+        task->regions[0].privilege_fields.end(); it++)
+  {
+    AccessorRO<double,3> fa_x(regions[0], *it);
+    AccessorRO<double,3> fa_y(regions[1], *it);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+      dot += fa_x[*itr] * fa_y[*itr];
+  }
+  return dot;
+#else
+  return 0.0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+AndersonMix::AndersonMix(const Snap &snap, const Predicate &pred,
+                         const SnapArray<3> &flux0,
+                         const std::vector<SnapArray<3>*> &dg,
+                         const std::vector<Future> &normal_equations)
+  : SnapTask<AndersonMix, Snap::ANDERSON_MIX_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred)
+//------------------------------------------------------------------------------
+{
+  flux0.add_projection_requirement(READ_WRITE, *this);
+  for (unsigned idx = 0; idx < dg.size(); idx++)
+    dg[idx]->add_projection_requirement(READ_ONLY, *this);
+  // Upper triangle of the Gram matrix of the residual differences by 
+  // rows followed by their dot products with the current residual
+  const int n = dg.size();
+  assert(int(normal_equations.size()) == ((n * (n + 3)) / 2));
+  for (unsigned idx = 0; idx < normal_equations.size(); idx++)
+    add_future(normal_equations[idx]);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void AndersonMix::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // The number of difference regions varies so only constrain the first 
+  // two, the mapper makes SOA instances for all of them anyway
+  for (unsigned idx = 0; idx < 2; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void AndersonMix::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running Anderson Mix");
+
+  // Every point task solves the same small system
+  const int n = regions.size() - 1;
+  std::vector<std::vector<double> > a(n, std::vector<double>(n+1, 0.0));
+  unsigned next = 0;
+  for (int i = 0; i < n; i++)
+    for (int j = i; j < n; j++) {
+      a[i][j] = 
+        task->futures[next++].get_result<double>(true/*silence warnings*/);
+      a[j][i] = a[i][j];
+    }
+  double scale = 0.0;
+  for (int i = 0; i < n; i++) {
+    a[i][n] = 
+      task->futures[next++].get_result<double>(true/*silence warnings*/);
+    if (a[i][i] > scale)
+      scale = a[i][i];
+  }
+  // Gaussian elimination with partial pivoting, differences that are 
+  // (nearly) linearly dependent on the others just get no weight
+  std::vector<int> pivot_row(n, -1);
+  std::vector<bool> used(n, false);
+  for (int k = 0; k < n; k++)
+  {
+    int best = -1;
+    for (int i = 0; i < n; i++) {
+      if (used[i])
+        continue;
+      if ((best < 0) || (fabs(a[i][k]) > fabs(a[best][k])))
+        best = i;
+    }
+    if ((best < 0) || (fabs(a[best][k]) <= 1e-12 * scale))
+      continue;
+    used[best] = true;
+    pivot_row[k] = best;
+    for (int i = 0; i < n; i++) {
+      if (used[i])
+        continue;
+      const double factor = a[i][k] / a[best][k];
+      for (int j = k; j <= n; j++)
+        a[i][j] -= factor * a[best][j];
+    }
+  }
+  std::vector<double> gamma(n, 0.0);
+  for (int k = n-1; k >= 0; k--) {
+    if (pivot_row[k] < 0)
+      continue;
+    const std::vector<double> &row = a[pivot_row[k]];
+    double sum = row[n];
+    for (int j = k+1; j < n; j++)
+      sum -= row[j] * gamma[j];
+    gamma[k] = sum / row[k];
+  }
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  std::vector<AccessorRO<double,3> > fa_dg(n);
+  for (std::set<FieldID>::const_iterator it = 
+        task->regions[0].privilege_fields.begin(); it !=
+        task->regions[0].privilege_fields.end(); it++)
+  {
+    AccessorRW<double,3> fa_flux0(regions[0], *it);
+    for (int i = 0; i < n; i++)
+      fa_dg[i] = AccessorRO<double,3>(regions[i+1], *it);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+    {
+      double flux = fa_flux0[*itr];
+      for (int i = 0; i < n; i++)
+        flux -= gamma[i] * fa_dg[i][*itr];
+      fa_flux0[*itr] = flux;
+    }
+  }
+#endif
+}
@@ -0,0 +1,75 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software 
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __ANDERSON_H__
+#define __ANDERSON_H__
+
+#include "snap.h"
+#include "legion.h"
+
+// Anderson mixing of the scalar flux between outer iterations. The outer
+// iteration is a fixed point map G from flux0po to flux0 with residual
+// f = flux0 - flux0po. The differences of the last m residuals and maps
+// are kept in rotating buffers and the next iterate is G minus the
+// combination of map differences that best cancels the current residual.
+// The small normal equations are assembled from reduction futures.
+
+class AndersonResidual : public SnapTask<AndersonResidual,
+                                         Snap::ANDERSON_RESIDUAL_TASK_ID> {
+public:
+  AndersonResidual(const Snap &snap, const Predicate &pred,
+                   const SnapArray<3> &flux0, const SnapArray<3> &flux0po,
+                   const SnapArray<3> &f_prev, const SnapArray<3> &g_prev,
+                   const SnapArray<3> &df, const SnapArray<3> &dg,
+                   bool has_history);
+public:
+  const bool has_history;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class AndersonDot : public SnapTask<AndersonDot, Snap::ANDERSON_DOT_TASK_ID> {
+public:
+  AndersonDot(const Snap &snap, const Predicate &pred,
+              const SnapArray<3> &x, const SnapArray<3> &y,
+              const Future &zero_future);
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class AndersonMix : public SnapTask<AndersonMix, Snap::ANDERSON_MIX_TASK_ID> {
+public:
+  AndersonMix(const Snap &snap, const Predicate &pred,
+              const SnapArray<3> &flux0, 
+              const std::vector<SnapArray<3>*> &dg,
+              const std::vector<Future> &normal_equations);
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+#endif // __ANDERSON_H__
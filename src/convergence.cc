@@ -17,10 +17,31 @@
  */
 
 #include "snap.h"
+#include "sweep.h"
 #include "convergence.h"
 
+#include <cstdio>
+#include <cstring>
+#include <x86intrin.h>
+
 extern Legion::Logger log_snap;
 
+//------------------------------------------------------------------------------
+static const char* cycle_name(void)
+//------------------------------------------------------------------------------
+{
+  // Power iterations take the place of time steps for k-eigenvalue problems
+  return (Snap::max_power_iters > 0) ? "power iteration" : "time step";
+}
+
+//------------------------------------------------------------------------------
+static int cycle_number(const ConvergenceMonad::MonadData &data)
+//------------------------------------------------------------------------------
+{
+  return (Snap::max_power_iters > 0) ? 
+    data.power_iteration_number : data.time_step_number;
+}
+
 //------------------------------------------------------------------------------
 ConvergenceMonad::ConvergenceMonad(Context c, Runtime *rt)
   : ctx(c), runtime(rt)
@@ -36,11 +57,16 @@ ConvergenceMonad::ConvergenceMonad(Context c, Runtime *rt)
   init_data.time_step_number = 0;
   init_data.inner_loop_number = 0;
   init_data.outer_loop_number = 0;
+  init_data.power_iteration_number = 0;
   init_data.total_inner_loops = 0;
   init_data.total_outer_loops = 0;
+  init_data.total_group_sweeps = 0;
   init_data.total_inner_time = 0;
   init_data.total_outer_time = 0;
   init_data.total_step_time = 0;
+  init_data.keff = 1.0;
+  init_data.num_records = 0;
+  memset(&init_data.record, 0, sizeof(init_data.record));
 
   monad_future = Future::from_untyped_pointer(runtime, &init_data, 
                                               sizeof(init_data));
@@ -59,9 +85,12 @@ ConvergenceMonad::ConvergenceMonad(const ConvergenceMonad &rhs)
 ConvergenceMonad::~ConvergenceMonad(void)
 //------------------------------------------------------------------------------
 {
-  // Launch the summary task
+  // Launch the summary task, it gets the history rows after the final data
   TaskLauncher launcher(Snap::SUMMARY_TASK_ID, TaskArgument(NULL, 0));
   launcher.add_future(monad_future);
+  for (std::vector<Future>::const_iterator it = 
+        history_futures.begin(); it != history_futures.end(); it++)
+    launcher.add_future(*it);
 
   runtime->execute_task(ctx, launcher);
 }
@@ -77,25 +106,42 @@ ConvergenceMonad& ConvergenceMonad::operator=(const ConvergenceMonad &rhs)
 
 //------------------------------------------------------------------------------
 void ConvergenceMonad::bind_inner(const Predicate &pred,
-                                  const Future &inner_converged)
+                                  const Future &inner_converged,
+                                  const std::vector<Future> &chunks_swept,
+                                  const std::vector<int> &chunk_groups,
+                                  const std::vector<Future> &max_changes)
 //------------------------------------------------------------------------------
 {
+  assert(chunks_swept.size() == chunk_groups.size());
   Future timing_future = runtime->get_current_time_in_microseconds(ctx, 
                                                       inner_converged);
 
   TaskLauncher launcher(Snap::BIND_INNER_CONVERGENCE_TASK_ID,
-                        TaskArgument(NULL, 0), pred);
+      TaskArgument(chunk_groups.empty() ? NULL : &chunk_groups.front(),
+                   chunk_groups.size() * sizeof(int)), pred);
   launcher.add_future(monad_future);
   launcher.add_future(inner_converged);
   launcher.add_future(timing_future);
+  for (std::vector<Future>::const_iterator it = 
+        chunks_swept.begin(); it != chunks_swept.end(); it++)
+    launcher.add_future(*it);
+  for (std::vector<Future>::const_iterator it = 
+        max_changes.begin(); it != max_changes.end(); it++)
+    launcher.add_future(*it);
   launcher.predicate_false_future = monad_future;
 
+#ifdef SNAP_OVERHEAD_BENCHMARK
+  OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::SINGLE_TASK_LAUNCH);
+#endif
   monad_future = runtime->execute_task(ctx, launcher);
+  if (!max_changes.empty())
+    history_futures.push_back(monad_future);
 }
 
 //------------------------------------------------------------------------------
 void ConvergenceMonad::bind_outer(const Predicate &pred,
-                                  const Future &outer_converged)
+                                  const Future &outer_converged,
+                                  const std::vector<Future> &max_changes)
 //------------------------------------------------------------------------------
 {
   Future timing_future = runtime->get_current_time_in_microseconds(ctx, 
@@ -106,8 +152,39 @@ void ConvergenceMonad::bind_outer(const Predicate &pred,
   launcher.add_future(monad_future);
   launcher.add_future(outer_converged);
   launcher.add_future(timing_future);
+  for (std::vector<Future>::const_iterator it = 
+        max_changes.begin(); it != max_changes.end(); it++)
+    launcher.add_future(*it);
   launcher.predicate_false_future = monad_future;
 
+#ifdef SNAP_OVERHEAD_BENCHMARK
+  OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::SINGLE_TASK_LAUNCH);
+#endif
+  monad_future = runtime->execute_task(ctx, launcher);
+  if (!max_changes.empty())
+    history_futures.push_back(monad_future);
+}
+
+//------------------------------------------------------------------------------
+void ConvergenceMonad::bind_eigenvalue(const Predicate &pred,
+                                       const Future &power_converged,
+                                       const Future &keff)
+//------------------------------------------------------------------------------
+{
+  Future timing_future = runtime->get_current_time_in_microseconds(ctx, 
+                                                      power_converged);
+
+  TaskLauncher launcher(Snap::BIND_EIGENVALUE_TASK_ID,
+                        TaskArgument(NULL, 0), pred);
+  launcher.add_future(monad_future);
+  launcher.add_future(power_converged);
+  launcher.add_future(keff);
+  launcher.add_future(timing_future);
+  launcher.predicate_false_future = monad_future;
+
+#ifdef SNAP_OVERHEAD_BENCHMARK
+  OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::SINGLE_TASK_LAUNCH);
+#endif
   monad_future = runtime->execute_task(ctx, launcher);
 }
 
@@ -138,6 +215,19 @@ void ConvergenceMonad::bind_outer(const Predicate &pred,
   Runtime::preregister_task_variant<MonadData, bind_outer_implementation>(
       outer_registrar, Snap::task_names[Snap::BIND_OUTER_CONVERGENCE_TASK_ID]);
 
+  strcpy(variant_name, "CPU ");
+  strncat(variant_name, 
+      Snap::task_names[Snap::BIND_EIGENVALUE_TASK_ID], 123);
+  TaskVariantRegistrar eigenvalue_registrar(
+      Snap::BIND_EIGENVALUE_TASK_ID, true/*global*/, variant_name);
+  eigenvalue_registrar.add_constraint(
+      ProcessorConstraint(Processor::LOC_PROC));
+  eigenvalue_registrar.leaf_variant = true;
+  eigenvalue_registrar.inner_variant = false;
+  Runtime::preregister_task_variant<MonadData, 
+    bind_eigenvalue_implementation>(eigenvalue_registrar, 
+        Snap::task_names[Snap::BIND_EIGENVALUE_TASK_ID]);
+
   strcpy(variant_name, "CPU ");
   strncat(variant_name,
       Snap::task_names[Snap::SUMMARY_TASK_ID], 123);
@@ -156,8 +246,13 @@ void ConvergenceMonad::bind_outer(const Predicate &pred,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
 //------------------------------------------------------------------------------
 {
-  // Should always have three futures
-  assert(task->futures.size() == 3);
+  // The arguments are the groups swept by each group chunk
+  const int num_chunks = task->arglen / sizeof(int);
+  const int *chunk_groups = (const int*)task->args;
+  // Should always have three futures and one for each group chunk, 
+  // plus the max flux changes of the tests if recording the history
+  const unsigned history_index = 3 + num_chunks;
+  assert(task->futures.size() >= history_index);
   // First is the monad data
   MonadData data = 
     task->futures[0].get_result<MonadData>(true/*silence warnings*/);
@@ -166,25 +261,56 @@ void ConvergenceMonad::bind_outer(const Predicate &pred,
   // Third is the timing information for when the convergence result was ready
   long long time = 
     task->futures[2].get_result<long long>(true/*silence warnings*/);
+  // Then whether each group chunk was swept, chunks that converged 
+  // in earlier inner iterations were predicated off
+  int groups_swept = 0;
+  for (int idx = 0; idx < num_chunks; idx++)
+    if (task->futures[3+idx].get_result<bool>(true/*silence warnings*/))
+      groups_swept += chunk_groups[idx];
 
   const long long loop_time = time - data.inner_start;
+  // Last are the max flux changes if we are recording the history
+  if (task->futures.size() > history_index) {
+    ConvergenceRecord &record = data.record;
+    record.outer = false;
+    record.converged = converged;
+    record.time_step = cycle_number(data);
+    record.outer_loop = data.outer_loop_number;
+    record.inner_loop = data.inner_loop_number;
+    record.max_df = 0.0;
+    for (unsigned idx = history_index; idx < task->futures.size(); idx++) {
+      const double df = 
+        task->futures[idx].get_result<double>(true/*silence warnings*/);
+      if (df > record.max_df)
+        record.max_df = df;
+    }
+    record.time = loop_time;
+    data.num_records++;
+  }
+  // Grind time is nanoseconds per cell, angle, and group for each sweep
+  const double grind_time = (groups_swept > 0) ? 
+    1e3 * double(loop_time) / (sweep_unknowns() * groups_swept) : 0.0;
   if (converged) {
     log_snap.print("Inner loop %d of outer loop %d of "
-                   "time step %d CONVERGED in %lld microseconds",
+                   "%s %d CONVERGED in %lld microseconds "
+                   "(grind time %.4g ns)",
                    data.inner_loop_number, data.outer_loop_number,
-                   data.time_step_number, loop_time);
+                   cycle_name(), cycle_number(data), loop_time, grind_time);
     // Inner count goes back to zero
     data.inner_loop_number = 0;
   }
   else {
     log_snap.print("Inner loop %d of outer loop %d of "
-                   "time step %d did not converge in %lld microseconds",
+                   "%s %d did not converge in %lld microseconds "
+                   "(grind time %.4g ns)",
                    data.inner_loop_number, data.outer_loop_number,
-                   data.time_step_number, loop_time);
+                   cycle_name(), cycle_number(data), loop_time, grind_time);
     data.inner_loop_number++;
   }
-  // Remember the results
+  // Remember the results, this task is predicated the same way as the
+  // inner loop and only counts the group chunks that were swept in it
   data.total_inner_loops++;
+  data.total_group_sweeps += groups_swept;
   data.total_inner_time += loop_time;
   // Reset the timer
   data.inner_start = time;
@@ -197,8 +323,8 @@ void ConvergenceMonad::bind_outer(const Predicate &pred,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
 //------------------------------------------------------------------------------
 {
-  // Should always have three futures
-  assert(task->futures.size() == 3);
+  // Should always have three futures, more with the max flux changes
+  assert(task->futures.size() >= 3);
   // First is the monad data
   MonadData data = 
     task->futures[0].get_result<MonadData>(true/*silence warnings*/);
@@ -209,21 +335,42 @@ void ConvergenceMonad::bind_outer(const Predicate &pred,
     task->futures[2].get_result<long long>(true/*silence warnings*/);
 
   const long long loop_time = time - data.outer_start;
+  // Last are the max flux changes if we are recording the history
+  if (task->futures.size() > 3) {
+    ConvergenceRecord &record = data.record;
+    record.outer = true;
+    record.converged = converged;
+    record.time_step = cycle_number(data);
+    record.outer_loop = data.outer_loop_number;
+    record.inner_loop = -1;
+    record.max_df = 0.0;
+    for (unsigned idx = 3; idx < task->futures.size(); idx++) {
+      const double df = 
+        task->futures[idx].get_result<double>(true/*silence warnings*/);
+      if (df > record.max_df)
+        record.max_df = df;
+    }
+    record.time = loop_time;
+    data.num_records++;
+  }
   if (converged) {
-    log_snap.print("Outer loop %d of time step %d CONVERGED in %lld "
+    log_snap.print("Outer loop %d of %s %d CONVERGED in %lld "
                    "microseconds", data.outer_loop_number,
-                   data.time_step_number, loop_time);
-    const long long step_time = time - data.step_start;
-    log_snap.print("Time step %d took %lld microseconds", 
-                   data.time_step_number, step_time);
-    data.time_step_number++;
+                   cycle_name(), cycle_number(data), loop_time);
+    // Power iterations are timed when the eigenvalue is bound
+    if (Snap::max_power_iters == 0) {
+      const long long step_time = time - data.step_start;
+      log_snap.print("Time step %d took %lld microseconds", 
+                     data.time_step_number, step_time);
+      data.time_step_number++;
+      data.step_start = time;
+      data.total_step_time += step_time;
+    }
     data.outer_loop_number = 0;
-    data.step_start = time;
-    data.total_step_time += step_time;
   } else {
-    log_snap.print("Outer loop %d of time step %d did not converge "
+    log_snap.print("Outer loop %d of %s %d did not converge "
                    "in %lld microsecond", data.outer_loop_number,
-                   data.time_step_number, loop_time);
+                   cycle_name(), cycle_number(data), loop_time);
     data.outer_loop_number++;
   }
   data.total_outer_loops++;
@@ -236,13 +383,49 @@ void ConvergenceMonad::bind_outer(const Predicate &pred,
   return data;
 }
 
+//------------------------------------------------------------------------------
+/*static*/ ConvergenceMonad::MonadData 
+          ConvergenceMonad::bind_eigenvalue_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+  // Should always have four futures
+  assert(task->futures.size() == 4);
+  // First is the monad data
+  MonadData data = 
+    task->futures[0].get_result<MonadData>(true/*silence warnings*/);
+  // Second is the convergence result of the power iteration
+  bool converged = task->futures[1].get_result<bool>(true/*silence warnings*/);
+  // Third is the eigenvalue estimate after the power iteration
+  const double old_keff = data.keff;
+  data.keff = task->futures[2].get_result<double>(true/*silence warnings*/);
+  // Fourth is the timing information for when the convergence result was ready
+  long long time = 
+    task->futures[3].get_result<long long>(true/*silence warnings*/);
+
+  const long long step_time = time - data.step_start;
+  const double dk = fabs(data.keff - old_keff) / data.keff;
+  if (converged)
+    log_snap.print("Power iteration %d CONVERGED with k-eff %.10f "
+                   "(dk/k %.4g) in %lld microseconds", 
+                   data.power_iteration_number, data.keff, dk, step_time);
+  else
+    log_snap.print("Power iteration %d did not converge, k-eff %.10f "
+                   "(dk/k %.4g) in %lld microseconds",
+                   data.power_iteration_number, data.keff, dk, step_time);
+  data.power_iteration_number++;
+  data.step_start = time;
+  data.total_step_time += step_time;
+  return data;
+}
+
 //------------------------------------------------------------------------------
 /*static*/ void ConvergenceMonad::summary_implementation(const Task *task,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
 //------------------------------------------------------------------------------
 {
-  // Should always have one future
-  assert(task->futures.size() == 1);
+  // Should always have at least one future
+  assert(!task->futures.empty());
   // Get the monad data
   MonadData data = 
     task->futures[0].get_result<MonadData>(true/*silence warnings*/);
@@ -251,15 +434,229 @@ void ConvergenceMonad::bind_outer(const Predicate &pred,
   log_snap.print("SNAP Execution Summary");
   log_snap.print("---------------------------------------------------------");
   log_snap.print("  Execution Time: %lld us", data.total_step_time);
-  log_snap.print("  Total Time Steps: %d (avg %.8g us / iter)",
-      data.time_step_number,
-      double(data.total_step_time) / double(data.time_step_number));
+  // Outer loops of k-eigenvalue problems converge once per power
+  // iteration so there are no time steps to count
+  if (Snap::max_power_iters > 0) {
+    log_snap.print("  Total Power Iterations: %d (avg %.8g us / iter)",
+        data.power_iteration_number,
+        double(data.total_step_time) / double(data.power_iteration_number));
+    log_snap.print("  k-eff: %.10f", data.keff);
+  } else
+    log_snap.print("  Total Time Steps: %d (avg %.8g us / iter)",
+        data.time_step_number,
+        double(data.total_step_time) / double(data.time_step_number));
   log_snap.print("  Total Outer Loops: %d (avg %.8g us / iter)",
       data.total_outer_loops,
       double(data.total_outer_time) / double(data.total_outer_loops));
   log_snap.print("  Total Inner Loops: %d (avg %.8g us / iter)", 
       data.total_inner_loops, 
       double(data.total_inner_time) / double(data.total_inner_loops));
+  // Same figure of merit as Fortran SNAP: solve time divided by the
+  // unknowns swept over all the inner iterations that were executed,
+  // counting only the groups that each of them actually swept
+  if (data.total_group_sweeps > 0) {
+    const double total_unknowns = 
+      sweep_unknowns() * double(data.total_group_sweeps);
+    log_snap.print("  Grind Time (inner loops): %.8g ns",
+        1e3 * double(data.total_inner_time) / total_unknowns);
+    log_snap.print("  Grind Time (overall): %.8g ns",
+        1e3 * double(data.total_step_time) / total_unknowns);
+  } else
+    log_snap.print("  Grind Time: no groups were swept");
+  // Modelled sweep traffic and work over the inner loop time for the
+  // groups that were actually swept, building with SNAP_SWEEP_ROOFLINE 
+  // also reports the measured rate of the kernels at exit
+  const Rect<3> chunk(Point<3>(0, 0, 0), Point<3>(Snap::nx_per_chunk-1,
+                      Snap::ny_per_chunk-1, Snap::nz_per_chunk-1));
+  double chunk_bytes, chunk_flops;
+  MiniKBATask::sweep_model(chunk, 1/*group*/, chunk_bytes, chunk_flops);
+  const double total_sweeps = double(data.total_group_sweeps) * 
+    double(Snap::num_octants) * double(Snap::nx_chunks) * 
+    double(Snap::ny_chunks) * double(Snap::nz_chunks);
+  const double inner_ns = 1e3 * double(data.total_inner_time);
+  log_snap.print("  Sweep Bytes (modelled): %.8g GB (%.8g GB/s)",
+      1e-9 * total_sweeps * chunk_bytes, total_sweeps * chunk_bytes / inner_ns);
+  log_snap.print("  Sweep Flops (modelled): %.8g GFLOP (%.8g GFLOP/s)",
+      1e-9 * total_sweeps * chunk_flops, total_sweeps * chunk_flops / inner_ns);
+  if (Snap::history_prefix != NULL) {
+    // The rest of the futures are monad data that may hold a new row of
+    // the history, predicated off binds passed on the previous data so 
+    // only take the rows whose numbers we haven't seen yet
+    std::vector<ConvergenceRecord> history;
+    history.reserve(data.num_records);
+    for (unsigned idx = 1; idx < task->futures.size(); idx++) {
+      const MonadData &rows = 
+        task->futures[idx].get_result<MonadData>(true/*silence warnings*/);
+      if (rows.num_records > int(history.size()))
+        history.push_back(rows.record);
+    }
+    write_history(Snap::history_prefix, history);
+    log_snap.print("  Convergence History: %s.csv %s.json (%zu iterations)",
+        Snap::history_prefix, Snap::history_prefix, history.size());
+  }
   log_snap.print("---------------------------------------------------------");
 }
 
+//------------------------------------------------------------------------------
+/*static*/ double ConvergenceMonad::sweep_unknowns(void)
+//------------------------------------------------------------------------------
+{
+  return double(Snap::nx) * double(Snap::ny) * double(Snap::nz) * 
+    double(Snap::num_angles) * double(Snap::num_octants);
+}
+
+
+//------------------------------------------------------------------------------
+/*static*/ void ConvergenceMonad::write_history(const char *prefix,
+                                const std::vector<ConvergenceRecord> &history)
+//------------------------------------------------------------------------------
+{
+  char file_name[1024];
+  snprintf(file_name, sizeof(file_name), "%s.csv", prefix);
+  FILE *f = fopen(file_name, "w");
+  if (f == NULL) {
+    log_snap.error("Unable to open convergence history file %s", file_name);
+    return;
+  }
+  fprintf(f, "level,time_step,outer,inner,converged,max_df,time_us\n");
+  for (std::vector<ConvergenceRecord>::const_iterator it = 
+        history.begin(); it != history.end(); it++)
+  {
+    if (it->outer)
+      fprintf(f, "outer,%d,%d,,%d,%.8e,%lld\n", it->time_step, it->outer_loop,
+              it->converged ? 1 : 0, it->max_df, it->time);
+    else
+      fprintf(f, "inner,%d,%d,%d,%d,%.8e,%lld\n", it->time_step, 
+              it->outer_loop, it->inner_loop, it->converged ? 1 : 0, 
+              it->max_df, it->time);
+  }
+  fclose(f);
+
+  snprintf(file_name, sizeof(file_name), "%s.json", prefix);
+  f = fopen(file_name, "w");
+  if (f == NULL) {
+    log_snap.error("Unable to open convergence history file %s", file_name);
+    return;
+  }
+  fprintf(f, "{\n  \"convergence_eps\": %.8e,\n", Snap::convergence_eps);
+  fprintf(f, "  \"iterations\": [");
+  for (std::vector<ConvergenceRecord>::const_iterator it = 
+        history.begin(); it != history.end(); it++)
+  {
+    fprintf(f, "%s\n    {\"level\": \"%s\", \"time_step\": %d, "
+            "\"outer\": %d, ", (it == history.begin()) ? "" : ",",
+            it->outer ? "outer" : "inner", it->time_step, it->outer_loop);
+    if (it->outer)
+      fprintf(f, "\"inner\": null, ");
+    else
+      fprintf(f, "\"inner\": %d, ", it->inner_loop);
+    fprintf(f, "\"converged\": %s, \"max_df\": %.8e, \"time_us\": %lld}",
+            it->converged ? "true" : "false", it->max_df, it->time);
+  }
+  fprintf(f, "\n  ]\n}\n");
+  fclose(f);
+}
+
+//------------------------------------------------------------------------------
+double max_relative_change(const Rect<3> &bounds, 
+                           const AccessorRO<double,3> &fa_flux,
+                           const AccessorRO<double,3> &fa_prev)
+//------------------------------------------------------------------------------
+{
+  // Values that are essentially zero are compared absolutely
+  const double tolr = 1.0e-12;
+  const __m128d vtolr = _mm_set1_pd(tolr);
+  const __m128d one = _mm_set1_pd(1.0);
+  const __m128d sign_mask = _mm_set1_pd(-0.0);
+  const long long x_range = (bounds.hi[0] - bounds.lo[0]) + 1;
+  double max_df = 0.0;
+  for (long long z = bounds.lo[2]; z <= bounds.hi[2]; z++)
+  {
+    for (long long y = bounds.lo[1]; y <= bounds.hi[1]; y++)
+    {
+      const Point<3> row(bounds.lo[0], y, z);
+      const double *flux = fa_flux.ptr(row);
+      const double *prev = fa_prev.ptr(row);
+      __m128d vmax = _mm_set1_pd(max_df);
+      long long x = 0;
+      for ( ; (x + 1) < x_range; x += 2)
+      {
+        const __m128d p = _mm_loadu_pd(prev + x);
+        const __m128d small = _mm_cmplt_pd(_mm_andnot_pd(sign_mask, p), vtolr);
+        // Where the previous value is small divide by one and subtract zero
+        const __m128d denom = _mm_or_pd(_mm_and_pd(small, one), 
+                                        _mm_andnot_pd(small, p));
+        const __m128d base = _mm_andnot_pd(small, one);
+        const __m128d df = _mm_andnot_pd(sign_mask, 
+            _mm_sub_pd(_mm_div_pd(_mm_loadu_pd(flux + x), denom), base));
+        // Second operand comes back for NaNs so they never count
+        vmax = _mm_max_pd(df, vmax);
+      }
+      double lanes[2];
+      _mm_storeu_pd(lanes, vmax);
+      max_df = (lanes[0] > lanes[1]) ? lanes[0] : lanes[1];
+      for ( ; x < x_range; x++)
+      {
+        double p = prev[x];
+        double df = 1.0;
+        if (fabs(p) < tolr) {
+          p = 1.0;
+          df = 0.0;
+        }
+        df = fabs( (flux[x] / p) - df );
+        if (df > max_df)
+          max_df = df;
+      }
+    }
+  }
+  return max_df;
+}
+
+//------------------------------------------------------------------------------
+CompareFluxChange::CompareFluxChange(const Predicate &pred, double eps,
+                                     const std::vector<Future> &max_changes,
+                                     const Future &precondition,
+                                     const Future &pred_false_result)
+  : TaskLauncher(Snap::COMPARE_FLUX_CHANGE_TASK_ID, 
+                 TaskArgument(&epsi, sizeof(epsi)), pred), epsi(eps)
+//------------------------------------------------------------------------------
+{
+  add_future(precondition);
+  for (std::vector<Future>::const_iterator it = 
+        max_changes.begin(); it != max_changes.end(); it++)
+    add_future(*it);
+  predicate_false_future = pred_false_result;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void CompareFluxChange::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  char variant_name[128];
+  strcpy(variant_name, "CPU ");
+  strncat(variant_name, 
+      Snap::task_names[Snap::COMPARE_FLUX_CHANGE_TASK_ID], 123);
+  TaskVariantRegistrar registrar(Snap::COMPARE_FLUX_CHANGE_TASK_ID, 
+                                 true/*global*/, variant_name);
+  registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+  registrar.leaf_variant = true;
+  registrar.inner_variant = false;
+  Runtime::preregister_task_variant<bool, cpu_implementation>(registrar,
+      Snap::task_names[Snap::COMPARE_FLUX_CHANGE_TASK_ID]);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ bool CompareFluxChange::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+  assert(task->arglen == sizeof(double));
+  const double epsi = *((const double*)task->args);
+  assert(!task->futures.empty());
+  if (!task->futures[0].get_result<bool>(true/*silence warnings*/))
+    return false;
+  for (unsigned idx = 1; idx < task->futures.size(); idx++)
+    if (task->futures[idx].get_result<double>(true/*silence warnings*/) > epsi)
+      return false;
+  return true;
+}
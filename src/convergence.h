@@ -22,6 +22,9 @@
 #include "snap.h"
 #include "legion.h"
 
+#include <cmath>
+#include <vector>
+
 // This class will issue a chain of single task launches
 // that when executed will emulate the execution of a 
 // monad. We use them in SNAP to print out the convergence
@@ -29,6 +32,17 @@
 // various loops of SNAP
 class ConvergenceMonad {
 public:
+  // One row of the convergence history for an inner or outer iteration
+  struct ConvergenceRecord {
+  public:
+    bool outer; // outer iteration rather than an inner one
+    bool converged;
+    int time_step; // power iteration for k-eigenvalue problems
+    int outer_loop;
+    int inner_loop; // -1 for outer iterations
+    double max_df; // largest relative change in the scalar flux
+    long long time; // microseconds
+  };
   // This is the type data actually stored in the Monad
   struct MonadData {
   public:
@@ -38,12 +52,20 @@ public:
     int time_step_number;
     int inner_loop_number;
     int outer_loop_number;
+    int power_iteration_number;
   public:
     int total_inner_loops;
     int total_outer_loops;
+    long long total_group_sweeps; // groups swept over all the inner loops
     long long total_inner_time;
     long long total_outer_time;
     long long total_step_time;
+    double keff; // latest eigenvalue estimate of k-eigenvalue problems
+  public:
+    // Only the latest row of the history rides along in the monad, the 
+    // monad futures that made rows are kept and read once at the end
+    int num_records;
+    ConvergenceRecord record;
   };
 public:
   ConvergenceMonad(Context ctx, Runtime *runtime);
@@ -52,23 +74,71 @@ public:
 public:
   ConvergenceMonad& operator=(const ConvergenceMonad &rhs);
 public:
-  void bind_inner(const Predicate &pred, const Future &inner_converged);
-  void bind_outer(const Predicate &pred, const Future &outer_converged);
+  // The chunks_swept futures say whether each group chunk was swept in
+  // this inner iteration, chunk_groups are the groups that each one of
+  // them sweeps. The max flux changes from the convergence tests are 
+  // optional and only needed for the history.
+  void bind_inner(const Predicate &pred, const Future &inner_converged,
+                  const std::vector<Future> &chunks_swept,
+                  const std::vector<int> &chunk_groups,
+                  const std::vector<Future> &max_changes = 
+                                            std::vector<Future>());
+  void bind_outer(const Predicate &pred, const Future &outer_converged,
+                  const std::vector<Future> &max_changes = 
+                                            std::vector<Future>());
+  void bind_eigenvalue(const Predicate &pred, const Future &power_converged,
+                       const Future &keff);
 public:
   const Context ctx;
   Runtime *const runtime;
 protected:
   Future monad_future;
+  // Monad futures that may hold a new row of the history
+  std::vector<Future> history_futures;
 public:
   static void preregister_cpu_variants(void);
+  // Cells x angles x octants covered by the sweeps of one group
+  static double sweep_unknowns(void);
+  // Write <prefix>.csv and <prefix>.json
+  static void write_history(const char *prefix,
+                            const std::vector<ConvergenceRecord> &history);
 public:
   static MonadData bind_inner_implementation(const Task *task,
      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
   static MonadData bind_outer_implementation(const Task *task,
      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+  static MonadData bind_eigenvalue_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
   static void summary_implementation(const Task *task,
      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
 };
 
+// Largest relative change between two scalar fluxes over the cells of a
+// rectangle using the measure of the original SNAP convergence tests. 
+// Rows in x are contiguous so this runs two cells at a time with SSE2.
+double max_relative_change(const Rect<3> &bounds, 
+                           const AccessorRO<double,3> &fa_flux,
+                           const AccessorRO<double,3> &fa_prev);
+
+// The convergence tests reduce the largest change in the scalar flux so
+// it is there for the history, this single task compares those against
+// the tolerance to make the boolean future for a predicate. It only 
+// passes if the precondition future (e.g. inner convergence) is true.
+// Power iterations also use it for the relative change in the eigenvalue.
+class CompareFluxChange : public TaskLauncher {
+public:
+  CompareFluxChange(const Predicate &pred, double epsi,
+                    const std::vector<Future> &max_changes,
+                    const Future &precondition,
+                    const Future &pred_false_result);
+public:
+  double epsi;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static bool cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
 #endif // __SNAP_CONVERGENCE_H__
 
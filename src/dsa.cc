@@ -0,0 +1,441 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software 
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "snap.h"
+#include "dsa.h"
+
+extern Legion::Logger log_snap;
+
+static void dsa_group_fields(int group_start, int group_stop,
+                             std::vector<Snap::SnapFieldID> &fields)
+{
+  fields.resize((group_stop - group_start) + 1);
+  for (int group = group_start; group <= group_stop; group++)
+    fields[group-group_start] = SNAP_ENERGY_GROUP_FIELD(group);
+}
+
+// CG is done once the residual has dropped by the convergence epsilon
+static inline bool dsa_converged(double rr0, double rr)
+{
+  return (rr <= (Snap::convergence_eps * Snap::convergence_eps * rr0));
+}
+
+//------------------------------------------------------------------------------
+DSAInitialize::DSAInitialize(const Snap &snap, const Predicate &pred,
+                             const SnapArray<3> &s_xs, 
+                             const SnapArray<3> &flux0,
+                             const SnapArray<3> &flux0pi, 
+                             const SnapArray<3> &dsa_x,
+                             const SnapArray<3> &dsa_r, 
+                             const SnapArray<3> &dsa_p,
+                             const Future &zero_future, int start, int stop)
+  : SnapTask<DSAInitialize, Snap::DSA_INITIALIZE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  dsa_group_fields(group_start, group_stop, fields);
+  s_xs.add_projection_requirement(READ_ONLY, *this, fields);
+  flux0.add_projection_requirement(READ_ONLY, *this, fields);
+  flux0pi.add_projection_requirement(READ_ONLY, *this, fields);
+  dsa_x.add_projection_requirement(WRITE_DISCARD, *this, fields);
+  dsa_r.add_projection_requirement(WRITE_DISCARD, *this, fields);
+  dsa_p.add_projection_requirement(WRITE_DISCARD, *this, fields);
+  predicate_false_future = zero_future;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void DSAInitialize::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 6; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double DSAInitialize::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running DSA Initialize");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  // The source is the within-group scattering of the sweep's change
+  double rr = 0.0;
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<MomentQuad,3> fa_sxs(regions[0], field);
+    AccessorRO<double,3> fa_flux0(regions[1], field);
+    AccessorRO<double,3> fa_flux0pi(regions[2], field);
+    AccessorWO<double,3> fa_x(regions[3], field);
+    AccessorWO<double,3> fa_r(regions[4], field);
+    AccessorWO<double,3> fa_p(regions[5], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+    {
+      const double sxs = fa_sxs[*itr][0];
+      const double residual = sxs * (fa_flux0[*itr] - fa_flux0pi[*itr]);
+      fa_x[*itr] = 0.0;
+      fa_r[*itr] = residual;
+      fa_p[*itr] = residual;
+      rr += residual * residual;
+    }
+  }
+  return rr;
+#else
+  return 0.0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+DSAStencil::DSAStencil(const Snap &snap, const Predicate &pred,
+                       const SnapArray<3> &dsa_p, const SnapArray<3> &t_xs,
+                       const SnapArray<3> &s_xs, const SnapArray<3> &dsa_ap,
+                       const SnapArray<1> &vdelt, const Future &zero_future,
+                       int start, int stop)
+  : SnapTask<DSAStencil, Snap::DSA_STENCIL_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  dsa_group_fields(group_start, group_stop, fields);
+  // The direction and cross sections need a one cell halo
+  dsa_p.add_ghost_requirement(*this, snap.get_ghost_partition(), fields);
+  t_xs.add_ghost_requirement(*this, snap.get_ghost_partition(), fields);
+  s_xs.add_projection_requirement(READ_ONLY, *this, fields);
+  dsa_ap.add_projection_requirement(WRITE_DISCARD, *this, fields);
+  vdelt.add_region_requirement(READ_ONLY, *this, fields);
+  predicate_false_future = zero_future;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void DSAStencil::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 5; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double DSAStencil::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running DSA Stencil");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[3].region.get_index_space()));
+
+  const long long extents[3] = { Snap::nx, Snap::ny, Snap::nz };
+  const double widths[3] = { Snap::lx / double(Snap::nx), 
+                             Snap::ly / double(Snap::ny),
+                             Snap::lz / double(Snap::nz) };
+  double pap = 0.0;
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<double,3> fa_p(regions[0], field);
+    AccessorRO<double,3> fa_xs(regions[1], field);
+    AccessorRO<MomentQuad,3> fa_sxs(regions[2], field);
+    AccessorWO<double,3> fa_ap(regions[3], field);
+    const double vdelt = 
+      AccessorRO<double,1>(regions[4], field)[0];
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+    {
+      const double sigt = fa_xs[*itr] + vdelt;
+      const double diffusion = 1.0 / (3.0 * sigt);
+      const double removal = sigt - fa_sxs[*itr][0];
+      double diag = (removal > 0.0) ? removal : 0.0;
+      double offdiag = 0.0;
+      for (int dim = 0; dim < Snap::num_dims; dim++)
+      {
+        const double h = widths[dim];
+        for (int dir = -1; dir <= 1; dir += 2)
+        {
+          Point<3> neighbor = *itr;
+          neighbor[dim] += dir;
+          if ((neighbor[dim] < 0) || (neighbor[dim] >= extents[dim])) {
+            // Marshak vacuum condition on the domain boundary
+            diag += 2.0 * diffusion / (h * (h + 4.0 * diffusion));
+            continue;
+          }
+          // Harmonic mean of the diffusion coefficients on the face
+          const double other = 1.0 / (3.0 * (fa_xs[neighbor] + vdelt));
+          const double coupling = 
+            2.0 * diffusion * other / ((diffusion + other) * h * h);
+          diag += coupling;
+          offdiag += coupling * fa_p[neighbor];
+        }
+      }
+      const double p = fa_p[*itr];
+      const double ap = diag * p - offdiag;
+      fa_ap[*itr] = ap;
+      pap += p * ap;
+    }
+  }
+  return pap;
+#else
+  return 0.0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+DSAUpdate::DSAUpdate(const Snap &snap, const Predicate &pred,
+                     const SnapArray<3> &dsa_p, const SnapArray<3> &dsa_ap,
+                     const SnapArray<3> &dsa_x, const SnapArray<3> &dsa_r,
+                     const Future &rr0, const Future &rr, const Future &pap,
+                     const Future &zero_future, int start, int stop)
+  : SnapTask<DSAUpdate, Snap::DSA_UPDATE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  dsa_group_fields(group_start, group_stop, fields);
+  dsa_p.add_projection_requirement(READ_ONLY, *this, fields);
+  dsa_ap.add_projection_requirement(READ_ONLY, *this, fields);
+  dsa_x.add_projection_requirement(READ_WRITE, *this, fields);
+  dsa_r.add_projection_requirement(READ_WRITE, *this, fields);
+  add_future(rr0);
+  add_future(rr);
+  add_future(pap);
+  predicate_false_future = zero_future;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void DSAUpdate::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 4; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double DSAUpdate::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running DSA Update");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  const double rr0 = 
+    task->futures[0].get_result<double>(true/*silence warnings*/);
+  const double rr = 
+    task->futures[1].get_result<double>(true/*silence warnings*/);
+  const double pap = 
+    task->futures[2].get_result<double>(true/*silence warnings*/);
+  // Every point sees the same scalars so they all agree on stopping
+  const double alpha = 
+    (dsa_converged(rr0, rr) || (pap <= 0.0)) ? 0.0 : rr / pap;
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  double rr_new = 0.0;
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<double,3> fa_p(regions[0], field);
+    AccessorRO<double,3> fa_ap(regions[1], field);
+    AccessorRW<double,3> fa_x(regions[2], field);
+    AccessorRW<double,3> fa_r(regions[3], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+    {
+      const double r = fa_r[*itr] - alpha * fa_ap[*itr];
+      fa_x[*itr] = fa_x[*itr] + alpha * fa_p[*itr];
+      fa_r[*itr] = r;
+      rr_new += r * r;
+    }
+  }
+  return rr_new;
+#else
+  return 0.0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+DSADirection::DSADirection(const Snap &snap, const Predicate &pred,
+                           const SnapArray<3> &dsa_r, const SnapArray<3> &dsa_p,
+                           const Future &rr0, const Future &rr_old, 
+                           const Future &rr_new, int start, int stop)
+  : SnapTask<DSADirection, Snap::DSA_DIRECTION_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  dsa_group_fields(group_start, group_stop, fields);
+  dsa_r.add_projection_requirement(READ_ONLY, *this, fields);
+  dsa_p.add_projection_requirement(READ_WRITE, *this, fields);
+  add_future(rr0);
+  add_future(rr_old);
+  add_future(rr_new);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void DSADirection::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 2; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void DSADirection::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running DSA Direction");
+
+  const double rr0 = 
+    task->futures[0].get_result<double>(true/*silence warnings*/);
+  const double rr_old = 
+    task->futures[1].get_result<double>(true/*silence warnings*/);
+  const double rr_new = 
+    task->futures[2].get_result<double>(true/*silence warnings*/);
+  // Leave the direction alone once the update has stopped
+  if (dsa_converged(rr0, rr_old))
+    return;
+  const double beta = rr_new / rr_old;
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<double,3> fa_r(regions[0], field);
+    AccessorRW<double,3> fa_p(regions[1], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+      fa_p[*itr] = fa_r[*itr] + beta * fa_p[*itr];
+  }
+#endif
+}
+
+//------------------------------------------------------------------------------
+DSACorrect::DSACorrect(const Snap &snap, const Predicate &pred,
+                       const SnapArray<3> &dsa_x, const SnapArray<3> &flux0,
+                       int start, int stop)
+  : SnapTask<DSACorrect, Snap::DSA_CORRECT_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  dsa_group_fields(group_start, group_stop, fields);
+  dsa_x.add_projection_requirement(READ_ONLY, *this, fields);
+  flux0.add_projection_requirement(READ_WRITE, *this, fields);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void DSACorrect::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 2; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void DSACorrect::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running DSA Correct");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<double,3> fa_x(regions[0], field);
+    AccessorRW<double,3> fa_flux0(regions[1], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+      fa_flux0[*itr] = fa_flux0[*itr] + fa_x[*itr];
+  }
+#endif
+}
+
@@ -0,0 +1,115 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software 
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __DSA_H__
+#define __DSA_H__
+
+#include "snap.h"
+#include "legion.h"
+
+// Diffusion synthetic acceleration of the within-group source iteration:
+// after each sweep we solve -div(D grad f) + sigr f = sigs (flux0 - flux0pi)
+// with CG on a cell-centered 7-point stencil and add f to flux0. All the 
+// groups in a chunk share one CG so the scalars are reduction futures.
+
+class DSAInitialize : public SnapTask<DSAInitialize,
+                                      Snap::DSA_INITIALIZE_TASK_ID> {
+public:
+  DSAInitialize(const Snap &snap, const Predicate &pred, 
+                const SnapArray<3> &s_xs, const SnapArray<3> &flux0, 
+                const SnapArray<3> &flux0pi, const SnapArray<3> &dsa_x,
+                const SnapArray<3> &dsa_r, const SnapArray<3> &dsa_p,
+                const Future &zero_future, int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class DSAStencil : public SnapTask<DSAStencil, Snap::DSA_STENCIL_TASK_ID> {
+public:
+  DSAStencil(const Snap &snap, const Predicate &pred, 
+             const SnapArray<3> &dsa_p, const SnapArray<3> &t_xs, 
+             const SnapArray<3> &s_xs, const SnapArray<3> &dsa_ap, 
+             const SnapArray<1> &vdelt, const Future &zero_future, 
+             int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class DSAUpdate : public SnapTask<DSAUpdate, Snap::DSA_UPDATE_TASK_ID> {
+public:
+  DSAUpdate(const Snap &snap, const Predicate &pred, 
+            const SnapArray<3> &dsa_p, const SnapArray<3> &dsa_ap, 
+            const SnapArray<3> &dsa_x, const SnapArray<3> &dsa_r, 
+            const Future &rr0, const Future &rr, const Future &pap,
+            const Future &zero_future, int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class DSADirection : public SnapTask<DSADirection, 
+                                     Snap::DSA_DIRECTION_TASK_ID> {
+public:
+  DSADirection(const Snap &snap, const Predicate &pred, 
+               const SnapArray<3> &dsa_r, const SnapArray<3> &dsa_p, 
+               const Future &rr0, const Future &rr_old, const Future &rr_new,
+               int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class DSACorrect : public SnapTask<DSACorrect, Snap::DSA_CORRECT_TASK_ID> {
+public:
+  DSACorrect(const Snap &snap, const Predicate &pred, 
+             const SnapArray<3> &dsa_x, const SnapArray<3> &flux0,
+             int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+#endif // __DSA_H__
+
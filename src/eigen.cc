@@ -0,0 +1,289 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software 
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#include "snap.h"
+#include "eigen.h"
+
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+extern Legion::Logger log_snap;
+
+//------------------------------------------------------------------------------
+CalcFissionProduction::CalcFissionProduction(const Snap &snap, 
+                                             const Predicate &pred,
+                                             const SnapArray<3> &flux0,
+                                             const SnapArray<3> &mat,
+                                             const SnapArray<1> &nusigf,
+                                             const Future &pred_false_result)
+  : SnapTask<CalcFissionProduction, Snap::CALC_FISSION_PRODUCTION_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred)
+//------------------------------------------------------------------------------
+{
+  flux0.add_projection_requirement(READ_ONLY, *this);
+  mat.add_projection_requirement(READ_ONLY, *this, Snap::FID_SINGLE);
+  nusigf.add_region_requirement(READ_ONLY, *this);
+  predicate_false_future = pred_false_result;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void CalcFissionProduction::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 3; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double CalcFissionProduction::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running Calc Fission Production");
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  AccessorRO<int,3> fa_mat(regions[1], Snap::FID_SINGLE);
+  double result = 0.0;
+  for (int g = 0; g < Snap::num_groups; g++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(g);
+    AccessorRO<double,3> fa_flux0(regions[0], field);
+    AccessorRO<double,1> fa_nusigf(regions[2], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+      result += fa_nusigf[fa_mat[*itr]] * fa_flux0[*itr];
+  }
+  return result;
+#else
+  return 0.0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+CalcFissionSource::CalcFissionSource(const Snap &snap, const Predicate &pred,
+                                     const SnapArray<3> &flux0,
+                                     const SnapArray<3> &mat,
+                                     const SnapArray<1> &nusigf,
+                                     const SnapArray<1> &chi,
+                                     const SnapArray<3> &source,
+                                     const Future &keff, bool shifted,
+                                     int group_start, int group_stop)
+  : SnapTask<CalcFissionSource, Snap::CALC_FISSION_SOURCE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred)
+//------------------------------------------------------------------------------
+{
+  args.group_start = group_start;
+  args.group_stop = group_stop;
+  args.shifted = shifted;
+  global_arg = TaskArgument(&args, sizeof(args));
+  std::vector<Snap::SnapFieldID> fields((group_stop - group_start) + 1);
+  for (int group = group_start; group <= group_stop; group++)
+    fields[group-group_start] = SNAP_ENERGY_GROUP_FIELD(group);
+  // Fission couples all the groups like scattering in the outer source
+  flux0.add_projection_requirement(READ_ONLY, *this);
+  mat.add_projection_requirement(READ_ONLY, *this, Snap::FID_SINGLE);
+  nusigf.add_region_requirement(READ_ONLY, *this);
+  chi.add_region_requirement(READ_ONLY, *this, fields);
+  // The shifted part is added on top of the outer source
+  if (shifted)
+    source.add_projection_requirement(READ_WRITE, *this, fields);
+  else
+    source.add_projection_requirement(WRITE_DISCARD, *this, fields);
+  add_future(keff);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void CalcFissionSource::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 5; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void CalcFissionSource::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running Calc Fission Source");
+
+  const FissionArgs args = *((const FissionArgs*)task->args);
+  const double keff = 
+    task->futures[0].get_result<double>(true/*silence warnings*/);
+  // Without a shift all of the fission source is in the fixed part
+  double coefficient = 1.0 / keff;
+  if (Snap::wielandt_shift > 0.0) {
+    const double shifted = 1.0 / (keff + Snap::wielandt_shift);
+    coefficient = args.shifted ? shifted : (coefficient - shifted);
+  }
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  // Fission production of each cell first, then spread over the groups
+  std::vector<double> production(dom.bounds.volume(), 0.0);
+  AccessorRO<int,3> fa_mat(regions[1], Snap::FID_SINGLE);
+  for (int g = 0; g < Snap::num_groups; g++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(g);
+    AccessorRO<double,3> fa_flux0(regions[0], field);
+    AccessorRO<double,1> fa_nusigf(regions[2], field);
+    size_t index = 0;
+    for (DomainIterator<3> itr(dom); itr(); itr++, index++)
+      production[index] += fa_nusigf[fa_mat[*itr]] * fa_flux0[*itr];
+  }
+  const Point<1> dp(0);
+  for (int g = args.group_start; g <= args.group_stop; g++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(g);
+    AccessorRO<double,1> fa_chi(regions[3], field);
+    const double scale = coefficient * fa_chi[dp];
+    size_t index = 0;
+    if (args.shifted) {
+      AccessorRW<double,3> fa_source(regions[4], field);
+      for (DomainIterator<3> itr(dom); itr(); itr++, index++)
+        fa_source[*itr] = fa_source[*itr] + scale * production[index];
+    } else {
+      AccessorWO<double,3> fa_source(regions[4], field);
+      for (DomainIterator<3> itr(dom); itr(); itr++, index++)
+        fa_source[*itr] = scale * production[index];
+    }
+  }
+#endif
+}
+
+//------------------------------------------------------------------------------
+UpdateEigenvalue::UpdateEigenvalue(const Predicate &pred, const Future &keff,
+                                   const Future &old_production,
+                                   const Future &new_production)
+  : TaskLauncher(Snap::UPDATE_EIGENVALUE_TASK_ID, TaskArgument(NULL, 0), pred)
+//------------------------------------------------------------------------------
+{
+  add_future(keff);
+  add_future(old_production);
+  add_future(new_production);
+  predicate_false_future = keff;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void UpdateEigenvalue::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  char variant_name[128];
+  strcpy(variant_name, "CPU ");
+  strncat(variant_name, 
+      Snap::task_names[Snap::UPDATE_EIGENVALUE_TASK_ID], 123);
+  TaskVariantRegistrar registrar(Snap::UPDATE_EIGENVALUE_TASK_ID, 
+                                 true/*global*/, variant_name);
+  registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+  registrar.leaf_variant = true;
+  registrar.inner_variant = false;
+  Runtime::preregister_task_variant<double, cpu_implementation>(registrar,
+      Snap::task_names[Snap::UPDATE_EIGENVALUE_TASK_ID]);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double UpdateEigenvalue::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+  assert(task->futures.size() == 3);
+  const double keff = 
+    task->futures[0].get_result<double>(true/*silence warnings*/);
+  const double old_production = 
+    task->futures[1].get_result<double>(true/*silence warnings*/);
+  const double new_production = 
+    task->futures[2].get_result<double>(true/*silence warnings*/);
+  if ((old_production <= 0.0) || (new_production <= 0.0))
+    return keff;
+  // Production of the new flux over what the source was made from,
+  // with a shift only the part of the source that was fixed counts
+  if (Snap::wielandt_shift > 0.0) {
+    const double shifted = 1.0 / (keff + Snap::wielandt_shift);
+    return 1.0 / (shifted + 
+        (1.0 / keff - shifted) * old_production / new_production);
+  }
+  return keff * new_production / old_production;
+}
+
+//------------------------------------------------------------------------------
+CalcEigenvalueChange::CalcEigenvalueChange(const Predicate &pred, 
+                                           const Future &old_keff,
+                                           const Future &new_keff,
+                                           const Future &zero_future)
+  : TaskLauncher(Snap::CALC_EIGENVALUE_CHANGE_TASK_ID, 
+                 TaskArgument(NULL, 0), pred)
+//------------------------------------------------------------------------------
+{
+  add_future(old_keff);
+  add_future(new_keff);
+  predicate_false_future = zero_future;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void CalcEigenvalueChange::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  char variant_name[128];
+  strcpy(variant_name, "CPU ");
+  strncat(variant_name, 
+      Snap::task_names[Snap::CALC_EIGENVALUE_CHANGE_TASK_ID], 123);
+  TaskVariantRegistrar registrar(Snap::CALC_EIGENVALUE_CHANGE_TASK_ID, 
+                                 true/*global*/, variant_name);
+  registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+  registrar.leaf_variant = true;
+  registrar.inner_variant = false;
+  Runtime::preregister_task_variant<double, cpu_implementation>(registrar,
+      Snap::task_names[Snap::CALC_EIGENVALUE_CHANGE_TASK_ID]);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double CalcEigenvalueChange::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+  assert(task->futures.size() == 2);
+  const double old_keff = 
+    task->futures[0].get_result<double>(true/*silence warnings*/);
+  const double new_keff = 
+    task->futures[1].get_result<double>(true/*silence warnings*/);
+  return fabs(new_keff - old_keff) / new_keff;
+}
@@ -0,0 +1,102 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software 
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+
+#ifndef __EIGEN_H__
+#define __EIGEN_H__
+
+#include "snap.h"
+#include "legion.h"
+
+// Tasks for k-eigenvalue problems. Each power iteration solves a fixed
+// source problem with the fission source of the flux from the last one.
+// With a Wielandt shift k_e = k + shift the part of the fission source
+// divided by k_e is moved into the outer source and computed from the
+// latest flux, which makes each power iteration more expensive but 
+// shrinks the dominance ratio so far fewer of them are needed.
+
+// Fission production sum_g nusigf_g * phi_g over all cells and groups
+class CalcFissionProduction : public SnapTask<CalcFissionProduction,
+                                      Snap::CALC_FISSION_PRODUCTION_TASK_ID> {
+public:
+  CalcFissionProduction(const Snap &snap, const Predicate &pred,
+                        const SnapArray<3> &flux0, const SnapArray<3> &mat,
+                        const SnapArray<1> &nusigf, 
+                        const Future &pred_false_result);
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+// Fission source chi_g * c * sum_g' nusigf_g' * phi_g' for a range of 
+// groups. The fixed part of a power iteration overwrites qi with 
+// c = 1/k - 1/k_e and the shifted part adds c = 1/k_e to the outer source.
+class CalcFissionSource : public SnapTask<CalcFissionSource,
+                                          Snap::CALC_FISSION_SOURCE_TASK_ID> {
+public:
+  struct FissionArgs {
+  public:
+    int group_start;
+    int group_stop;
+    bool shifted;
+  };
+public:
+  CalcFissionSource(const Snap &snap, const Predicate &pred,
+                    const SnapArray<3> &flux0, const SnapArray<3> &mat,
+                    const SnapArray<1> &nusigf, const SnapArray<1> &chi,
+                    const SnapArray<3> &source, const Future &keff,
+                    bool shifted, int group_start, int group_stop);
+public:
+  FissionArgs args;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+// The next eigenvalue only depends on futures so it is a single task
+// that returns it, predicated-off power iterations keep the old one
+class UpdateEigenvalue : public TaskLauncher {
+public:
+  UpdateEigenvalue(const Predicate &pred, const Future &keff,
+                   const Future &old_production, 
+                   const Future &new_production);
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+// Relative change |k - k_old| / k of the eigenvalue over a power iteration,
+// which has to pass its own test as well as the change in the flux
+class CalcEigenvalueChange : public TaskLauncher {
+public:
+  CalcEigenvalueChange(const Predicate &pred, const Future &old_keff,
+                       const Future &new_keff, const Future &zero_future);
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+#endif // __EIGEN_H__
@@ -0,0 +1,513 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software 
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "snap.h"
+#include "gmres.h"
+
+#include <vector>
+
+extern Legion::Logger log_snap;
+
+static void gmres_group_fields(int group_start, int group_stop,
+                               std::vector<Snap::SnapFieldID> &fields)
+{
+  fields.resize((group_stop - group_start) + 1);
+  for (int group = group_start; group <= group_stop; group++)
+    fields[group-group_start] = SNAP_ENERGY_GROUP_FIELD(group);
+}
+
+//------------------------------------------------------------------------------
+GMRESInitialize::GMRESInitialize(const Snap &snap, const Predicate &pred,
+                                 const SnapArray<3> &flux0, 
+                                 const SnapArray<3> &flux0pi,
+                                 const SnapArray<3> &gmres_w,
+                                 const Future &zero_future, 
+                                 int start, int stop)
+  : SnapTask<GMRESInitialize, Snap::GMRES_INITIALIZE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  gmres_group_fields(group_start, group_stop, fields);
+  flux0.add_projection_requirement(READ_ONLY, *this, fields);
+  flux0pi.add_projection_requirement(READ_ONLY, *this, fields);
+  gmres_w.add_projection_requirement(WRITE_DISCARD, *this, fields);
+  predicate_false_future = zero_future;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void GMRESInitialize::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 3; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double GMRESInitialize::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running GMRES Initialize");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  // The sweep from the old flux minus the old flux is the initial residual
+  double rr = 0.0;
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<double,3> fa_flux0(regions[0], field);
+    AccessorRO<double,3> fa_flux0pi(regions[1], field);
+    AccessorWO<double,3> fa_w(regions[2], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+    {
+      const double residual = fa_flux0[*itr] - fa_flux0pi[*itr];
+      fa_w[*itr] = residual;
+      rr += residual * residual;
+    }
+  }
+  return rr;
+#else
+  return 0.0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+GMRESNormalize::GMRESNormalize(const Snap &snap, const Predicate &pred,
+                               const SnapArray<3> &gmres_w, 
+                               const SnapArray<3> &basis,
+                               const Future &norm2, int start, int stop)
+  : SnapTask<GMRESNormalize, Snap::GMRES_NORMALIZE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  gmres_group_fields(group_start, group_stop, fields);
+  gmres_w.add_projection_requirement(READ_ONLY, *this, fields);
+  basis.add_projection_requirement(WRITE_DISCARD, *this, fields);
+  add_future(norm2);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void GMRESNormalize::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 2; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void GMRESNormalize::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running GMRES Normalize");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  const double norm2 = 
+    task->futures[0].get_result<double>(true/*silence warnings*/);
+  // A zero vector means the Krylov space is exhausted
+  const double scale = (norm2 > 0.0) ? 1.0 / sqrt(norm2) : 0.0;
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<double,3> fa_w(regions[0], field);
+    AccessorWO<double,3> fa_v(regions[1], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+      fa_v[*itr] = scale * fa_w[*itr];
+  }
+#endif
+}
+
+//------------------------------------------------------------------------------
+GMRESSource::GMRESSource(const Snap &snap, const Predicate &pred,
+                         const SnapArray<3> &s_xs, const SnapArray<3> &basis,
+                         const SnapArray<3> &qtot, int start, int stop)
+  : SnapTask<GMRESSource, Snap::GMRES_SOURCE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  gmres_group_fields(group_start, group_stop, fields);
+  s_xs.add_projection_requirement(READ_ONLY, *this, fields);
+  basis.add_projection_requirement(READ_ONLY, *this, fields);
+  qtot.add_projection_requirement(WRITE_DISCARD, *this, fields);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void GMRESSource::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 3; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void GMRESSource::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running GMRES Source");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  // Only the isotropic self-scattering of the Krylov vector, the
+  // sweep then applies D L^-1 to it with no external source
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<MomentQuad,3> fa_sxs(regions[0], field);
+    AccessorRO<double,3> fa_v(regions[1], field);
+    AccessorWO<MomentQuad,3> fa_qtot(regions[2], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+    {
+      MomentQuad quad;
+      quad[0] = fa_v[*itr] * fa_sxs[*itr][0];
+      for (int l = 1; l < 4; l++)
+        quad[l] = 0.0;
+      fa_qtot[*itr] = quad;
+    }
+  }
+#endif
+}
+
+//------------------------------------------------------------------------------
+GMRESDot::GMRESDot(const Snap &snap, const Predicate &pred,
+                   const SnapArray<3> &basis_i, const SnapArray<3> &basis_j,
+                   const SnapArray<3> &gmres_w, const Future &zero_future,
+                   int start, int stop)
+  : SnapTask<GMRESDot, Snap::GMRES_DOT_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  gmres_group_fields(group_start, group_stop, fields);
+  basis_i.add_projection_requirement(READ_ONLY, *this, fields);
+  basis_j.add_projection_requirement(READ_ONLY, *this, fields);
+  gmres_w.add_projection_requirement(READ_ONLY, *this, fields);
+  predicate_false_future = zero_future;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void GMRESDot::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 3; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double GMRESDot::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running GMRES Dot");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  // w still holds the sweep of v_j so the operator is v_j - w
+  double dot = 0.0;
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<double,3> fa_vi(regions[0], field);
+    AccessorRO<double,3> fa_vj(regions[1], field);
+    AccessorRO<double,3> fa_w(regions[2], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+      dot += fa_vi[*itr] * (fa_vj[*itr] - fa_w[*itr]);
+  }
+  return dot;
+#else
+  return 0.0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+GMRESOrthogonalize::GMRESOrthogonalize(const Snap &snap, const Predicate &pred,
+                              const std::vector<SnapArray<3>*> &basis, int j,
+                              const SnapArray<3> &gmres_w,
+                              const std::vector<Future> &dots,
+                              const Future &zero_future, int start, int stop)
+  : SnapTask<GMRESOrthogonalize, Snap::GMRES_ORTHOGONALIZE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  gmres_group_fields(group_start, group_stop, fields);
+  gmres_w.add_projection_requirement(READ_WRITE, *this, fields);
+  // Then v_0 through v_j, the last of which is the vector we swept
+  assert(int(dots.size()) == (j+1));
+  for (int i = 0; i <= j; i++)
+  {
+    basis[i]->add_projection_requirement(READ_ONLY, *this, fields);
+    add_future(dots[i]);
+  }
+  predicate_false_future = zero_future;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void GMRESOrthogonalize::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // The number of basis regions varies so only constrain the first two,
+  // the mapper makes SOA instances for all of them anyway
+  for (unsigned idx = 0; idx < 2; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double GMRESOrthogonalize::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running GMRES Orthogonalize");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  // Classical Gram-Schmidt: all the projections were computed up front
+  const int num_basis = regions.size() - 1;
+  assert(int(task->futures.size()) == num_basis);
+  std::vector<double> dots(num_basis);
+  for (int i = 0; i < num_basis; i++)
+    dots[i] = task->futures[i].get_result<double>(true/*silence warnings*/);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  double norm2 = 0.0;
+  std::vector<AccessorRO<double,3> > fa_basis(num_basis);
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRW<double,3> fa_w(regions[0], field);
+    for (int i = 0; i < num_basis; i++)
+      fa_basis[i] = AccessorRO<double,3>(regions[i+1], field);
+    const AccessorRO<double,3> &fa_vj = fa_basis[num_basis-1];
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+    {
+      double w = fa_vj[*itr] - fa_w[*itr];
+      for (int i = 0; i < num_basis; i++)
+        w -= dots[i] * fa_basis[i][*itr];
+      fa_w[*itr] = w;
+      norm2 += w * w;
+    }
+  }
+  return norm2;
+#else
+  return 0.0;
+#endif
+}
+
+//------------------------------------------------------------------------------
+GMRESUpdate::GMRESUpdate(const Snap &snap, const Predicate &pred,
+                         const SnapArray<3> &flux0pi, const SnapArray<3> &flux0,
+                         const std::vector<SnapArray<3>*> &basis,
+                         const std::vector<Future> &hessenberg,
+                         int start, int stop)
+  : SnapTask<GMRESUpdate, Snap::GMRES_UPDATE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred), group_start(start), group_stop(stop)
+//------------------------------------------------------------------------------
+{
+  global_arg = TaskArgument(&group_start, 2*sizeof(group_start));
+  std::vector<Snap::SnapFieldID> fields;
+  gmres_group_fields(group_start, group_stop, fields);
+  flux0pi.add_projection_requirement(READ_ONLY, *this, fields);
+  flux0.add_projection_requirement(WRITE_DISCARD, *this, fields);
+  for (unsigned idx = 0; idx < basis.size(); idx++)
+    basis[idx]->add_projection_requirement(READ_ONLY, *this, fields);
+  // The squared residual norm, then each column of the Hessenberg 
+  // matrix with the square of its subdiagonal entry last
+  const int m = basis.size();
+  assert(int(hessenberg.size()) == (1 + (m * (m + 3)) / 2));
+  for (unsigned idx = 0; idx < hessenberg.size(); idx++)
+    add_future(hessenberg[idx]);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void GMRESUpdate::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // The number of basis regions varies so only constrain the first three,
+  // the mapper makes SOA instances for all of them anyway
+  for (unsigned idx = 0; idx < 3; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/, 
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void GMRESUpdate::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running GMRES Update");
+
+  const int group_start = *((int*)task->args);
+  const int group_stop  = *(((int*)task->args) + 1);
+
+  // Every point task solves the same small least squares problem
+  const int m = regions.size() - 2;
+  std::vector<std::vector<double> > h(m+1, std::vector<double>(m, 0.0));
+  unsigned next = 0;
+  const double beta = 
+    sqrt(task->futures[next++].get_result<double>(true/*silence warnings*/));
+  for (int j = 0; j < m; j++)
+  {
+    for (int i = 0; i <= j; i++)
+      h[i][j] = 
+        task->futures[next++].get_result<double>(true/*silence warnings*/);
+    const double norm2 = 
+      task->futures[next++].get_result<double>(true/*silence warnings*/);
+    h[j+1][j] = (norm2 > 0.0) ? sqrt(norm2) : 0.0;
+  }
+  // Reduce to upper triangular with Givens rotations, stopping early
+  // if the residual vanishes or the Krylov space runs out
+  std::vector<double> g(m+1, 0.0), cs(m, 1.0), sn(m, 0.0);
+  g[0] = beta;
+  int k = 0;
+  while (k < m)
+  {
+    for (int i = 0; i < k; i++) {
+      const double temp = cs[i] * h[i][k] + sn[i] * h[i+1][k];
+      h[i+1][k] = -sn[i] * h[i][k] + cs[i] * h[i+1][k];
+      h[i][k] = temp;
+    }
+    const double denom = sqrt(h[k][k] * h[k][k] + h[k+1][k] * h[k+1][k]);
+    if (denom <= 1e-14 * beta)
+      break;
+    cs[k] = h[k][k] / denom;
+    sn[k] = h[k+1][k] / denom;
+    h[k][k] = denom;
+    h[k+1][k] = 0.0;
+    g[k+1] = -sn[k] * g[k];
+    g[k] = cs[k] * g[k];
+    k++;
+    if (fabs(g[k]) <= 1e-14 * beta)
+      break;
+  }
+  std::vector<double> y(m, 0.0);
+  for (int i = k-1; i >= 0; i--) {
+    double sum = g[i];
+    for (int j = i+1; j < k; j++)
+      sum -= h[i][j] * y[j];
+    y[i] = sum / h[i][i];
+  }
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+
+  std::vector<AccessorRO<double,3> > fa_basis(k);
+  for (int group = group_start; group <= group_stop; group++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(group);
+    AccessorRO<double,3> fa_flux0pi(regions[0], field);
+    AccessorWO<double,3> fa_flux0(regions[1], field);
+    for (int i = 0; i < k; i++)
+      fa_basis[i] = AccessorRO<double,3>(regions[i+2], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+    {
+      double flux = fa_flux0pi[*itr];
+      for (int i = 0; i < k; i++)
+        flux += y[i] * fa_basis[i][*itr];
+      fa_flux0[*itr] = flux;
+    }
+  }
+#endif
+}
+
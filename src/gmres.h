@@ -0,0 +1,131 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software 
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef __GMRES_H__
+#define __GMRES_H__
+
+#include "snap.h"
+#include "legion.h"
+
+// Restarted GMRES for the within-group problem (I - D L^-1 S) phi = D L^-1 q.
+// Each matrix-vector product is one pass of the normal Mini-KBA sweeps
+// with only the self-scattering source of the Krylov vector. The groups
+// in a chunk share one Krylov space and the scalars are reduction futures.
+
+class GMRESInitialize : public SnapTask<GMRESInitialize,
+                                        Snap::GMRES_INITIALIZE_TASK_ID> {
+public:
+  GMRESInitialize(const Snap &snap, const Predicate &pred,
+                  const SnapArray<3> &flux0, const SnapArray<3> &flux0pi,
+                  const SnapArray<3> &gmres_w, const Future &zero_future,
+                  int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class GMRESNormalize : public SnapTask<GMRESNormalize,
+                                       Snap::GMRES_NORMALIZE_TASK_ID> {
+public:
+  GMRESNormalize(const Snap &snap, const Predicate &pred,
+                 const SnapArray<3> &gmres_w, const SnapArray<3> &basis,
+                 const Future &norm2, int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class GMRESSource : public SnapTask<GMRESSource, Snap::GMRES_SOURCE_TASK_ID> {
+public:
+  GMRESSource(const Snap &snap, const Predicate &pred,
+              const SnapArray<3> &s_xs, const SnapArray<3> &basis,
+              const SnapArray<3> &qtot, int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class GMRESDot : public SnapTask<GMRESDot, Snap::GMRES_DOT_TASK_ID> {
+public:
+  GMRESDot(const Snap &snap, const Predicate &pred,
+           const SnapArray<3> &basis_i, const SnapArray<3> &basis_j,
+           const SnapArray<3> &gmres_w, const Future &zero_future,
+           int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class GMRESOrthogonalize : public SnapTask<GMRESOrthogonalize,
+                                      Snap::GMRES_ORTHOGONALIZE_TASK_ID> {
+public:
+  GMRESOrthogonalize(const Snap &snap, const Predicate &pred,
+                     const std::vector<SnapArray<3>*> &basis, int j,
+                     const SnapArray<3> &gmres_w, 
+                     const std::vector<Future> &dots,
+                     const Future &zero_future, 
+                     int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+class GMRESUpdate : public SnapTask<GMRESUpdate, Snap::GMRES_UPDATE_TASK_ID> {
+public:
+  GMRESUpdate(const Snap &snap, const Predicate &pred,
+              const SnapArray<3> &flux0pi, const SnapArray<3> &flux0,
+              const std::vector<SnapArray<3>*> &basis,
+              const std::vector<Future> &hessenberg,
+              int group_start, int group_stop);
+public:
+  const int group_start;
+  const int group_stop;
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+#endif // __GMRES_H__
+
@@ -444,12 +444,11 @@ __global__
 void gpu_outer_convergence(const Point<3> origin,
                            const AccessorRO<double,3> fa_flux0,
                            const AccessorRO<double,3> fa_flux0po,
-                           const double epsi, 
-                           const DeferredBuffer<int,1> results,
+                           const DeferredBuffer<double,1> results,
                            const int results_offset)
 {
   // We know there is never more than 32 warps in a CTA
-  __shared__ int trampoline[32];
+  __shared__ double trampoline[32];
 
   const int x = blockIdx.x * blockDim.x + threadIdx.x;
   const int y = blockIdx.y * blockDim.y + threadIdx.y;
@@ -469,49 +468,47 @@ void gpu_outer_convergence(const Point<3> origin,
   }
   double flux0 = *flux0_ptr;
   df = fabs( (flux0 / flux0po) - df );
-  int local_converged = 1;
-  if ((df >= -INFINITY) && (df > epsi))
-    local_converged = 0;
+  // NaNs are dropped by fmax so they never count
+  double local_max = df;
   // Perform a local reduction inside the CTA
   // Butterfly reduction across all threads in all warps
   for (int i = 16; i >= 1; i/=2)
-    local_converged += __shfl_xor_sync(0xfffffff, local_converged, i, 32);
+    local_max = fmax(local_max, __shfl_xor_sync(0xfffffff, local_max, i, 32));
   unsigned laneid;
   asm volatile("mov.u32 %0, %laneid;" : "=r"(laneid) : );
   unsigned warpid = 
     ((threadIdx.z * blockDim.y + threadIdx.y) * blockDim.x + threadIdx.x) >> 5;
   // First thread in each warp writes out all values
   if (laneid == 0)
-    trampoline[warpid] = local_converged;
+    trampoline[warpid] = local_max;
   __syncthreads();
   // Butterfly reduction across all thread in the first warp
   if (warpid == 0) {
     unsigned numwarps = (blockDim.x * blockDim.y * blockDim.z) >> 5;
-    local_converged = (laneid < numwarps) ? trampoline[laneid] : 0;
+    local_max = (laneid < numwarps) ? trampoline[laneid] : 0.0;
     for (int i = 16; i >= 1; i/=2)
-      local_converged += __shfl_xor_sync(0xfffffff, local_converged, i, 32);
-    // First thread does the atomic
+      local_max = fmax(local_max, __shfl_xor_sync(0xfffffff, local_max, i, 32));
+    // First thread writes out the block maximum
     if (laneid == 0)
       results.write(Point<1>(results_offset + 
-        (blockIdx.z * gridDim.y + blockIdx.y) * gridDim.x + blockIdx.x), local_converged);
+        (blockIdx.z * gridDim.y + blockIdx.y) * gridDim.x + blockIdx.x), local_max);
   }
 }
 
 __global__
-void gpu_sum_outer_convergence(const DeferredBuffer<int,1> buffer,
-                               const DeferredValue<bool> result,
-                               const size_t total_blocks, 
-                               const int expected)
+void gpu_max_outer_convergence(const DeferredBuffer<double,1> buffer,
+                               const DeferredValue<double> result,
+                               const size_t total_blocks)
 {
-  __shared__ int trampoline[32];
+  __shared__ double trampoline[32];
   int offset = threadIdx.x;
-  int total = 0;
+  double total = 0.0;
   while (offset < total_blocks) {
-    total += buffer.read(Point<1>(offset));
+    total = fmax(total, buffer.read(Point<1>(offset)));
     offset += blockDim.x;
   }
   for (int i = 16; i >= 1; i/=2)
-    total += __shfl_xor_sync(0xfffffff, total, i, 32);
+    total = fmax(total, __shfl_xor_sync(0xfffffff, total, i, 32));
   unsigned laneid;
   asm volatile("mov.u32 %0, %laneid;" : "=r"(laneid) : );
   unsigned warpid = threadIdx.x >> 5;
@@ -522,20 +519,19 @@ void gpu_sum_outer_convergence(const DeferredBuffer<int,1> buffer,
   if (warpid == 0)
   {
     unsigned numwarps = blockDim.x >> 5;
-    total = (laneid < numwarps) ? trampoline[laneid] : 0;
+    total = (laneid < numwarps) ? trampoline[laneid] : 0.0;
     for (int i = 16; i >= 1; i/=2)
-      total += __shfl_xor_sync(0xfffffff, total, i, 32);
+      total = fmax(total, __shfl_xor_sync(0xfffffff, total, i, 32));
     if (laneid == 0)
-      result.write(total == expected);
+      result.write(total);
   }
 }
 
 __host__
 void run_outer_convergence(Rect<3> subgrid_bounds,
-                           const DeferredValue<bool> &result,
+                           const DeferredValue<double> &result,
                            const std::vector<AccessorRO<double,3> > &fa_flux0,
-                           const std::vector<AccessorRO<double,3> > &fa_flux0po,
-                           const double epsi)
+                           const std::vector<AccessorRO<double,3> > &fa_flux0po)
 {
   
   // Launch the kernels
@@ -547,18 +543,17 @@ void run_outer_convergence(Rect<3> subgrid_bounds,
   const size_t total_blocks = grid.x*grid.y*grid.z;
   assert(fa_flux0.size() == fa_flux0po.size());
   const Rect<1> bounds(Point<1>(0),Point<1>(total_blocks * fa_flux0.size() - 1));
-  DeferredBuffer<int,1> buffer(bounds, Memory::GPU_FB_MEM);
+  DeferredBuffer<double,1> buffer(bounds, Memory::GPU_FB_MEM);
   for (unsigned idx = 0; idx < fa_flux0.size(); idx++) {
     gpu_outer_convergence<<<grid,block>>>(subgrid_bounds.lo,
                                           fa_flux0[idx], fa_flux0po[idx],
-                                          epsi, buffer, idx * total_blocks);
+                                          buffer, idx * total_blocks);
   }
   dim3 block2((bounds.hi[0]+1) > 1024 ? 1024 : (bounds.hi[0]+1),1,1);
   // Round up to the nearest multiple of warps
   while ((block2.x % 32) != 0)
     block2.x++;
   dim3 grid2(1,1,1);
-  const int expected = x_range * y_range * z_range * fa_flux0.size();
-  gpu_sum_outer_convergence<<<grid2,block2>>>(buffer, result, bounds.hi[0]+1, expected);
+  gpu_max_outer_convergence<<<grid2,block2>>>(buffer, result, bounds.hi[0]+1);
 }
 
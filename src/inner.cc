@@ -20,6 +20,7 @@
 
 #include "snap.h"
 #include "inner.h"
+#include "convergence.h"
 
 extern Legion::Logger log_snap;
 
@@ -219,7 +220,7 @@ TestInnerConvergence::TestInnerConvergence(const Snap &snap,
                                            const Predicate &pred,
                                            const SnapArray<3> &flux0,
                                            const SnapArray<3> &flux0pi,
-                                           const Future &true_future,
+                                           const Future &zero_future,
                                            int group_start, int group_stop)
   : SnapTask<TestInnerConvergence, Snap::TEST_INNER_CONVERGENCE_TASK_ID>(
       snap, snap.get_launch_bounds(), pred)
@@ -238,7 +239,7 @@ TestInnerConvergence::TestInnerConvergence(const Snap &snap,
     flux0.add_projection_requirement(READ_ONLY, *this, group_fields);
     flux0pi.add_projection_requirement(READ_ONLY, *this, group_fields);
   }
-  predicate_false_future = true_future;
+  predicate_false_future = zero_future;
 }
 
 //------------------------------------------------------------------------------
@@ -253,9 +254,9 @@ TestInnerConvergence::TestInnerConvergence(const Snap &snap,
   for (unsigned idx = 0; idx < 2; idx++)
     layout_constraints.add_layout_constraint(idx/*index*/,
                                              Snap::get_soa_layout());
-  register_cpu_variant<bool, cpu_implementation>(execution_constraints,
-                                                 layout_constraints,
-                                                 true/*leaf*/);
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
 }
 
 //------------------------------------------------------------------------------
@@ -273,14 +274,14 @@ TestInnerConvergence::TestInnerConvergence(const Snap &snap,
   for (unsigned idx = 0; idx < 2; idx++)
     layout_constraints.add_layout_constraint(idx/*index*/, 
                                              Snap::get_soa_layout());
-  register_gpu_variant<DeferredValue<bool>, gpu_implementation>(
+  register_gpu_variant<DeferredValue<double>, gpu_implementation>(
                                                  execution_constraints,
                                                  layout_constraints,
                                                  true/*leaf*/);
 }
 
 //------------------------------------------------------------------------------
-/*static*/ bool TestInnerConvergence::cpu_implementation(const Task *task,
+/*static*/ double TestInnerConvergence::cpu_implementation(const Task *task,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
 //------------------------------------------------------------------------------
 {
@@ -292,9 +293,9 @@ TestInnerConvergence::TestInnerConvergence(const Snap &snap,
          task->regions[1].region.get_index_space());
   Domain<3> dom = runtime->get_index_space_domain(ctx, 
           IndexSpace<3>(task->regions[0].region.get_index_space()));
-  const double tolr = 1.0e-12;
-  const double epsi = Snap::convergence_eps;
-  // Iterate over all the energy groups
+  // The largest change over all the energy groups gets compared
+  // against the tolerance after the reduction over the points
+  double max_df = 0.0;
   assert(task->regions[0].privilege_fields.size() == 
          task->regions[1].privilege_fields.size());
   for (std::set<FieldID>::const_iterator it = 
@@ -303,47 +304,35 @@ TestInnerConvergence::TestInnerConvergence(const Snap &snap,
   {
     AccessorRO<double,3> fa_flux0(regions[0], *it);
     AccessorRO<double,3> fa_flux0pi(regions[1], *it);
-    for (DomainIterator<3> itr(dom); itr(); itr++)
-    {
-      double flux0pi = fa_flux0pi[*itr];
-      double df = 1.0;
-      if (fabs(flux0pi) < tolr) {
-        flux0pi = 1.0;
-        df = 0.0;
-      }
-      double flux0 = fa_flux0[*itr];
-      df = fabs( (flux0 / flux0pi) - df );
-      if (df > epsi)
-        return false;
-    }
+    const double df = max_relative_change(dom.bounds, fa_flux0, fa_flux0pi);
+    if (df > max_df)
+      max_df = df;
   }
-  return true;
+  return max_df;
 #else
-  return false;
+  return INFINITY;
 #endif
 }
 
 #ifdef USE_GPU_KERNELS
 extern void run_inner_convergence(const Rect<3> subgrid_bounds,
-                            const DeferredValue<bool> &result,
+                            const DeferredValue<double> &result,
                             const std::vector<AccessorRO<double,3> > &fa_flux0,
-                            const std::vector<AccessorRO<double,3> > &fa_flux0pi,
-                            const double epsi);
+                            const std::vector<AccessorRO<double,3> > &fa_flux0pi);
 #endif
 
 //------------------------------------------------------------------------------
-/*static*/ DeferredValue<bool> 
+/*static*/ DeferredValue<double> 
             TestInnerConvergence::gpu_implementation(const Task *task,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
 //------------------------------------------------------------------------------
 {
   log_snap.info("Running GPU Test Inner Convergence");
-  DeferredValue<bool> result(false);
+  DeferredValue<double> result(INFINITY);
 #ifndef NO_COMPUTE
 #ifdef USE_GPU_KERNELS
   Domain<3> dom = runtime->get_index_space_domain(ctx, 
           IndexSpace<3>(task->regions[0].region.get_index_space()));
-  const double epsi = Snap::convergence_eps;
 
   assert(task->regions[0].privilege_fields.size() == 
          task->regions[1].privilege_fields.size());
@@ -358,7 +347,7 @@ extern void run_inner_convergence(const Rect<3> subgrid_bounds,
     fa_flux0[idx] = AccessorRO<double,3>(regions[0], *it);
     fa_flux0pi[idx] = AccessorRO<double,3>(regions[1], *it);
   }
-  run_inner_convergence(dom.bounds, result, fa_flux0, fa_flux0pi, epsi);
+  run_inner_convergence(dom.bounds, result, fa_flux0, fa_flux0pi);
 #else
   assert(false);
 #endif
@@ -45,14 +45,14 @@ class TestInnerConvergence : public SnapTask<TestInnerConvergence,
 public:
   TestInnerConvergence(const Snap &snap, const Predicate &pred,
                        const SnapArray<3> &flux0, const SnapArray<3> &flux0pi,
-                       const Future &true_future, int group_start, int group_stop);
+                       const Future &zero_future, int group_start, int group_stop);
 public:
   static void preregister_cpu_variants(void);
   static void preregister_gpu_variants(void);
 public:
-  static bool cpu_implementation(const Task *task,
+  static double cpu_implementation(const Task *task,
      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
-  static DeferredValue<bool> gpu_implementation(const Task *task,
+  static DeferredValue<double> gpu_implementation(const Task *task,
      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
 };
 
@@ -19,12 +19,17 @@
 #include "snap.h"
 #include "sweep.h"
 
+#include <algorithm>
+
 //------------------------------------------------------------------------------
 Snap::SnapMapper::SnapMapper(MapperRuntime *rt, Machine machine, 
                              Processor local, const char *mapper_name)
   : DefaultMapper(rt, machine, local, mapper_name), has_variants(false)
 //------------------------------------------------------------------------------
 {
+#ifndef DISABLE_CORNER_AFFINITY
+  sweep_cache_cores = detect_cache_cores();
+#endif
   // Get our local memories
   {
     Machine::MemoryQuery sysmem_query(machine);
@@ -54,49 +59,70 @@ Snap::SnapMapper::SnapMapper(MapperRuntime *rt, Machine machine,
   }
   // Compute the local CPU and GPU mappings
   // TODO: make these topology aware
-  const Rect<3> bounds(Point<3>(0,0,0), Point<3>(nx_chunks, ny_chunks, nz_chunks));
   {
-    // Round robin these across nodes, not individual processors so we
+    // Block these across nodes, not individual processors so we
     // evenly distribute blocks of cells across the machine, then let 
     // individual nodes use field parallelism across processors
-    std::map<AddressSpace,Processor> node_cpus;
-    for (std::vector<Processor>::const_iterator it = remote_cpus.begin();
-          it != remote_cpus.end(); it++)
-    {
-      const AddressSpace space = it->address_space();
-      if (node_cpus.find(space) == node_cpus.end())
-        node_cpus[space] = *it;
-    }
-    for (RectIterator<3> pir(bounds); pir(); pir++) {
-      const Point<3> &p = *pir;
-      const int index = 
-        (p[2] * ny_chunks + p[1]) * nx_chunks + p[0];
-      std::map<AddressSpace,Processor>::const_iterator finder = 
-        node_cpus.find(index % node_cpus.size());
-      assert(finder != node_cpus.end());
-      global_cpu_mapping[p] = finder->second;
-    }
+    std::map<AddressSpace,std::vector<Processor> > node_cpus;
+    Machine::ProcessorQuery all_cpus(machine);
+    all_cpus.only_kind(Processor::LOC_PROC);
+    for (Machine::ProcessorQuery::iterator it = all_cpus.begin();
+          it != all_cpus.end(); it++)
+      node_cpus[it->address_space()].push_back(*it);
+    // Address spaces need not be numbered densely, so owners index
+    // the sorted list of them, which is also the order in which 
+    // map_replicate_task places the shards of the top-level task
+    for (std::map<AddressSpace,std::vector<Processor> >::const_iterator it = 
+          node_cpus.begin(); it != node_cpus.end(); it++)
+      node_spaces.push_back(it->first);
+    num_nodes = node_spaces.size();
+    deal_chunks(node_cpus, global_cpu_mapping);
   }
   {
-    // Round robin these across all GPUs
-    Machine::ProcessorQuery all_procs(machine);
-    all_procs.only_kind(Processor::TOC_PROC);
-    if (all_procs.count() > 0) {
-      std::vector<Processor> all_gpus(all_procs.count());
-      unsigned idx = 0;
-      for (Machine::ProcessorQuery::iterator it = all_procs.begin();
-            it != all_procs.end(); it++, idx++)
-        all_gpus[idx] = *it;
-      for (RectIterator<3> pir(bounds); pir(); pir++) {
-        const Point<3> &p = *pir;
-        const int index = 
-          (p[2] * ny_chunks + p[1]) * nx_chunks + p[0];
-        global_gpu_mapping[p] = all_gpus[index % all_gpus.size()];
-      }
+    Machine::ProcessorQuery all_gpus(machine);
+    all_gpus.only_kind(Processor::TOC_PROC);
+    if (all_gpus.count() > 0) {
+      std::map<AddressSpace,std::vector<Processor> > node_gpus;
+      for (Machine::ProcessorQuery::iterator it = all_gpus.begin();
+            it != all_gpus.end(); it++)
+        node_gpus[it->address_space()].push_back(*it);
+      deal_chunks(node_gpus, global_gpu_mapping);
     }
   }
 }
 
+//------------------------------------------------------------------------------
+void Snap::SnapMapper::deal_chunks(
+          const std::map<AddressSpace,std::vector<Processor> > &node_procs,
+          std::map<Point<3>,Processor> &mapping) const
+//------------------------------------------------------------------------------
+{
+  // Each node gets the same block of chunks as the sharding functor 
+  // gives its shard, then deals them round robin to its processors
+  for (unsigned owner = 0; owner < num_nodes; owner++) {
+    std::map<AddressSpace,std::vector<Processor> >::const_iterator 
+      finder = node_procs.find(node_spaces[owner]);
+    assert(finder != node_procs.end());
+    std::vector<Rect<3> > owned;
+    owned_chunks(owner, num_nodes, owned);
+    unsigned index = 0;
+    for (std::vector<Rect<3> >::const_iterator it = owned.begin();
+          it != owned.end(); it++)
+      for (RectIterator<3> pir(*it); pir(); pir++, index++)
+        mapping[*pir] = finder->second[index % finder->second.size()];
+  }
+}
+
+#ifdef SNAP_MAPPER_PROFILING
+//------------------------------------------------------------------------------
+Snap::SnapMapper::~SnapMapper(void)
+//------------------------------------------------------------------------------
+{
+  // Mappers are deleted when the runtime shuts down
+  report_mapper_profile();
+}
+#endif
+
 //------------------------------------------------------------------------------
 void Snap::SnapMapper::select_tunable_value(const MapperContext ctx,
                                             const Task& task,
@@ -193,6 +219,9 @@ void Snap::SnapMapper::map_copy(const MapperContext ctx,
                                       MapCopyOutput &output)
 //------------------------------------------------------------------------------
 {
+#ifdef SNAP_MAPPER_PROFILING
+  const unsigned long long start_ns = Realm::Clock::current_time_in_nanoseconds();
+#endif
   // See if we already know where the copy is going
   for (unsigned idx = 0; idx < copy.src_requirements.size(); idx++)
   {
@@ -323,6 +352,13 @@ void Snap::SnapMapper::map_copy(const MapperContext ctx,
   }
   runtime->acquire_instances(ctx, output.src_instances);
   runtime->acquire_instances(ctx, output.dst_instances);
+#ifdef SNAP_MAPPER_PROFILING
+  for (unsigned idx = 0; idx < output.dst_instances.size(); idx++)
+    if (!output.dst_instances[idx].empty())
+      record_mapper_decision(MAP_COPY_CALL, COPY_PROFILE_KIND, Processor::NO_PROC,
+                             output.dst_instances[idx][0].get_location());
+  record_mapper_call(MAP_COPY_CALL, COPY_PROFILE_KIND, start_ns);
+#endif
 }
 
 //------------------------------------------------------------------------------
@@ -355,6 +391,9 @@ void Snap::SnapMapper::slice_task(const MapperContext ctx,
                                         SliceTaskOutput &output)
 //------------------------------------------------------------------------------
 {
+#ifdef SNAP_MAPPER_PROFILING
+  const unsigned long long start_ns = Realm::Clock::current_time_in_nanoseconds();
+#endif
   if (!has_variants)
     update_variants(ctx);
   // Iterate over the points and assign them to the best target processors
@@ -369,14 +408,69 @@ void Snap::SnapMapper::slice_task(const MapperContext ctx,
   const bool use_gpu = !local_gpus.empty() &&
     (gpu_variants.find((SnapTaskID)task.task_id) != gpu_variants.end());
 #endif
-  for (RectIterator<3> pir(all_points); pir(); pir++) {
-    TaskSlice slice;
-    slice.domain = Domain<3>(Rect<3>(*pir, *pir));
-    slice.proc = use_gpu ? global_gpu_mapping[*pir]:global_cpu_mapping[*pir];
-    slice.recurse = false;
-    slice.stealable = false;
-    output.slices.push_back(slice);
+  const std::map<Point<3>,Processor> &mapping = 
+    use_gpu ? global_gpu_mapping : global_cpu_mapping;
+  // Chunks are blocked across nodes in linearized order, so if the first
+  // and last points have different owners we first make one slice for
+  // each node's block of points and let that node slice them itself
+  const unsigned first_owner = chunk_owner(all_points.lo, num_nodes);
+  const unsigned last_owner = chunk_owner(all_points.hi, num_nodes);
+  if (first_owner != last_owner) {
+    for (unsigned owner = first_owner; owner <= last_owner; owner++) {
+      std::vector<Rect<3> > owned;
+      owned_chunks(owner, num_nodes, owned);
+      for (std::vector<Rect<3> >::const_iterator it = owned.begin();
+            it != owned.end(); it++) {
+        const Rect<3> rect = all_points.intersection(*it);
+        if (rect.empty())
+          continue;
+        add_slice(task, rect, mapping, true/*recurse*/, output);
+      }
+    }
+  } else if (all_points.volume() > MAX_LEAF_SLICE_POINTS) {
+    // All the points are on one node, so halve the longest dimension 
+    // and let the processors that own each half keep slicing them
+    int dim = 0;
+    for (int i = 1; i < 3; i++)
+      if ((all_points.hi[i] - all_points.lo[i]) > 
+          (all_points.hi[dim] - all_points.lo[dim]))
+        dim = i;
+    const Legion::coord_t split = (all_points.lo[dim] + all_points.hi[dim]) / 2;
+    Rect<3> lower = all_points, upper = all_points;
+    lower.hi[dim] = split;
+    upper.lo[dim] = split + 1;
+    add_slice(task, lower, mapping, true/*recurse*/, output);
+    add_slice(task, upper, mapping, true/*recurse*/, output);
+  } else {
+    // Few enough points left to assign them to processors directly
+    for (RectIterator<3> pir(all_points); pir(); pir++)
+      add_slice(task, Rect<3>(*pir, *pir), mapping, false/*recurse*/, output);
   }
+#ifdef SNAP_MAPPER_PROFILING
+  record_mapper_call(SLICE_TASK_CALL, profile_kind(task.task_id), start_ns);
+#endif
+}
+
+//------------------------------------------------------------------------------
+void Snap::SnapMapper::add_slice(const Task &task, const Rect<3> &rect,
+                                 const std::map<Point<3>,Processor> &mapping,
+                                 bool recurse, SliceTaskOutput &output)
+//------------------------------------------------------------------------------
+{
+  // Every slice goes to the processor that the policy gives its first
+  // point, whether it is a point or a block that will be sliced again
+  std::map<Point<3>,Processor>::const_iterator finder = mapping.find(rect.lo);
+  assert(finder != mapping.end());
+  TaskSlice slice;
+  slice.domain = Domain<3>(rect);
+  slice.proc = finder->second;
+  slice.recurse = recurse;
+  slice.stealable = false;
+  output.slices.push_back(slice);
+#ifdef SNAP_MAPPER_PROFILING
+  record_mapper_decision(SLICE_TASK_CALL, profile_kind(task.task_id),
+                         slice.proc, Memory::NO_MEMORY);
+#endif
 }
 
 //------------------------------------------------------------------------------
@@ -401,6 +495,9 @@ void Snap::SnapMapper::map_task(const MapperContext ctx,
                                       MapTaskOutput &output)
 //------------------------------------------------------------------------------
 {
+#ifdef SNAP_MAPPER_PROFILING
+  const unsigned long long start_ns = Realm::Clock::current_time_in_nanoseconds();
+#endif
   if (!has_variants)
     update_variants(ctx);
   // Assume we are mapping on the target processor
@@ -418,6 +515,26 @@ void Snap::SnapMapper::map_task(const MapperContext ctx,
     case EXPAND_CROSS_SECTION_TASK_ID:
     case EXPAND_SCATTERING_CROSS_SECTION_TASK_ID:
     case MMS_SCALE_TASK_ID:
+    case DSA_INITIALIZE_TASK_ID:
+    case DSA_STENCIL_TASK_ID:
+    case DSA_UPDATE_TASK_ID:
+    case DSA_DIRECTION_TASK_ID:
+    case DSA_CORRECT_TASK_ID:
+    case GMRES_INITIALIZE_TASK_ID:
+    case GMRES_NORMALIZE_TASK_ID:
+    case GMRES_SOURCE_TASK_ID:
+    case GMRES_DOT_TASK_ID:
+    case GMRES_ORTHOGONALIZE_TASK_ID:
+    case GMRES_UPDATE_TASK_ID:
+    case ANDERSON_RESIDUAL_TASK_ID:
+    case ANDERSON_DOT_TASK_ID:
+    case ANDERSON_MIX_TASK_ID:
+    case EXTRAPOLATE_FLUX_TASK_ID:
+    case CALC_COARSE_BALANCE_TASK_ID:
+    case SOLVE_COARSE_REBALANCE_TASK_ID:
+    case APPLY_COARSE_REBALANCE_TASK_ID:
+    case CALC_FISSION_PRODUCTION_TASK_ID:
+    case CALC_FISSION_SOURCE_TASK_ID:
 #ifdef SNAP_USE_RELAXED_COHERENCE
     case TEST_OUTER_CONVERGENCE_TASK_ID:
     case TEST_INNER_CONVERGENCE_TASK_ID:
@@ -426,7 +543,11 @@ void Snap::SnapMapper::map_task(const MapperContext ctx,
         Memory target_mem;
         std::map<SnapTaskID,VariantID>::const_iterator finder = 
           gpu_variants.find((SnapTaskID)task.task_id);
-        if (finder != gpu_variants.end() && 
+        // The GPU outer source only handles all the groups at once so
+        // Gauss-Seidel passes over a subset of them stay on the CPU
+        const bool cpu_only = (task.task_id == CALC_OUTER_SOURCE_TASK_ID) &&
+          (task.regions[0].privilege_fields.size() < size_t(num_groups));
+        if (finder != gpu_variants.end() && !cpu_only &&
             (local_kind == Processor::TOC_PROC)) {
           output.chosen_variant = finder->second; 
 #ifdef LOCAL_MAP_TASKS
@@ -520,6 +641,10 @@ void Snap::SnapMapper::map_task(const MapperContext ctx,
 #endif
     case BIND_INNER_CONVERGENCE_TASK_ID:
     case BIND_OUTER_CONVERGENCE_TASK_ID:
+    case BIND_EIGENVALUE_TASK_ID:
+    case UPDATE_EIGENVALUE_TASK_ID:
+    case CALC_EIGENVALUE_CHANGE_TASK_ID:
+    case COMPARE_FLUX_CHANGE_TASK_ID:
       {
         // These tasks have no region requirements so they 
         // can go wherever on the cpus
@@ -537,7 +662,10 @@ void Snap::SnapMapper::map_task(const MapperContext ctx,
         Memory target_mem, reduction_mem, vdelt_mem;
         std::map<SnapTaskID,VariantID>::const_iterator finder = 
           gpu_variants.find((SnapTaskID)task.task_id);
-        if (finder != gpu_variants.end() && 
+        // Sweeps that fold the face leakage for coarse mesh rebalance
+        // only have CPU kernels for it so they stay on the CPU
+        const bool cpu_only = (task.regions.size() > 12);
+        if (finder != gpu_variants.end() && !cpu_only &&
             (local_kind == Processor::TOC_PROC)) {
           output.chosen_variant = finder->second; 
 #ifdef LOCAL_MAP_TASKS
@@ -563,6 +691,13 @@ void Snap::SnapMapper::map_task(const MapperContext ctx,
           target_mem = local_sysmem;
           reduction_mem = local_sysmem;
           vdelt_mem = local_sysmem;
+#endif
+#ifndef DISABLE_CORNER_AFFINITY
+          // Pin the sweep to the core that owns its corner and groups
+          const Processor affinity_proc = 
+            select_sweep_processor(task, output.target_procs);
+          output.target_procs.clear();
+          output.target_procs.push_back(affinity_proc);
 #endif
         }
         // qtot is normal
@@ -594,23 +729,130 @@ void Snap::SnapMapper::map_task(const MapperContext ctx,
 #endif
         }
         // Remaining arrays that are not vdelt are normal
-        const unsigned last_idx = task.regions.size() - 1;
-        for (unsigned idx = 4; idx < last_idx; idx++) {
+        const unsigned vdelt_idx = 11;
+        for (unsigned idx = 4; idx < vdelt_idx; idx++) {
           map_snap_array(ctx, task.regions[idx].region, target_mem, 
                          output.chosen_instances[idx]);
         }
         // Put vdelt in a special memory since it is read locally
-        map_snap_array(ctx, task.regions[last_idx].region, vdelt_mem,
-                       output.chosen_instances[last_idx]);
+        map_snap_array(ctx, task.regions[vdelt_idx].region, vdelt_mem,
+                       output.chosen_instances[vdelt_idx]);
+        if (task.regions.size() > 12) {
+#ifndef SNAP_USE_RELAXED_COHERENCE
+          // Coarse leakage is reduced just like the flux
+          default_create_custom_instances(ctx, task.target_proc,
+            reduction_mem, task.regions[12], 12/*index*/, dummy_fields,
+            dummy_constraints, false/*need check*/, output.chosen_instances[12]);
+#else
+          map_snap_array(ctx, task.regions[12].region, target_mem,
+                         output.chosen_instances[12]);
+#endif
+        }
         break;
       }
     default:
       {
         DefaultMapper::map_task(ctx, task, input, output);
+#ifdef SNAP_MAPPER_PROFILING
+        record_mapper_call(MAP_TASK_CALL, profile_kind(task.task_id), start_ns);
+#endif
         return;
       }
   }
   runtime->acquire_instances(ctx, output.chosen_instances);
+#ifdef SNAP_MAPPER_PROFILING
+  {
+    // Record the first target processor and the memory of the first instance
+    const Processor target = output.target_procs.empty() ? 
+      Processor::NO_PROC : output.target_procs[0];
+    Memory target_mem = Memory::NO_MEMORY;
+    for (unsigned idx = 0; idx < output.chosen_instances.size(); idx++) {
+      if (output.chosen_instances[idx].empty())
+        continue;
+      target_mem = output.chosen_instances[idx][0].get_location();
+      break;
+    }
+    record_mapper_decision(MAP_TASK_CALL, profile_kind(task.task_id),
+                           target, target_mem);
+  }
+  record_mapper_call(MAP_TASK_CALL, profile_kind(task.task_id), start_ns);
+#endif
+}
+
+//------------------------------------------------------------------------------
+void Snap::SnapMapper::map_replicate_task(const MapperContext ctx,
+                                          const Task &task,
+                                          const MapTaskInput &input,
+                                          const MapTaskOutput &default_output,
+                                                MapReplicateTaskOutput &output)
+//------------------------------------------------------------------------------
+{
+  DefaultMapper::map_replicate_task(ctx, task, input, default_output, output);
+  // Put the shards in the order of their address spaces so that shard i
+  // runs on node_spaces[i], the node that owns the chunks that the 
+  // sharding functor gives to shard i
+  std::vector<std::pair<AddressSpace,unsigned> > order;
+  for (unsigned idx = 0; idx < output.control_replication_map.size(); idx++)
+    order.push_back(std::make_pair(
+          output.control_replication_map[idx].address_space(), idx));
+  std::stable_sort(order.begin(), order.end());
+  std::vector<Processor> shard_procs(order.size());
+  std::vector<MapTaskOutput> shard_mappings(order.size());
+  for (unsigned idx = 0; idx < order.size(); idx++) {
+    shard_procs[idx] = output.control_replication_map[order[idx].second];
+    shard_mappings[idx] = output.task_mappings[order[idx].second];
+  }
+  output.control_replication_map.swap(shard_procs);
+  output.task_mappings.swap(shard_mappings);
+}
+
+//------------------------------------------------------------------------------
+void Snap::SnapMapper::select_sharding_functor(const MapperContext ctx,
+                                       const Task &task,
+                                       const SelectShardingFunctorInput &input,
+                                             SelectShardingFunctorOutput &output)
+//------------------------------------------------------------------------------
+{
+  // Single operations can go wherever the default mapper wants
+  if (!task.is_index_space) {
+    DefaultMapper::select_sharding_functor(ctx, task, input, output);
+    return;
+  }
+  output.chosen_functor = SPATIAL_SHARDING_ID;
+  // Each shard's points still get sliced across its node by slice_task
+  output.slice_recurse = true;
+}
+
+//------------------------------------------------------------------------------
+void Snap::SnapMapper::select_sharding_functor(const MapperContext ctx,
+                                       const Copy &copy,
+                                       const SelectShardingFunctorInput &input,
+                                             SelectShardingFunctorOutput &output)
+//------------------------------------------------------------------------------
+{
+  if (!copy.is_index_space) {
+    DefaultMapper::select_sharding_functor(ctx, copy, input, output);
+    return;
+  }
+  output.chosen_functor = SPATIAL_SHARDING_ID;
+  // Each shard's points still get sliced across its node by slice_task
+  output.slice_recurse = true;
+}
+
+//------------------------------------------------------------------------------
+void Snap::SnapMapper::select_sharding_functor(const MapperContext ctx,
+                                       const Legion::Fill &fill,
+                                       const SelectShardingFunctorInput &input,
+                                             SelectShardingFunctorOutput &output)
+//------------------------------------------------------------------------------
+{
+  if (!fill.is_index_space) {
+    DefaultMapper::select_sharding_functor(ctx, fill, input, output);
+    return;
+  }
+  output.chosen_functor = SPATIAL_SHARDING_ID;
+  // Each shard's points still get sliced across its node by slice_task
+  output.slice_recurse = true;
 }
 
 //------------------------------------------------------------------------------
@@ -629,7 +871,131 @@ void Snap::SnapMapper::update_variants(const MapperContext ctx)
     if (!variants.empty())
       gpu_variants[tid] = variants[0];
   }
+  // There are several CPU sweep variants so pick the best one for this node
+  if (cpu_variants.find(MINI_KBA_TASK_ID) != cpu_variants.end())
+    cpu_variants[MINI_KBA_TASK_ID] = select_sweep_variant(ctx);
+  has_variants = true;
+}
+
+//------------------------------------------------------------------------------
+Snap::SnapMapper::VariantID Snap::SnapMapper::select_sweep_variant(
+                                                      const MapperContext ctx)
+//------------------------------------------------------------------------------
+{
+  std::vector<VariantID> variants;
+  runtime->find_valid_variants(ctx, MINI_KBA_TASK_ID, variants, 
+                               Processor::LOC_PROC);
+  const std::set<VariantID> valid(variants.begin(), variants.end());
+  // Without LOCAL_MAP_TASKS we map on the node that runs the task so we
+  // can check the ISA of the processor that we are running on. The vector
+  // variants also need the angles to pack evenly into vectors.
+  if ((valid.find(MiniKBATask::AVX_VARIANT_ID) != valid.end()) &&
+      __builtin_cpu_supports("avx") && ((Snap::num_angles % 4) == 0))
+    return MiniKBATask::AVX_VARIANT_ID;
+  if ((valid.find(MiniKBATask::SSE_VARIANT_ID) != valid.end()) &&
+      __builtin_cpu_supports("sse4.1") && ((Snap::num_angles % 2) == 0))
+    return MiniKBATask::SSE_VARIANT_ID;
+  assert(valid.find(MiniKBATask::CPU_VARIANT_ID) != valid.end());
+  return MiniKBATask::CPU_VARIANT_ID;
+}
+
+#ifndef DISABLE_CORNER_AFFINITY
+//------------------------------------------------------------------------------
+Processor Snap::SnapMapper::select_sweep_processor(const Task &task,
+                                    const std::vector<Processor> &procs) const
+//------------------------------------------------------------------------------
+{
+  assert(!procs.empty());
+  assert(task.arglen == sizeof(MiniKBATask::MiniKBAArgs));
+  const MiniKBATask::MiniKBAArgs *args = 
+    reinterpret_cast<const MiniKBATask::MiniKBAArgs*>(task.args);
+  const Point<3> chunk = task.index_point;
+  // Chunks on a diagonal x+y+z=d are told apart by x and y alone
+  const long long position = chunk[0] * Snap::ny_chunks + chunk[1];
+  const int group_chunk = 
+    args->group_start / ((args->group_stop - args->group_start) + 1);
+  // Without a known cache topology just deal the sweeps round-robin
+  if ((sweep_cache_cores == 0) || (sweep_cache_cores >= procs.size()))
+    return procs[(position + args->corner + group_chunk) % procs.size()];
+  // Each corner gets its own cache domains, with more domains than
+  // corners the columns of chunks in z are split into contiguous blocks
+  // over them. All the energy group chunks of a corner and spatial chunk
+  // share a domain, so the ghost planes and the dinv/t_xs fields of the
+  // chunk stay in its cache, and they only differ by the core in it.
+  // Inside a domain the chunks of a wavefront diagonal are spread over 
+  // the cores by their position on the diagonal so it still runs in
+  // parallel. Processors left over after the last whole domain make a
+  // smaller domain of their own.
+  const unsigned domain_size = sweep_cache_cores;
+  const unsigned num_domains = (procs.size() + domain_size - 1) / domain_size;
+  const unsigned corners = Snap::num_corners;
+  const unsigned blocks_per_corner = 
+    (num_domains > corners) ? (num_domains / corners) : 1;
+  const long long columns = Snap::nx_chunks * Snap::ny_chunks;
+  const long long block = (position * blocks_per_corner) / columns;
+  const unsigned domain = 
+    (args->corner * blocks_per_corner + block) % num_domains;
+  const unsigned first = domain * domain_size;
+  const unsigned size = 
+    ((first + domain_size) <= procs.size()) ? domain_size : 
+                                              (procs.size() - first);
+  return procs[first + ((position + group_chunk) % size)];
+}
+
+//------------------------------------------------------------------------------
+static unsigned count_cpu_list(const char *path)
+//------------------------------------------------------------------------------
+{
+  // Parse a Linux cpu list like "0-3,8-11"
+  FILE *f = fopen(path, "r");
+  if (f == NULL)
+    return 0;
+  unsigned count = 0;
+  int lo, hi;
+  while (fscanf(f, "%d", &lo) == 1) {
+    hi = lo;
+    int next = fgetc(f);
+    if (next == '-') {
+      if (fscanf(f, "%d", &hi) != 1)
+        break;
+      next = fgetc(f);
+    }
+    count += (hi - lo) + 1;
+    if (next != ',')
+      break;
+  }
+  fclose(f);
+  return count;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ unsigned Snap::SnapMapper::detect_cache_cores(void)
+//------------------------------------------------------------------------------
+{
+  // Realm doesn't describe shared caches in the machine model so ask
+  // Linux how many cores share the last level cache of the first core.
+  // This assumes that the order of Realm's CPU processors follows the
+  // consecutive core IDs of sysfs, with the caches all the same size, 
+  // so if the cores don't divide evenly into caches we don't trust it
+  // and the sweeps are dealt round-robin instead.
+  unsigned cpus = 0;
+  for (int index = 3; (index >= 2) && (cpus == 0); index--) {
+    char path[128];
+    snprintf(path, sizeof(path),
+        "/sys/devices/system/cpu/cpu0/cache/index%d/shared_cpu_list", index);
+    cpus = count_cpu_list(path);
+  }
+  const unsigned threads = count_cpu_list(
+      "/sys/devices/system/cpu/cpu0/topology/thread_siblings_list");
+  const unsigned online = 
+    count_cpu_list("/sys/devices/system/cpu/online");
+  if ((cpus == 0) || (threads == 0) || (online == 0))
+    return 0;
+  if (((online % cpus) != 0) || ((cpus % threads) != 0))
+    return 0;
+  return (cpus >= threads) ? (cpus / threads) : 1;
 }
+#endif
 
 //------------------------------------------------------------------------------
 void Snap::SnapMapper::map_snap_array(const MapperContext ctx, 
@@ -675,6 +1041,97 @@ void Snap::SnapMapper::map_snap_array(const MapperContext ctx,
   local_instances[key] = result;
 }
 
+#ifdef SNAP_MAPPER_PROFILING
+//------------------------------------------------------------------------------
+Snap::SnapMapper::MapperCallProfile::MapperCallProfile(void)
+  : count(0), total_ns(0), min_ns(0), max_ns(0)
+//------------------------------------------------------------------------------
+{
+  for (int idx = 0; idx < MAPPER_LATENCY_BUCKETS; idx++)
+    buckets[idx] = 0;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ unsigned Snap::SnapMapper::profile_kind(Legion::TaskID task_id)
+//------------------------------------------------------------------------------
+{
+  // Runtime and library tasks are lumped together, they are not copies
+  if (task_id >= LAST_TASK_ID)
+    return OTHER_TASK_PROFILE_KIND;
+  return task_id;
+}
+
+//------------------------------------------------------------------------------
+void Snap::SnapMapper::record_mapper_call(MapperCallKind call, unsigned kind,
+                                          unsigned long long start_ns)
+//------------------------------------------------------------------------------
+{
+  const unsigned long long stop_ns = Realm::Clock::current_time_in_nanoseconds();
+  const unsigned long long latency = (stop_ns > start_ns) ? stop_ns - start_ns : 0;
+  std::lock_guard<std::mutex> guard(profile_lock);
+  MapperCallProfile &profile = call_profiles[call][kind];
+  if ((profile.count == 0) || (latency < profile.min_ns))
+    profile.min_ns = latency;
+  if (latency > profile.max_ns)
+    profile.max_ns = latency;
+  profile.count++;
+  profile.total_ns += latency;
+  // Bucket i holds latencies in [2^i,2^(i+1)) nanoseconds (bucket 0 from 0)
+  int bucket = 0;
+  while (((latency >> (bucket+1)) > 0) && (bucket < (MAPPER_LATENCY_BUCKETS-1)))
+    bucket++;
+  profile.buckets[bucket]++;
+}
+
+//------------------------------------------------------------------------------
+void Snap::SnapMapper::record_mapper_decision(MapperCallKind call, unsigned kind,
+                                              Processor proc, Memory memory)
+//------------------------------------------------------------------------------
+{
+  std::lock_guard<std::mutex> guard(profile_lock);
+  call_profiles[call][kind].decisions[std::pair<Processor,Memory>(proc,memory)]++;
+}
+
+//------------------------------------------------------------------------------
+void Snap::SnapMapper::report_mapper_profile(void) const
+//------------------------------------------------------------------------------
+{
+  static const char *const call_names[LAST_MAPPER_CALL] = 
+    { "map_task", "slice_task", "map_copy" };
+  std::lock_guard<std::mutex> guard(profile_lock);
+  for (int call = 0; call < LAST_MAPPER_CALL; call++) {
+    for (unsigned kind = 0; kind < NUM_PROFILE_KINDS; kind++) {
+      const MapperCallProfile &profile = call_profiles[call][kind];
+      if (profile.count == 0)
+        continue;
+      const char *kind_name = (kind < LAST_TASK_ID) ? task_names[kind] :
+        (kind == COPY_PROFILE_KIND) ? "Copy" : "Non-SNAP Task";
+      log_snap.print("Mapper " IDFMT " %s %s: %llu calls, "
+                     "min %.3f us, mean %.3f us, max %.3f us", local_proc.id,
+                     call_names[call], kind_name, profile.count,
+                     1e-3 * profile.min_ns, 
+                     1e-3 * profile.total_ns / profile.count,
+                     1e-3 * profile.max_ns);
+      for (int idx = 0; idx < MAPPER_LATENCY_BUCKETS; idx++) {
+        if (profile.buckets[idx] == 0)
+          continue;
+        log_snap.print("Mapper " IDFMT " %s %s:   [%llu ns, %llu ns) %llu calls",
+                       local_proc.id, call_names[call], kind_name, 
+                       (idx == 0) ? 0ULL : (1ULL << idx), (1ULL << (idx+1)),
+                       profile.buckets[idx]);
+      }
+      for (std::map<std::pair<Processor,Memory>,unsigned long long>::
+            const_iterator it = profile.decisions.begin(); 
+            it != profile.decisions.end(); it++)
+        log_snap.print("Mapper " IDFMT " %s %s:   processor " IDFMT 
+                       " memory " IDFMT " chosen %llu times", local_proc.id,
+                       call_names[call], kind_name, it->first.first.id,
+                       it->first.second.id, it->second);
+    }
+  }
+}
+#endif
+
 #ifdef LOCAL_MAP_TASKS
 //------------------------------------------------------------------------------
 Memory Snap::SnapMapper::get_associated_sysmem(Processor proc)
@@ -17,9 +17,11 @@
  */
 
 #include <cmath>
+#include <cstring>
 
 #include "snap.h"
 #include "outer.h"
+#include "convergence.h"
 
 extern Legion::Logger log_snap;
 
@@ -48,6 +50,37 @@ CalcOuterSource::CalcOuterSource(const Snap &snap, const Predicate &pred,
   }
 }
 
+//------------------------------------------------------------------------------
+CalcOuterSource::CalcOuterSource(const Snap &snap, const Predicate &pred,
+                         const SnapArray<3> &qi, const SnapArray<2> &slgg,
+                         const SnapArray<3> &mat, const SnapArray<3> &q2rgp0, 
+                         const SnapArray<3> &q2grpm, 
+                         const SnapArray<3> &flux0, const SnapArray<3> &fluxm,
+                         int group_start, int group_stop)
+  : SnapTask<CalcOuterSource, Snap::CALC_OUTER_SOURCE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred)
+//------------------------------------------------------------------------------
+{
+  // Gauss-Seidel version computes the source of a range of groups 
+  // from the current fluxes of all the groups
+  std::vector<Snap::SnapFieldID> fields((group_stop - group_start) + 1);
+  for (int group = group_start; group <= group_stop; group++)
+    fields[group-group_start] = SNAP_ENERGY_GROUP_FIELD(group);
+  qi.add_projection_requirement(READ_ONLY, *this, fields); // qi0
+  flux0.add_projection_requirement(READ_ONLY, *this); // flux0
+  slgg.add_region_requirement(READ_ONLY, *this, fields); // sxs_g
+  mat.add_projection_requirement(READ_ONLY, *this); // map
+  q2rgp0.add_projection_requirement(WRITE_DISCARD, *this, fields); // qo0
+  // Only have to initialize this if there are multiple moments
+  if (Snap::num_moments > 1) {
+    fluxm.add_projection_requirement(READ_ONLY, *this); // fluxm 
+    q2grpm.add_projection_requirement(WRITE_DISCARD, *this, fields); // qom
+  } else {
+    fluxm.add_projection_requirement(NO_ACCESS, *this); // fluxm 
+    q2grpm.add_projection_requirement(NO_ACCESS, *this, fields); // qom
+  }
+}
+
 //------------------------------------------------------------------------------
 /*static*/ void CalcOuterSource::preregister_cpu_variants(void)
 //------------------------------------------------------------------------------
@@ -114,31 +147,40 @@ static int gcd(int a, int b)
   Domain<3> dom = runtime->get_index_space_domain(ctx, 
           IndexSpace<3>(task->regions[0].region.get_index_space()));
   const bool multi_moment = (Snap::num_moments > 1);
-  const int num_groups = task->regions[0].privilege_fields.size();
-  assert(num_groups == int(task->regions[1].privilege_fields.size()));
-  assert(num_groups == int(task->regions[4].privilege_fields.size()));
+  // Fluxes come from all the groups, but with Gauss-Seidel ordering 
+  // we only compute the sources for some of them
+  const int num_groups = task->regions[1].privilege_fields.size();
+  const int num_out_groups = task->regions[0].privilege_fields.size();
+  assert(num_out_groups == int(task->regions[4].privilege_fields.size()));
   // Make the accessors for all the groups up front
-  std::vector<AccessorRO<double,3> > fa_qi0(num_groups);
+  std::vector<AccessorRO<double,3> > fa_qi0(num_out_groups);
   std::vector<AccessorRO<double,3> > fa_flux0(num_groups);
-  std::vector<AccessorRO<MomentQuad,2> > fa_slgg(num_groups);
-  std::vector<AccessorWO<double,3> > fa_qo0(num_groups);
+  std::vector<AccessorRO<MomentQuad,2> > fa_slgg(num_out_groups);
+  std::vector<AccessorWO<double,3> > fa_qo0(num_out_groups);
   std::vector<AccessorRO<MomentTriple,3> > fa_fluxm(multi_moment ? num_groups:0);
-  std::vector<AccessorWO<MomentTriple,3> > fa_qom(multi_moment ? num_groups : 0);
+  std::vector<AccessorWO<MomentTriple,3> > fa_qom(multi_moment ? num_out_groups:0);
+  std::vector<int> out_groups(num_out_groups);
   // Field spaces are all the same so this is safe
   int g = 0;
   for (std::set<FieldID>::const_iterator it = 
         task->regions[0].privilege_fields.begin(); it !=
         task->regions[0].privilege_fields.end(); it++, g++)
   {
+    out_groups[g] = *it - Snap::FID_GROUP_0;
     fa_qi0[g] = AccessorRO<double,3>(regions[0], *it);
-    fa_flux0[g] = AccessorRO<double,3>(regions[1], *it);
     fa_slgg[g] = AccessorRO<MomentQuad,2>(regions[2], *it);
     fa_qo0[g] = AccessorWO<double,3>(regions[4], *it);
     if (multi_moment)
-    {
-      fa_fluxm[g] = AccessorRO<MomentTriple,3>(regions[5], *it);
       fa_qom[g] = AccessorWO<MomentTriple,3>(regions[6], *it);
-    }
+  }
+  g = 0;
+  for (std::set<FieldID>::const_iterator it = 
+        task->regions[1].privilege_fields.begin(); it !=
+        task->regions[1].privilege_fields.end(); it++, g++)
+  {
+    fa_flux0[g] = AccessorRO<double,3>(regions[1], *it);
+    if (multi_moment)
+      fa_fluxm[g] = AccessorRO<MomentTriple,3>(regions[5], *it);
   }
   AccessorRO<int,3> fa_mat(regions[3], Snap::FID_SINGLE);
 
@@ -156,13 +198,13 @@ static int gcd(int a, int b)
           for (int i = 0; i < strip_size; i++) 
             flux_strip[g * strip_size + i] = fa_flux0[g][x+i][y][z];
         // We've loaded all the strips, now do the math
-        for (int g1 = 0; g1 < num_groups; g1++) {
+        for (int g1 = 0; g1 < num_out_groups; g1++) {
           for (int i = 0; i < strip_size; i++) {
             double qo0 = fa_qi0[g1][x+i][y][z];
             // Have to look up the the two materials separately 
             const int mat = fa_mat[x+i][y][z];
             for (int g2 = 0; g2 < num_groups; g2++) {
-              if (g1 == g2)
+              if (out_groups[g1] == g2)
                 continue;
               MomentQuad cs = fa_slgg[g1][mat][g2];
               qo0 += cs[0] * flux_strip[g2 * strip_size + i];
@@ -186,12 +228,12 @@ static int gcd(int a, int b)
             for (int i = 0; i < strip_size; i++)
               fluxm_strip[g * strip_size+ i] = fa_fluxm[g][x+i][y][z];
           // We've loaded all the strips, now do the math
-          for (int g1 = 0; g1 < num_groups; g1++) {
+          for (int g1 = 0; g1 < num_out_groups; g1++) {
             for (int i = 0; i < strip_size; i++) {
               const int mat = fa_mat[x+i][y][z];
               MomentTriple qom;
               for (int g2 = 0; g2 < num_groups; g2++) {
-                if (g1 == g2)
+                if (out_groups[g1] == g2)
                   continue;
                 int moment = 0;
                 MomentTriple csm;
@@ -288,8 +330,7 @@ TestOuterConvergence::TestOuterConvergence(const Snap &snap,
                                            const Predicate &pred,
                                            const SnapArray<3> &flux0,
                                            const SnapArray<3> &flux0po,
-                                           const Future &inner_converged,
-                                           const Future &true_future,
+                                           const Future &zero_future,
                                            int group_start, int group_stop)
   : SnapTask<TestOuterConvergence, Snap::TEST_OUTER_CONVERGENCE_TASK_ID>(
       snap, snap.get_launch_bounds(), pred)
@@ -308,8 +349,7 @@ TestOuterConvergence::TestOuterConvergence(const Snap &snap,
     flux0.add_projection_requirement(READ_ONLY, *this, group_fields);
     flux0po.add_projection_requirement(READ_ONLY, *this, group_fields);
   }
-  add_future(inner_converged);
-  predicate_false_future = true_future;
+  predicate_false_future = zero_future;
 }
 
 //------------------------------------------------------------------------------
@@ -324,9 +364,9 @@ TestOuterConvergence::TestOuterConvergence(const Snap &snap,
   for (unsigned idx = 0; idx < 2; idx++)
     layout_constraints.add_layout_constraint(idx/*index*/,
                                              Snap::get_soa_layout());
-  register_cpu_variant<bool, cpu_implementation>(execution_constraints,
-                                                 layout_constraints,
-                                                 true/*leaf*/);
+  register_cpu_variant<double, cpu_implementation>(execution_constraints,
+                                                   layout_constraints,
+                                                   true/*leaf*/);
 }
 
 //------------------------------------------------------------------------------
@@ -344,33 +384,28 @@ TestOuterConvergence::TestOuterConvergence(const Snap &snap,
   for (unsigned idx = 0; idx < 2; idx++)
     layout_constraints.add_layout_constraint(idx/*index*/, 
                                              Snap::get_soa_layout());
-  register_gpu_variant<DeferredValue<bool>, gpu_implementation>(
+  register_gpu_variant<DeferredValue<double>, gpu_implementation>(
                                                  execution_constraints,
                                                  layout_constraints,
                                                  true/*leaf*/);
 }
 
 //------------------------------------------------------------------------------
-/*static*/ bool TestOuterConvergence::cpu_implementation(const Task *task,
+/*static*/ double TestOuterConvergence::cpu_implementation(const Task *task,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
 //------------------------------------------------------------------------------
 {
 #ifndef NO_COMPUTE
   log_snap.info("Running Test Outer Convergence");
 
-  // If the inner loop didn't converge, then we can't either
-  assert(!task->futures.empty());
-  bool inner_converged = task->futures[0].get_result<bool>();
-  if (!inner_converged)
-    return false;
   // Get the index space domain for iteration
   assert(task->regions[0].region.get_index_space() == 
          task->regions[1].region.get_index_space());
   Domain<3> dom = runtime->get_index_space_domain(ctx, 
           IndexSpace<3>(task->regions[0].region.get_index_space()));
-  const double tolr = 1.0e-12;
-  const double epsi = 100.0 * Snap::convergence_eps;
-  // Iterate over all the energy groups
+  // The largest change over all the energy groups gets compared
+  // against the tolerance after the reduction over the points
+  double max_df = 0.0;
   assert(task->regions[0].privilege_fields.size() == 
          task->regions[1].privilege_fields.size());
   for (std::set<FieldID>::const_iterator it = 
@@ -379,58 +414,38 @@ TestOuterConvergence::TestOuterConvergence(const Snap &snap,
   {
     AccessorRO<double,3> fa_flux0(regions[0], *it);
     AccessorRO<double,3> fa_flux0po(regions[1], *it);
-    for (DomainIterator<3> itr(dom); itr(); itr++)
-    {
-      double flux0po = fa_flux0po[*itr];
-      double df = 1.0;
-      if (fabs(flux0po) < tolr) {
-        flux0po = 1.0;
-        df = 0.0;
-      }
-      double flux0 = fa_flux0[*itr];
-      df = fabs( (flux0 / flux0po) - df );
-      // Skip anything less than -INF
-      if (df < -INFINITY)
-        continue;
-      if (df > epsi)
-        return false;
-    }
+    const double df = max_relative_change(dom.bounds, fa_flux0, fa_flux0po);
+    if (df > max_df)
+      max_df = df;
   }
-  return true;
+  return max_df;
 #else
-  return false;
+  return INFINITY;
 #endif
 }
 
 #ifdef USE_GPU_KERNELS
 extern void run_outer_convergence(Rect<3> subgrid_bounds,
-                                  const DeferredValue<bool> &result,
+                                  const DeferredValue<double> &result,
                                   const std::vector<AccessorRO<double,3> > &fa_flux0,
-                                  const std::vector<AccessorRO<double,3> > &fa_flux0po,
-                                  const double epsi);
+                                  const std::vector<AccessorRO<double,3> > &fa_flux0po);
 #endif
 
 //------------------------------------------------------------------------------
-/*static*/ DeferredValue<bool> 
+/*static*/ DeferredValue<double> 
             TestOuterConvergence::gpu_implementation(const Task *task,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
 //------------------------------------------------------------------------------
 {
   log_snap.info("Running GPU Test Outer Convergence");
-  DeferredValue<bool> result(false);
+  DeferredValue<double> result(INFINITY);
 #ifndef NO_COMPUTE
 #ifdef USE_GPU_KERNELS
-  // If the inner loop didn't converge, then we can't either
-  assert(!task->futures.empty());
-  bool inner_converged = task->futures[0].get_result<bool>();
-  if (!inner_converged)
-    return result;
   // Get the index space domain for iteration
   assert(task->regions[0].region.get_index_space() == 
          task->regions[1].region.get_index_space());
   Domain<3> dom = runtime->get_index_space_domain(ctx, 
           IndexSpace<3>(task->regions[0].region.get_index_space()));
-  const double epsi = 100.0 * Snap::convergence_eps;
   std::vector<AccessorRO<double,3> > fa_flux0(
                           task->regions[0].privilege_fields.size());
   std::vector<AccessorRO<double,3> > fa_flux0po(fa_flux0.size());
@@ -442,7 +457,7 @@ extern void run_outer_convergence(Rect<3> subgrid_bounds,
     fa_flux0[idx]   = AccessorRO<double,3>(regions[0], *it);
     fa_flux0po[idx] = AccessorRO<double,3>(regions[1], *it);
   }
-  run_outer_convergence(dom.bounds, result, fa_flux0, fa_flux0po, epsi);
+  run_outer_convergence(dom.bounds, result, fa_flux0, fa_flux0po);
 #else
   assert(false);
 #endif
@@ -450,3 +465,436 @@ extern void run_outer_convergence(Rect<3> subgrid_bounds,
   return result;
 }
 
+
+//------------------------------------------------------------------------------
+ExtrapolateFlux::ExtrapolateFlux(const Snap &snap, const SnapArray<3> &flux0,
+                                 const SnapArray<3> &save, 
+                                 const SnapArray<3> *prev, double flux_weight,
+                                 double save_weight, double prev_weight)
+  : SnapTask<ExtrapolateFlux, Snap::EXTRAPOLATE_FLUX_TASK_ID>(
+      snap, snap.get_launch_bounds(), Predicate::TRUE_PRED)
+//------------------------------------------------------------------------------
+{
+  weights[0] = flux_weight;
+  weights[1] = save_weight;
+  weights[2] = prev_weight;
+  global_arg = TaskArgument(weights, sizeof(weights));
+  flux0.add_projection_requirement(READ_WRITE, *this);
+  // The save buffer only holds an older step if its weight is non-zero
+  if (save_weight != 0.0)
+    save.add_projection_requirement(READ_WRITE, *this);
+  else
+    save.add_projection_requirement(WRITE_DISCARD, *this);
+  if (prev != NULL)
+    prev->add_projection_requirement(READ_ONLY, *this);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void ExtrapolateFlux::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // The previous step is optional so only constrain the first two,
+  // the mapper makes SOA instances for all of them anyway
+  for (unsigned idx = 0; idx < 2; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/,
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void ExtrapolateFlux::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running Extrapolate Flux");
+
+  const double *weights = (const double*)task->args;
+  const bool has_prev = (regions.size() > 2);
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+  for (std::set<FieldID>::const_iterator it = 
+        task->regions[0].privilege_fields.begin(); it !=
+        task->regions[0].privilege_fields.end(); it++)
+  {
+    AccessorRW<double,3> fa_flux0(regions[0], *it);
+    AccessorRO<double,3> fa_prev;
+    if (has_prev)
+      fa_prev = AccessorRO<double,3>(regions[2], *it);
+    if (weights[1] != 0.0) {
+      AccessorRW<double,3> fa_save(regions[1], *it);
+      for (DomainIterator<3> itr(dom); itr(); itr++)
+      {
+        const double flux = fa_flux0[*itr];
+        double guess = weights[0] * flux + weights[1] * fa_save[*itr];
+        if (has_prev)
+          guess += weights[2] * fa_prev[*itr];
+        // Scalar fluxes are never negative, a steep decay could overshoot
+        fa_flux0[*itr] = (guess > 0.0) ? guess : 0.0;
+        fa_save[*itr] = flux;
+      }
+    } else {
+      AccessorWO<double,3> fa_save(regions[1], *it);
+      for (DomainIterator<3> itr(dom); itr(); itr++)
+      {
+        const double flux = fa_flux0[*itr];
+        double guess = weights[0] * flux;
+        if (has_prev)
+          guess += weights[2] * fa_prev[*itr];
+        fa_flux0[*itr] = (guess > 0.0) ? guess : 0.0;
+        fa_save[*itr] = flux;
+      }
+    }
+  }
+#endif
+}
+
+//------------------------------------------------------------------------------
+static inline Point<3> coarse_point(const Point<3> &origin, int term)
+//------------------------------------------------------------------------------
+{
+  // Terms of a chunk are laid out along x from the origin of its row
+  Point<3> point = origin;
+  point[0] += term;
+  return point;
+}
+
+//------------------------------------------------------------------------------
+CalcCoarseBalance::CalcCoarseBalance(const Snap &snap, const Predicate &pred,
+                                     const SnapArray<3> &flux0, 
+                                     const SnapArray<3> &qi,
+                                     const SnapArray<3> &t_xs, 
+                                     const SnapArray<3> &s_xs,
+                                     const SnapArray<3> &mat, 
+                                     const SnapArray<3> &balance,
+                                     const SnapArray<2> &slgg)
+  : SnapTask<CalcCoarseBalance, Snap::CALC_COARSE_BALANCE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred)
+//------------------------------------------------------------------------------
+{
+  flux0.add_projection_requirement(READ_ONLY, *this);
+  qi.add_projection_requirement(READ_ONLY, *this);
+  t_xs.add_projection_requirement(READ_ONLY, *this);
+  s_xs.add_projection_requirement(READ_ONLY, *this);
+  mat.add_projection_requirement(READ_ONLY, *this);
+  balance.add_projection_requirement(WRITE_DISCARD, *this);
+  // This one last since it's not a projection requirement
+  slgg.add_region_requirement(READ_ONLY, *this);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void CalcCoarseBalance::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 7; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/,
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void CalcCoarseBalance::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running Calc Coarse Balance");
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+  Domain<3> balance_dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[5].region.get_index_space()));
+  Domain<2> slgg_dom = runtime->get_index_space_domain(ctx,
+          IndexSpace<2>(task->regions[6].region.get_index_space()));
+  const Point<3> origin = balance_dom.bounds.lo;
+  const int num_groups = Snap::num_groups;
+  const int mat_lo = slgg_dom.bounds.lo[0];
+  const int num_mats = (slgg_dom.bounds.hi[0] - mat_lo) + 1;
+  // Balance sums over the chunk, the cell volumes are all the same so 
+  // they are left out just like the sweeps leave them out of the leakage.
+  // The flux is also summed by material so the scattering from the other
+  // groups can be formed without another pass over the cells.
+  std::vector<double> external(num_groups, 0.0);
+  std::vector<double> mat_flux(num_mats * num_groups, 0.0);
+  AccessorRO<int,3> fa_mat(regions[4], Snap::FID_SINGLE);
+  for (int g = 0; g < num_groups; g++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(g);
+    AccessorRO<double,3> fa_flux0(regions[0], field);
+    AccessorRO<double,3> fa_qi(regions[1], field);
+    AccessorRO<double,3> fa_t_xs(regions[2], field);
+    AccessorRO<MomentQuad,3> fa_s_xs(regions[3], field);
+    double removal = 0.0, flux = 0.0;
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+    {
+      const double phi = fa_flux0[*itr];
+      const MomentQuad s_xs = fa_s_xs[*itr];
+      // Scattering within the group is neither a loss nor a source
+      removal += (fa_t_xs[*itr] - s_xs[0]) * phi;
+      external[g] += fa_qi[*itr];
+      flux += phi;
+      mat_flux[(fa_mat[*itr] - mat_lo) * num_groups + g] += phi;
+    }
+    AccessorWO<double,3> fa_balance(regions[5], field);
+    fa_balance[coarse_point(origin, Snap::BALANCE_REMOVAL)] = removal;
+    fa_balance[coarse_point(origin, Snap::BALANCE_FLUX)] = flux;
+  }
+  for (int g = 0; g < num_groups; g++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(g);
+    AccessorRO<MomentQuad,2> fa_slgg(regions[6], field);
+    double source = external[g];
+    for (int m = 0; m < num_mats; m++)
+      for (int g2 = 0; g2 < num_groups; g2++) {
+        if (g2 == g)
+          continue;
+        MomentQuad cs = fa_slgg[mat_lo + m][g2];
+        source += cs[0] * mat_flux[m * num_groups + g2];
+      }
+    AccessorWO<double,3> fa_balance(regions[5], field);
+    fa_balance[coarse_point(origin, Snap::BALANCE_SOURCE)] = source;
+  }
+#endif
+}
+
+//------------------------------------------------------------------------------
+SolveCoarseRebalance::SolveCoarseRebalance(const Predicate &pred,
+                                           const SnapArray<3> &leakage,
+                                           const SnapArray<3> &balance)
+  : TaskLauncher(Snap::SOLVE_COARSE_REBALANCE_TASK_ID, 
+                 TaskArgument(NULL, 0), pred)
+//------------------------------------------------------------------------------
+{
+  leakage.add_region_requirement(READ_ONLY, *this);
+  balance.add_region_requirement(READ_WRITE, *this);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void SolveCoarseRebalance::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  char variant_name[128];
+  strcpy(variant_name, "CPU ");
+  strncat(variant_name, 
+      Snap::task_names[Snap::SOLVE_COARSE_REBALANCE_TASK_ID], 123);
+  TaskVariantRegistrar registrar(Snap::SOLVE_COARSE_REBALANCE_TASK_ID,
+                                 true/*global*/, variant_name);
+  registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+  // Both regions need to be SOA
+  for (unsigned idx = 0; idx < 2; idx++)
+    registrar.layout_constraints.add_layout_constraint(idx/*index*/,
+                                                       Snap::get_soa_layout());
+  registrar.leaf_variant = true;
+  registrar.inner_variant = false;
+  Runtime::preregister_task_variant<cpu_implementation>(registrar,
+      Snap::task_names[Snap::SOLVE_COARSE_REBALANCE_TASK_ID]);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void SolveCoarseRebalance::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running Solve Coarse Rebalance");
+
+  const int nx = Snap::nx_chunks;
+  const int ny = Snap::ny_chunks;
+  const int nz = Snap::nz_chunks;
+  const int num_chunks = nx * ny * nz;
+  // Gauss-Seidel sweeps forward and back over the chunks until the
+  // factors stop changing, the systems are M-matrices so this converges
+  const int max_sweeps = 1000;
+  std::vector<double> leakage(num_chunks * Snap::NUM_LEAKAGE_TERMS);
+  std::vector<double> diagonal(num_chunks), source(num_chunks);
+  std::vector<double> factors(num_chunks);
+  std::vector<bool> active(num_chunks);
+  for (int g = 0; g < Snap::num_groups; g++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(g);
+    AccessorRO<double,3> fa_leakage(regions[0], field);
+    AccessorRW<double,3> fa_balance(regions[1], field);
+    // Rebalancing chunk i by f_i in a group has to give back its balance
+    // with the partial currents from its neighbors scaled by theirs:
+    //   f_i * (leakage_i + removal_i) - sum_j f_j * current(j -> i) = source_i
+    bool any_active = false;
+    for (int i = 0; i < num_chunks; i++)
+    {
+      const Point<3> leakage_origin((i % nx) * Snap::NUM_LEAKAGE_TERMS,
+                                    (i / nx) % ny, i / (nx * ny));
+      const Point<3> balance_origin((i % nx) * Snap::NUM_BALANCE_TERMS,
+                                    (i / nx) % ny, i / (nx * ny));
+      double out = 0.0;
+      for (int face = 0; face < Snap::NUM_LEAKAGE_TERMS; face++) {
+        const double current = fa_leakage[coarse_point(leakage_origin, face)];
+        leakage[i * Snap::NUM_LEAKAGE_TERMS + face] = current;
+        out += current;
+      }
+      diagonal[i] = out + 
+        fa_balance[coarse_point(balance_origin, Snap::BALANCE_REMOVAL)];
+      source[i] = 
+        fa_balance[coarse_point(balance_origin, Snap::BALANCE_SOURCE)];
+      // Chunks without any flux in the group have nothing to rescale
+      active[i] = 
+        (fa_balance[coarse_point(balance_origin, Snap::BALANCE_FLUX)] > 0.0) &&
+        (diagonal[i] > 0.0);
+      if (active[i])
+        any_active = true;
+      factors[i] = 1.0;
+    }
+    bool converged = !any_active;
+    for (int sweep = 0; (sweep < max_sweeps) && !converged; sweep++)
+    {
+      double max_delta = 0.0;
+      for (int k = 0; k < 2*num_chunks; k++)
+      {
+        const int i = (k < num_chunks) ? k : (2*num_chunks - 1 - k);
+        if (!active[i])
+          continue;
+        const int x = i % nx;
+        const int y = (i / nx) % ny;
+        const int z = i / (nx * ny);
+        // What comes in through a face is what left the opposite face of
+        // the neighbor, nothing comes in through the vacuum boundaries
+        double in = source[i];
+        if (x > 0)
+          in += factors[i-1] * 
+            leakage[(i-1) * Snap::NUM_LEAKAGE_TERMS + Snap::LEAKAGE_POS_X];
+        if (x < (nx-1))
+          in += factors[i+1] * 
+            leakage[(i+1) * Snap::NUM_LEAKAGE_TERMS + Snap::LEAKAGE_NEG_X];
+        if (y > 0)
+          in += factors[i-nx] * 
+            leakage[(i-nx) * Snap::NUM_LEAKAGE_TERMS + Snap::LEAKAGE_POS_Y];
+        if (y < (ny-1))
+          in += factors[i+nx] * 
+            leakage[(i+nx) * Snap::NUM_LEAKAGE_TERMS + Snap::LEAKAGE_NEG_Y];
+        if (z > 0)
+          in += factors[i-nx*ny] * 
+            leakage[(i-nx*ny) * Snap::NUM_LEAKAGE_TERMS + Snap::LEAKAGE_POS_Z];
+        if (z < (nz-1))
+          in += factors[i+nx*ny] * 
+            leakage[(i+nx*ny) * Snap::NUM_LEAKAGE_TERMS + Snap::LEAKAGE_NEG_Z];
+        const double factor = in / diagonal[i];
+        const double scale = (factor > factors[i]) ? factor : factors[i];
+        if (scale > 0.0) {
+          const double delta = fabs(factor - factors[i]) / scale;
+          if (delta > max_delta)
+            max_delta = delta;
+        }
+        factors[i] = factor;
+      }
+      converged = (max_delta <= Snap::convergence_eps);
+    }
+    // Leave the group alone if the factors have no sensible answer
+    bool valid = converged;
+    if (!converged)
+      log_snap.warning("Coarse rebalance skipped group %d: the coarse "
+                       "system did not converge in %d sweeps", g, max_sweeps);
+    for (int i = 0; valid && (i < num_chunks); i++) {
+      if (std::isfinite(factors[i]) && (factors[i] >= 0.0))
+        continue;
+      log_snap.warning("Coarse rebalance skipped group %d: factor %g for "
+                       "chunk (%d,%d,%d)", g, factors[i], i % nx, 
+                       (i / nx) % ny, i / (nx * ny));
+      valid = false;
+    }
+    for (int i = 0; i < num_chunks; i++)
+    {
+      const Point<3> balance_origin((i % nx) * Snap::NUM_BALANCE_TERMS,
+                                    (i / nx) % ny, i / (nx * ny));
+      fa_balance[coarse_point(balance_origin, Snap::BALANCE_FACTOR)] = 
+        valid ? factors[i] : 1.0;
+    }
+  }
+#endif
+}
+
+//------------------------------------------------------------------------------
+ApplyCoarseRebalance::ApplyCoarseRebalance(const Snap &snap, 
+                                           const Predicate &pred,
+                                           const SnapArray<3> &flux0, 
+                                           const SnapArray<3> &fluxm,
+                                           const SnapArray<3> &balance)
+  : SnapTask<ApplyCoarseRebalance, Snap::APPLY_COARSE_REBALANCE_TASK_ID>(
+      snap, snap.get_launch_bounds(), pred)
+//------------------------------------------------------------------------------
+{
+  flux0.add_projection_requirement(READ_WRITE, *this);
+  // Only have to rescale this if there are multiple moments
+  if (Snap::num_moments > 1)
+    fluxm.add_projection_requirement(READ_WRITE, *this);
+  else
+    fluxm.add_projection_requirement(NO_ACCESS, *this);
+  balance.add_projection_requirement(READ_ONLY, *this);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void ApplyCoarseRebalance::preregister_cpu_variants(void)
+//------------------------------------------------------------------------------
+{
+  ExecutionConstraintSet execution_constraints;
+  // Need x86 CPU
+  execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+  TaskLayoutConstraintSet layout_constraints;
+  // All regions need to be SOA
+  for (unsigned idx = 0; idx < 3; idx++)
+    layout_constraints.add_layout_constraint(idx/*index*/,
+                                             Snap::get_soa_layout());
+  register_cpu_variant<cpu_implementation>(execution_constraints,
+                                           layout_constraints,
+                                           true/*leaf*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void ApplyCoarseRebalance::cpu_implementation(const Task *task,
+      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
+//------------------------------------------------------------------------------
+{
+#ifndef NO_COMPUTE
+  log_snap.info("Running Apply Coarse Rebalance");
+
+  Domain<3> dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[0].region.get_index_space()));
+  Domain<3> balance_dom = runtime->get_index_space_domain(ctx, 
+          IndexSpace<3>(task->regions[2].region.get_index_space()));
+  const Point<3> factor_point = 
+    coarse_point(balance_dom.bounds.lo, Snap::BALANCE_FACTOR);
+  const bool multi_moment = (Snap::num_moments > 1);
+  for (int g = 0; g < Snap::num_groups; g++)
+  {
+    const Snap::SnapFieldID field = SNAP_ENERGY_GROUP_FIELD(g);
+    AccessorRO<double,3> fa_balance(regions[2], field);
+    const double factor = fa_balance[factor_point];
+    if (factor == 1.0)
+      continue;
+    AccessorRW<double,3> fa_flux0(regions[0], field);
+    for (DomainIterator<3> itr(dom); itr(); itr++)
+      fa_flux0[*itr] = factor * fa_flux0[*itr];
+    if (multi_moment) {
+      AccessorRW<MomentTriple,3> fa_fluxm(regions[1], field);
+      for (DomainIterator<3> itr(dom); itr(); itr++)
+      {
+        MomentTriple fm = fa_fluxm[*itr];
+        for (int i = 0; i < 3; i++)
+          fm[i] *= factor;
+        fa_fluxm[*itr] = fm;
+      }
+    }
+  }
+#endif
+}
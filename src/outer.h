@@ -30,6 +30,11 @@ public:
                   const SnapArray<3> &mat, const SnapArray<3> &q2rgp0, 
                   const SnapArray<3> &q2grpm, const SnapArray<3> &flux0,
                   const SnapArray<3> &fluxm);
+  CalcOuterSource(const Snap &snap, const Predicate &pred,
+                  const SnapArray<3> &qi, const SnapArray<2> &slgg,
+                  const SnapArray<3> &mat, const SnapArray<3> &q2rgp0, 
+                  const SnapArray<3> &q2grpm, const SnapArray<3> &flux0,
+                  const SnapArray<3> &fluxm, int group_start, int group_stop);
 public:
   static void preregister_cpu_variants(void);
   static void preregister_gpu_variants(void);
@@ -45,15 +50,82 @@ class TestOuterConvergence : public SnapTask<TestOuterConvergence,
 public:
   TestOuterConvergence(const Snap &snap, const Predicate &pred,
                        const SnapArray<3> &flux0, const SnapArray<3> &flux0po,
-                       const Future &inner_converged, const Future &true_future,
-                       int group_start, int group_stop);
+                       const Future &zero_future, int group_start, int group_stop);
 public:
   static void preregister_cpu_variants(void);
   static void preregister_gpu_variants(void);
 public:
-  static bool cpu_implementation(const Task *task,
+  static double cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+  static DeferredValue<double> gpu_implementation(const Task *task,
      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
-  static DeferredValue<bool> gpu_implementation(const Task *task,
+};
+
+// Initial guess for the scalar flux of a new time step extrapolated from
+// the ends of the previous steps, which also gets saved for the next one
+class ExtrapolateFlux : public SnapTask<ExtrapolateFlux,
+                                        Snap::EXTRAPOLATE_FLUX_TASK_ID> {
+public:
+  ExtrapolateFlux(const Snap &snap, const SnapArray<3> &flux0,
+                  const SnapArray<3> &save, const SnapArray<3> *prev,
+                  double flux_weight, double save_weight, double prev_weight);
+public:
+  double weights[3];
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+// Coarse mesh rebalance with one coarse cell for each chunk of the 
+// spatial partition. The sweeps fold the partial currents out of each
+// face of a chunk from the ghost planes into the leakage array, this 
+// sums the rest of the balance of each chunk: the removal by absorption
+// and scattering out of the group, and the external source plus the
+// scattering into the group from the other groups.
+class CalcCoarseBalance : public SnapTask<CalcCoarseBalance,
+                                          Snap::CALC_COARSE_BALANCE_TASK_ID> {
+public:
+  CalcCoarseBalance(const Snap &snap, const Predicate &pred,
+                    const SnapArray<3> &flux0, const SnapArray<3> &qi,
+                    const SnapArray<3> &t_xs, const SnapArray<3> &s_xs,
+                    const SnapArray<3> &mat, const SnapArray<3> &balance,
+                    const SnapArray<2> &slgg);
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+// Solve for the factor of each chunk that makes its balance hold with
+// the currents coming in from its neighbors scaled by theirs. Each group
+// has its own system over all the chunks with the scattering from the
+// other groups held fixed, so this is a single task over the coarse 
+// arrays of every chunk.
+class SolveCoarseRebalance : public TaskLauncher {
+public:
+  SolveCoarseRebalance(const Predicate &pred, const SnapArray<3> &leakage,
+                       const SnapArray<3> &balance);
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
+     const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+};
+
+// Scale the flux of each chunk by the factors of its groups
+class ApplyCoarseRebalance : public SnapTask<ApplyCoarseRebalance,
+                                        Snap::APPLY_COARSE_REBALANCE_TASK_ID> {
+public:
+  ApplyCoarseRebalance(const Snap &snap, const Predicate &pred,
+                       const SnapArray<3> &flux0, const SnapArray<3> &fluxm,
+                       const SnapArray<3> &balance);
+public:
+  static void preregister_cpu_variants(void);
+public:
+  static void cpu_implementation(const Task *task,
      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
 };
 
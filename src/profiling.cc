@@ -0,0 +1,764 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software 
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "snap.h"
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+
+#ifdef SNAP_PERF_COUNTERS
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif
+
+#ifdef SNAP_TASK_PROFILING
+// Every thread that has run a task, only touched under the lock
+// when a thread records its first task and again at exit
+static std::mutex thread_profiles_lock;
+static std::vector<TaskProfiler::ThreadProfile*> thread_profiles;
+
+//------------------------------------------------------------------------------
+TaskProfiler::TaskKindProfile::TaskKindProfile(void)
+  : count(0), total_ns(0), min_ns(~0ULL), max_ns(0)
+//------------------------------------------------------------------------------
+{
+  memset(buckets, 0, sizeof(buckets));
+}
+
+//------------------------------------------------------------------------------
+void TaskProfiler::TaskKindProfile::record(unsigned long long ns)
+//------------------------------------------------------------------------------
+{
+  count++;
+  total_ns += ns;
+  if (ns < min_ns)
+    min_ns = ns;
+  if (ns > max_ns)
+    max_ns = ns;
+  buckets[bucket_index(ns)]++;
+}
+
+//------------------------------------------------------------------------------
+void TaskProfiler::TaskKindProfile::merge(const TaskKindProfile &rhs)
+//------------------------------------------------------------------------------
+{
+  count += rhs.count;
+  total_ns += rhs.total_ns;
+  if (rhs.min_ns < min_ns)
+    min_ns = rhs.min_ns;
+  if (rhs.max_ns > max_ns)
+    max_ns = rhs.max_ns;
+  for (int idx = 0; idx < NUM_BUCKETS; idx++)
+    buckets[idx] += rhs.buckets[idx];
+}
+
+//------------------------------------------------------------------------------
+unsigned long long TaskProfiler::TaskKindProfile::percentile(
+                                                          double fraction) const
+//------------------------------------------------------------------------------
+{
+  // Find the bucket holding the requested rank and clamp its midpoint
+  // to the observed range so small samples still report sensibly
+  const unsigned long long rank = 
+    (unsigned long long)(fraction * (count - 1)) + 1;
+  unsigned long long seen = 0;
+  for (int idx = 0; idx < NUM_BUCKETS; idx++) {
+    seen += buckets[idx];
+    if (seen < rank)
+      continue;
+    const unsigned long long value = bucket_midpoint(idx);
+    if (value < min_ns)
+      return min_ns;
+    if (value > max_ns)
+      return max_ns;
+    return value;
+  }
+  return max_ns;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void TaskProfiler::record_task(Snap::SnapTaskID task_id,
+                                          unsigned long long start_ns,
+                                          unsigned long long stop_ns)
+//------------------------------------------------------------------------------
+{
+  ThreadProfile *profile = get_thread_profile();
+  profile->kinds[task_id].record(stop_ns - start_ns);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void TaskProfiler::report(void)
+//------------------------------------------------------------------------------
+{
+  // The runtime and its loggers are gone by now so just use stdio
+  std::lock_guard<std::mutex> guard(thread_profiles_lock);
+  if (thread_profiles.empty())
+    return;
+  TaskKindProfile *totals = new TaskKindProfile[Snap::LAST_TASK_ID];
+  for (std::vector<ThreadProfile*>::const_iterator it = 
+        thread_profiles.begin(); it != thread_profiles.end(); it++)
+    for (int kind = 0; kind < Snap::LAST_TASK_ID; kind++)
+      totals[kind].merge((*it)->kinds[kind]);
+  printf("Task Profile for Node %d (%zd threads)\n", 
+         Snap::report_node, thread_profiles.size());
+  printf("  %-40s %10s %12s %12s %12s %12s %12s %12s\n", "Task", "Count",
+         "Total (ms)", "Min (us)", "Mean (us)", "P50 (us)", "P99 (us)", 
+         "Max (us)");
+  for (int kind = 0; kind < Snap::LAST_TASK_ID; kind++) {
+    const TaskKindProfile &profile = totals[kind];
+    if (profile.count == 0)
+      continue;
+    printf("  %-40s %10llu %12.3f %12.3f %12.3f %12.3f %12.3f %12.3f\n",
+           Snap::task_names[kind], profile.count, 1e-6 * profile.total_ns,
+           1e-3 * profile.min_ns, 1e-3 * profile.total_ns / profile.count,
+           1e-3 * profile.percentile(0.5), 1e-3 * profile.percentile(0.99),
+           1e-3 * profile.max_ns);
+  }
+  fflush(stdout);
+  delete [] totals;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ TaskProfiler::ThreadProfile* TaskProfiler::get_thread_profile(void)
+//------------------------------------------------------------------------------
+{
+  // Profiles are never freed since they must outlive their threads
+  static thread_local ThreadProfile *local_profile = NULL;
+  if (local_profile == NULL) {
+    local_profile = new ThreadProfile();
+    std::lock_guard<std::mutex> guard(thread_profiles_lock);
+    thread_profiles.push_back(local_profile);
+  }
+  return local_profile;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ int TaskProfiler::bucket_index(unsigned long long ns)
+//------------------------------------------------------------------------------
+{
+  // Values below 2^SUB_BUCKET_BITS get their own buckets, larger values
+  // are split into 2^SUB_BUCKET_BITS buckets per power of two
+  if (ns < (1ULL << SUB_BUCKET_BITS))
+    return ns;
+  const int exponent = 63 - __builtin_clzll(ns);
+  const int shift = exponent - SUB_BUCKET_BITS;
+  const int sub_bucket = (ns >> shift) & ((1 << SUB_BUCKET_BITS) - 1);
+  return ((shift + 1) << SUB_BUCKET_BITS) + sub_bucket;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ unsigned long long TaskProfiler::bucket_midpoint(int index)
+//------------------------------------------------------------------------------
+{
+  if (index < (1 << SUB_BUCKET_BITS))
+    return index;
+  const int shift = (index >> SUB_BUCKET_BITS) - 1;
+  const unsigned long long sub_bucket = 
+    (1ULL << SUB_BUCKET_BITS) + (index & ((1 << SUB_BUCKET_BITS) - 1));
+  return (sub_bucket << shift) + ((1ULL << shift) >> 1);
+}
+
+#endif // SNAP_TASK_PROFILING
+
+#ifdef SNAP_TASK_TRACING
+// Event buffers for every thread that has run a task, only touched
+// under the lock when a thread records its first task and again at exit
+static std::mutex thread_events_lock;
+static std::vector<std::vector<TaskTracer::TraceEvent>*> thread_events;
+static int trace_node = -1;
+
+//------------------------------------------------------------------------------
+/*static*/ void TaskTracer::record_task(Snap::SnapTaskID task_id,
+                                        const Task *task, Processor proc,
+                                        unsigned long long start_ns,
+                                        unsigned long long stop_ns)
+//------------------------------------------------------------------------------
+{
+  TraceEvent event;
+  event.task_id = task_id;
+  event.proc = proc;
+  event.point = task->index_point;
+  event.group_start = -1;
+  event.group_stop = -1;
+  event.corner_start = -1;
+  event.corner_stop = -1;
+  event.start_ns = start_ns;
+  event.stop_ns = stop_ns;
+  // Recover the energy groups and corners from the fields of the task
+  for (unsigned idx = 0; idx < task->regions.size(); idx++) {
+    const std::set<FieldID> &fields = task->regions[idx].privilege_fields;
+    for (std::set<FieldID>::const_iterator it = 
+          fields.begin(); it != fields.end(); it++) {
+      int group = -1, corner = -1;
+      if ((*it >= Snap::FID_GROUP_0) && (*it < Snap::FID_GROUP_MAX))
+        group = *it - Snap::FID_GROUP_0;
+      else if ((*it >= Snap::FID_FLUX_START) && (*it < Snap::FID_FLUX_MAX)) {
+        group = (*it - Snap::FID_FLUX_START) / 8;
+        corner = (*it - Snap::FID_FLUX_START) % 8;
+      }
+      if (group >= 0) {
+        if ((event.group_start < 0) || (group < event.group_start))
+          event.group_start = group;
+        if (group > event.group_stop)
+          event.group_stop = group;
+      }
+      if (corner >= 0) {
+        if ((event.corner_start < 0) || (corner < event.corner_start))
+          event.corner_start = corner;
+        if (corner > event.corner_stop)
+          event.corner_stop = corner;
+      }
+    }
+  }
+  get_thread_events()->push_back(event);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void TaskTracer::write_trace(void)
+//------------------------------------------------------------------------------
+{
+  std::lock_guard<std::mutex> guard(thread_events_lock);
+  if (thread_events.empty())
+    return;
+  char file_name[64];
+  snprintf(file_name, sizeof(file_name), "snap_trace_%d.json", trace_node);
+  FILE *f = fopen(file_name, "w");
+  if (f == NULL) {
+    fprintf(stderr, "SNAP unable to open trace file %s\n", file_name);
+    return;
+  }
+  // Give every processor its own row in the timeline
+  std::map<Processor,unsigned> proc_rows;
+  for (std::vector<std::vector<TraceEvent>*>::const_iterator it = 
+        thread_events.begin(); it != thread_events.end(); it++)
+    for (std::vector<TraceEvent>::const_iterator ev = 
+          (*it)->begin(); ev != (*it)->end(); ev++)
+      proc_rows.insert(std::pair<Processor,unsigned>(ev->proc, 0));
+  unsigned next_row = 0;
+  fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+  fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+             "\"args\":{\"name\":\"Node %d\"}}", trace_node, trace_node);
+  for (std::map<Processor,unsigned>::iterator it = 
+        proc_rows.begin(); it != proc_rows.end(); it++) {
+    it->second = next_row++;
+    fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,"
+               "\"tid\":%d,\"args\":{\"name\":\"%s " IDFMT "\"}}", 
+               trace_node, it->second, 
+               (it->first.kind() == Processor::TOC_PROC) ? "GPU" : "CPU",
+               it->first.id);
+  }
+  for (std::vector<std::vector<TraceEvent>*>::const_iterator it = 
+        thread_events.begin(); it != thread_events.end(); it++) {
+    for (std::vector<TraceEvent>::const_iterator ev = 
+          (*it)->begin(); ev != (*it)->end(); ev++) {
+      char point[64];
+      int offset = snprintf(point, sizeof(point), "(");
+      for (int i = 0; i < ev->point.get_dim(); i++)
+        offset += snprintf(point + offset, sizeof(point) - offset, 
+                           (i == 0) ? "%lld" : ",%lld", ev->point[i]);
+      snprintf(point + offset, sizeof(point) - offset, ")");
+      fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"task\",\"ph\":\"X\","
+                 "\"pid\":%d,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f,"
+                 "\"args\":{\"point\":\"%s\",\"processor\":\"" IDFMT "\","
+                 "\"group_start\":%d,\"group_stop\":%d,"
+                 "\"corner_start\":%d,\"corner_stop\":%d}}",
+                 Snap::task_names[ev->task_id], trace_node, 
+                 proc_rows[ev->proc], 1e-3 * ev->start_ns, 
+                 1e-3 * (ev->stop_ns - ev->start_ns), point, ev->proc.id,
+                 ev->group_start, ev->group_stop, 
+                 ev->corner_start, ev->corner_stop);
+    }
+  }
+  fprintf(f, "\n]}\n");
+  fclose(f);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ std::vector<TaskTracer::TraceEvent>* 
+                                        TaskTracer::get_thread_events(void)
+//------------------------------------------------------------------------------
+{
+  // Buffers are never freed since they must outlive their threads
+  static thread_local std::vector<TraceEvent> *local_events = NULL;
+  if (local_events == NULL) {
+    local_events = new std::vector<TraceEvent>();
+    local_events->reserve(4096);
+    std::lock_guard<std::mutex> guard(thread_events_lock);
+    thread_events.push_back(local_events);
+    if (trace_node < 0)
+      trace_node = Processor::get_executing_processor().address_space();
+  }
+  return local_events;
+}
+
+#endif // SNAP_TASK_TRACING
+
+#ifdef SNAP_PERF_COUNTERS
+// Counters for every thread that has run a task, only touched under
+// the lock when a thread records its first task and again at exit
+static std::mutex thread_counters_lock;
+static std::vector<PerfCounters::ThreadCounters*> thread_counters;
+
+//------------------------------------------------------------------------------
+PerfCounters::ThreadCounters::ThreadCounters(void)
+  : group_fd(-1), num_counters(0)
+//------------------------------------------------------------------------------
+{
+  for (int idx = 0; idx < LAST_COUNTER; idx++)
+    positions[idx] = -1;
+  memset(tasks, 0, sizeof(tasks));
+  memset(totals, 0, sizeof(totals));
+}
+
+//------------------------------------------------------------------------------
+static int open_perf_counter(unsigned type, unsigned long long config, 
+                             int group_fd)
+//------------------------------------------------------------------------------
+{
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = type;
+  attr.config = config;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  // Count this thread on whichever core it runs
+  return syscall(__NR_perf_event_open, &attr, 0/*this thread*/, 
+                 -1/*any cpu*/, group_fd, 0/*flags*/);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void PerfCounters::read_counters(Sample &sample)
+//------------------------------------------------------------------------------
+{
+  ThreadCounters *counters = get_thread_counters();
+  memset(sample.values, 0, sizeof(sample.values));
+  if (counters->group_fd < 0)
+    return;
+  // Group reads come back as the number of counters then each value
+  unsigned long long buffer[1 + LAST_COUNTER];
+  const ssize_t expected = (1 + counters->num_counters) * sizeof(buffer[0]);
+  if (read(counters->group_fd, buffer, sizeof(buffer)) != expected)
+    return;
+  for (int kind = 0; kind < LAST_COUNTER; kind++)
+    if (counters->positions[kind] >= 0)
+      sample.values[kind] = buffer[1 + counters->positions[kind]];
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void PerfCounters::record_task(Snap::SnapTaskID task_id,
+                                          const Sample &start)
+//------------------------------------------------------------------------------
+{
+  Sample stop;
+  read_counters(stop);
+  ThreadCounters *counters = get_thread_counters();
+  counters->tasks[task_id]++;
+  for (int kind = 0; kind < LAST_COUNTER; kind++)
+    counters->totals[task_id][kind] += stop.values[kind] - start.values[kind];
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void PerfCounters::report(void)
+//------------------------------------------------------------------------------
+{
+  // The runtime and its loggers are gone by now so just use stdio
+  std::lock_guard<std::mutex> guard(thread_counters_lock);
+  if (thread_counters.empty())
+    return;
+  unsigned long long tasks[Snap::LAST_TASK_ID];
+  unsigned long long totals[Snap::LAST_TASK_ID][LAST_COUNTER];
+  memset(tasks, 0, sizeof(tasks));
+  memset(totals, 0, sizeof(totals));
+  bool available[LAST_COUNTER] = { false, false, false, false };
+  for (std::vector<ThreadCounters*>::const_iterator it = 
+        thread_counters.begin(); it != thread_counters.end(); it++) {
+    for (int kind = 0; kind < LAST_COUNTER; kind++)
+      if ((*it)->positions[kind] >= 0)
+        available[kind] = true;
+    for (int task_id = 0; task_id < Snap::LAST_TASK_ID; task_id++) {
+      tasks[task_id] += (*it)->tasks[task_id];
+      for (int kind = 0; kind < LAST_COUNTER; kind++)
+        totals[task_id][kind] += (*it)->totals[task_id][kind];
+    }
+  }
+  if (!available[CYCLES_COUNTER]) {
+    printf("Hardware counters were unavailable on node %d "
+           "(check /proc/sys/kernel/perf_event_paranoid)\n", Snap::report_node);
+    return;
+  }
+  // LLC misses are each assumed to move one 64B line from memory
+  printf("Hardware Counters for Node %d (%zd threads)\n", Snap::report_node,
+         thread_counters.size());
+  printf("  %-40s %10s %14s %14s %8s %14s %12s %14s %12s\n", "Task", "Count",
+         "Cycles (M)", "Instrs (M)", "IPC", "LLC Misses", "LLC (MB)",
+         "FP Ops (M)", "FP Ops/Byte");
+  for (int task_id = 0; task_id < Snap::LAST_TASK_ID; task_id++) {
+    if (tasks[task_id] == 0)
+      continue;
+    const unsigned long long *total = totals[task_id];
+    const double cycles = total[CYCLES_COUNTER];
+    const double bytes = 64.0 * total[LLC_MISSES_COUNTER];
+    char ipc[16], fp_ops[16], intensity[16];
+    if (available[INSTRUCTIONS_COUNTER] && (cycles > 0.0))
+      snprintf(ipc, sizeof(ipc), "%.3f", total[INSTRUCTIONS_COUNTER] / cycles);
+    else
+      snprintf(ipc, sizeof(ipc), "n/a");
+    if (available[FP_OPS_COUNTER]) {
+      snprintf(fp_ops, sizeof(fp_ops), "%.3f", 1e-6 * total[FP_OPS_COUNTER]);
+      if (available[LLC_MISSES_COUNTER] && (bytes > 0.0))
+        snprintf(intensity, sizeof(intensity), "%.3f", 
+                 total[FP_OPS_COUNTER] / bytes);
+      else
+        snprintf(intensity, sizeof(intensity), "n/a");
+    } else {
+      snprintf(fp_ops, sizeof(fp_ops), "n/a");
+      snprintf(intensity, sizeof(intensity), "n/a");
+    }
+    printf("  %-40s %10llu %14.3f %14.3f %8s %14llu %12.3f %14s %12s\n",
+           Snap::task_names[task_id], tasks[task_id], 1e-6 * cycles,
+           1e-6 * total[INSTRUCTIONS_COUNTER], ipc, 
+           total[LLC_MISSES_COUNTER], 1e-6 * bytes, fp_ops, intensity);
+  }
+  fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ PerfCounters::ThreadCounters* 
+                                        PerfCounters::get_thread_counters(void)
+//------------------------------------------------------------------------------
+{
+  // Counters are never freed since they must outlive their threads
+  static thread_local ThreadCounters *local_counters = NULL;
+  if (local_counters != NULL)
+    return local_counters;
+  local_counters = new ThreadCounters();
+  const int group_fd = open_perf_counter(PERF_TYPE_HARDWARE, 
+                          PERF_COUNT_HW_CPU_CYCLES, -1/*group*/);
+  if (group_fd >= 0) {
+    local_counters->group_fd = group_fd;
+    local_counters->positions[CYCLES_COUNTER] = local_counters->num_counters++;
+    // The rest are optional and may not exist on every processor
+    if (open_perf_counter(PERF_TYPE_HARDWARE, 
+          PERF_COUNT_HW_INSTRUCTIONS, group_fd) >= 0)
+      local_counters->positions[INSTRUCTIONS_COUNTER] = 
+        local_counters->num_counters++;
+    if (open_perf_counter(PERF_TYPE_HARDWARE, 
+          PERF_COUNT_HW_CACHE_MISSES, group_fd) >= 0)
+      local_counters->positions[LLC_MISSES_COUNTER] = 
+        local_counters->num_counters++;
+    const char *fp_event = getenv("SNAP_PERF_FP_EVENT");
+    if ((fp_event != NULL) && (open_perf_counter(PERF_TYPE_RAW,
+          strtoull(fp_event, NULL, 0), group_fd) >= 0))
+      local_counters->positions[FP_OPS_COUNTER] = 
+        local_counters->num_counters++;
+  }
+  std::lock_guard<std::mutex> guard(thread_counters_lock);
+  thread_counters.push_back(local_counters);
+  return local_counters;
+}
+
+#endif // SNAP_PERF_COUNTERS
+
+
+#ifdef SNAP_SWEEP_EFFICIENCY
+// Sweep intervals for every thread that has run a sweep, only touched
+// under the lock when a thread records its first sweep and again at exit
+static std::mutex thread_intervals_lock;
+static std::vector<std::vector<SweepEfficiency::SweepInterval>*> 
+                                                          thread_intervals;
+static int sweep_group_chunks = 0;
+static unsigned sweep_shard = 0;
+static size_t sweep_num_shards = 1;
+
+//------------------------------------------------------------------------------
+/*static*/ void SweepEfficiency::set_shard(unsigned shard, size_t num_shards)
+//------------------------------------------------------------------------------
+{
+  sweep_shard = shard;
+  sweep_num_shards = num_shards;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void SweepEfficiency::set_group_chunks(int num_group_chunks)
+//------------------------------------------------------------------------------
+{
+  sweep_group_chunks = num_group_chunks;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void SweepEfficiency::record_sweep(Processor proc,
+                                              unsigned long long start_ns,
+                                              unsigned long long stop_ns)
+//------------------------------------------------------------------------------
+{
+  SweepInterval interval;
+  interval.proc = proc;
+  interval.start_ns = start_ns;
+  interval.stop_ns = stop_ns;
+  get_thread_intervals()->push_back(interval);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ double SweepEfficiency::theoretical_efficiency(int group_chunks,
+                                unsigned shard, size_t num_shards,
+                                int &columns_y, int &columns_z)
+//------------------------------------------------------------------------------
+{
+  // The shard owns a block of chunks in linearized order, so its y x z
+  // columns of chunks are the ones that the busy time of this process 
+  // can be compared against. Each column works on its x chunks times
+  // group_chunks blocks per corner, and the last one can only start 
+  // after the wavefront has crossed the other columns of the shard.
+  std::vector<Rect<3> > owned;
+  Snap::owned_chunks(shard, num_shards, owned);
+  std::set<std::pair<long long,long long> > columns;
+  std::set<long long> ys, zs;
+  double chunks = 0.0;
+  for (std::vector<Rect<3> >::const_iterator it = 
+        owned.begin(); it != owned.end(); it++) {
+    chunks += double(it->volume());
+    for (long long z = it->lo[2]; z <= it->hi[2]; z++) {
+      zs.insert(z);
+      for (long long y = it->lo[1]; y <= it->hi[1]; y++) {
+        ys.insert(y);
+        columns.insert(std::make_pair(y, z));
+      }
+    }
+  }
+  columns_y = ys.size();
+  columns_z = zs.size();
+  if (columns.empty())
+    return 0.0;
+  const double blocks = chunks / double(columns.size()) * double(group_chunks);
+  return blocks / (blocks + double(columns_y + columns_z - 2));
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void SweepEfficiency::report(void)
+//------------------------------------------------------------------------------
+{
+  // The runtime and its loggers are gone by now so just use stdio
+  std::lock_guard<std::mutex> guard(thread_intervals_lock);
+  std::vector<SweepInterval> intervals;
+  for (std::vector<std::vector<SweepInterval>*>::const_iterator it = 
+        thread_intervals.begin(); it != thread_intervals.end(); it++)
+    intervals.insert(intervals.end(), (*it)->begin(), (*it)->end());
+  if (intervals.empty())
+    return;
+  // Sweep phases are the times when any processor is sweeping
+  std::vector<std::pair<unsigned long long,unsigned long long> > bounds;
+  bounds.reserve(intervals.size());
+  std::map<Processor,unsigned long long> busy_ns;
+  for (std::vector<SweepInterval>::const_iterator it = 
+        intervals.begin(); it != intervals.end(); it++) {
+    bounds.push_back(std::make_pair(it->start_ns, it->stop_ns));
+    busy_ns[it->proc] += (it->stop_ns - it->start_ns);
+  }
+  std::sort(bounds.begin(), bounds.end());
+  unsigned long long phase_ns = 0, total_busy_ns = 0;
+  unsigned num_phases = 0;
+  unsigned long long phase_start = bounds[0].first;
+  unsigned long long phase_stop = bounds[0].second;
+  for (unsigned idx = 1; idx < bounds.size(); idx++) {
+    if (bounds[idx].first > phase_stop) {
+      phase_ns += (phase_stop - phase_start);
+      num_phases++;
+      phase_start = bounds[idx].first;
+      phase_stop = bounds[idx].second;
+    } else if (bounds[idx].second > phase_stop)
+      phase_stop = bounds[idx].second;
+  }
+  phase_ns += (phase_stop - phase_start);
+  num_phases++;
+  for (std::map<Processor,unsigned long long>::const_iterator it = 
+        busy_ns.begin(); it != busy_ns.end(); it++)
+    total_busy_ns += it->second;
+
+  printf("Sweep Pipeline Efficiency (node %d)\n", Snap::report_node);
+  printf("  Decomposition: npey=%d npez=%d ichunk=%d", 
+         Snap::ny_chunks, Snap::nz_chunks, Snap::nx_chunks);
+  if (sweep_group_chunks > 0) {
+    printf(" group chunks=%d\n", sweep_group_chunks);
+    int columns_y = 0, columns_z = 0;
+    const double theoretical = theoretical_efficiency(sweep_group_chunks,
+                          sweep_shard, sweep_num_shards, columns_y, columns_z);
+    printf("  Theoretical KBA Efficiency: %.1f%% for the %d x %d chunk "
+           "columns of shard %u of %zd\n", 100.0 * theoretical, 
+           columns_y, columns_z, sweep_shard, sweep_num_shards);
+  } else
+    printf("\n");
+  printf("  Sweep Phase Time: %.8g ms over %u phases\n", 
+         1e-6 * phase_ns, num_phases);
+  printf("  Measured Efficiency: %.1f%% on %zd processors\n",
+         100.0 * total_busy_ns / (double(phase_ns) * busy_ns.size()), 
+         busy_ns.size());
+  printf("  %-20s %14s %14s %10s\n", "Processor", "Busy (ms)", "Idle (ms)",
+         "Efficiency");
+  for (std::map<Processor,unsigned long long>::const_iterator it = 
+        busy_ns.begin(); it != busy_ns.end(); it++) {
+    char proc_name[32];
+    snprintf(proc_name, sizeof(proc_name), IDFMT, it->first.id);
+    printf("  %-20s %14.3f %14.3f %9.1f%%\n", proc_name, 1e-6 * it->second,
+           1e-6 * (phase_ns - it->second), 100.0 * it->second / phase_ns);
+  }
+  fflush(stdout);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ std::vector<SweepEfficiency::SweepInterval>* 
+                                SweepEfficiency::get_thread_intervals(void)
+//------------------------------------------------------------------------------
+{
+  // Buffers are never freed since they must outlive their threads
+  static thread_local std::vector<SweepInterval> *local_intervals = NULL;
+  if (local_intervals == NULL) {
+    local_intervals = new std::vector<SweepInterval>();
+    std::lock_guard<std::mutex> guard(thread_intervals_lock);
+    thread_intervals.push_back(local_intervals);
+  }
+  return local_intervals;
+}
+
+#endif // SNAP_SWEEP_EFFICIENCY
+
+#ifdef SNAP_OVERHEAD_BENCHMARK
+// Executions come from every processor so they are counted atomically,
+// everything else is only touched by the top-level task on this process
+static std::atomic<unsigned long long> overhead_executions(0);
+static bool solving = false;
+static unsigned long long solve_start_ns = 0;
+static unsigned long long solve_ns = 0;
+static unsigned long long launches[OverheadBenchmark::LAST_LAUNCH_KIND];
+static unsigned long long launch_ns[OverheadBenchmark::LAST_LAUNCH_KIND];
+static unsigned long long total_launch_ns = 0;
+static unsigned long long inner_iterations = 0;
+static unsigned long long inner_start_ns = 0;
+static unsigned long long inner_start_launch_ns = 0;
+static unsigned long long total_issue_ns = 0;
+static unsigned long long max_issue_ns = 0;
+static unsigned long long inner_launch_ns = 0;
+
+//------------------------------------------------------------------------------
+/*static*/ void OverheadBenchmark::begin_solve(void)
+//------------------------------------------------------------------------------
+{
+  solving = true;
+  solve_start_ns = Realm::Clock::current_time_in_nanoseconds();
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void OverheadBenchmark::end_solve(void)
+//------------------------------------------------------------------------------
+{
+  // Launches are counted while they are issued, so this is the time to
+  // issue the whole solve, which can end before the task graph does
+  solve_ns = Realm::Clock::current_time_in_nanoseconds() - solve_start_ns;
+  solving = false;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void OverheadBenchmark::record_launch(LaunchKind kind,
+                                                 unsigned long long ns)
+//------------------------------------------------------------------------------
+{
+  // Setup and the final summary are not part of the solve
+  if (!solving)
+    return;
+  launches[kind]++;
+  launch_ns[kind] += ns;
+  total_launch_ns += ns;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void OverheadBenchmark::record_execution(void)
+//------------------------------------------------------------------------------
+{
+  overhead_executions++;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void OverheadBenchmark::begin_inner_iteration(void)
+//------------------------------------------------------------------------------
+{
+  inner_start_ns = Realm::Clock::current_time_in_nanoseconds();
+  inner_start_launch_ns = total_launch_ns;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void OverheadBenchmark::end_inner_iteration(void)
+//------------------------------------------------------------------------------
+{
+  const unsigned long long issue_ns = 
+    Realm::Clock::current_time_in_nanoseconds() - inner_start_ns;
+  inner_iterations++;
+  total_issue_ns += issue_ns;
+  if (issue_ns > max_issue_ns)
+    max_issue_ns = issue_ns;
+  inner_launch_ns += (total_launch_ns - inner_start_launch_ns);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void OverheadBenchmark::report(void)
+//------------------------------------------------------------------------------
+{
+  // The runtime and its loggers are gone by now so just use stdio
+  static const char *const launch_names[LAST_LAUNCH_KIND] =
+    { "Index Tasks", "Single Tasks", "Copies", "Fills" };
+  const unsigned long long executions = overhead_executions.load();
+  printf("Runtime Overhead for Node %d "
+         "(kernels compiled out with NO_COMPUTE)\n", Snap::report_node);
+  const double solve_s = 1e-9 * solve_ns;
+  printf("  Solve Issue Time: %.8g s\n", solve_s);
+  printf("  Point Tasks Executed: %llu\n", executions);
+  // Time inside the runtime calls that launched each kind of operation
+  printf("  %-20s %12s %16s %14s\n", "Launch", "Count", 
+         "In Runtime (ms)", "Per Call (us)");
+  unsigned long long total_launches = 0;
+  for (int kind = 0; kind < LAST_LAUNCH_KIND; kind++) {
+    total_launches += launches[kind];
+    if (launches[kind] == 0)
+      continue;
+    printf("  %-20s %12llu %16.3f %14.3f\n", launch_names[kind], 
+           launches[kind], 1e-6 * launch_ns[kind], 
+           1e-3 * launch_ns[kind] / launches[kind]);
+  }
+  if (total_launches > 0)
+    printf("  %-20s %12llu %16.3f %14.3f\n", "Total", total_launches,
+           1e-6 * total_launch_ns, 1e-3 * total_launch_ns / total_launches);
+  if (solve_ns > 0)
+    printf("  Runtime Share of Issue Time: %.1f%%\n",
+           100.0 * total_launch_ns / solve_ns);
+  if (inner_iterations > 0) {
+    printf("  Inner Iterations: %llu\n", inner_iterations);
+    printf("  Issue Time per Inner Iteration: avg %.8g us, max %.8g us\n",
+           1e-3 * total_issue_ns / inner_iterations, 1e-3 * max_issue_ns);
+    printf("  Runtime Call Time per Inner Iteration: %.8g us\n",
+           1e-3 * inner_launch_ns / inner_iterations);
+  }
+  fflush(stdout);
+}
+
+#endif // SNAP_OVERHEAD_BENCHMARK
@@ -0,0 +1,201 @@
+#!/usr/bin/env python3
+
+# Copyright 2017 NVIDIA Corporation
+#
+# The U.S. Department of Energy funded the development of this software
+# under subcontract B609478 with Lawrence Livermore National Security, LLC
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+#
+
+# Runs SNAP over a subset of the decks in the input directory, collects
+# the execution summary of each run into a JSON file, and optionally
+# compares the results against a stored baseline. Arguments after '--'
+# are passed through to SNAP (e.g. -ll:cpu 4 -ll:csize 8192).
+#
+#   ./run_benchmarks.py --decks tiny_512 small_1K --output results.json
+#   ./run_benchmarks.py --decks tiny --baseline baseline.json
+#   ./run_benchmarks.py --decks tiny --baseline baseline.json --update-baseline
+
+import argparse
+import glob
+import json
+import os
+import re
+import shlex
+import subprocess
+import sys
+import time
+
+# Metrics parsed from the SNAP execution summary
+summary_patterns = {
+    'time_us' : re.compile(r'Execution Time: (\d+) us'),
+    'time_steps' : re.compile(r'Total Time Steps: (\d+)'),
+    'outer_loops' : re.compile(r'Total Outer Loops: (\d+)'),
+    'inner_loops' : re.compile(r'Total Inner Loops: (\d+)'),
+    'grind_inner_ns' : re.compile(r'Grind Time \(inner loops\): ([0-9.eE+-]+) ns'),
+    'grind_overall_ns' : re.compile(r'Grind Time \(overall\): ([0-9.eE+-]+) ns'),
+}
+
+# Metrics where lower is better and small changes are noise
+timing_metrics = ['time_us', 'grind_inner_ns', 'grind_overall_ns']
+# Metrics that must match exactly or the numerics have changed
+count_metrics = ['time_steps', 'outer_loops', 'inner_loops']
+
+def find_decks(input_dir, selections):
+    decks = []
+    for selection in selections:
+        # Allow any prefix of the deck name, e.g. 'tiny' or 'tiny_512'
+        matches = sorted(glob.glob(os.path.join(input_dir, selection + '*.in')))
+        if not matches:
+            sys.exit('No input decks match %s in %s' % (selection, input_dir))
+        for match in matches:
+            if match not in decks:
+                decks.append(match)
+    return decks
+
+def run_deck(command, deck, snap_args):
+    start = time.time()
+    # SNAP expects the deck first and the runtime flags after it
+    proc = subprocess.Popen(command + [deck] + snap_args, stdout=subprocess.PIPE,
+                            stderr=subprocess.STDOUT, universal_newlines=True)
+    output = proc.stdout.read()
+    # wait4 gives the peak resident set size of the child (in KB on Linux)
+    _, status, usage = os.wait4(proc.pid, 0)
+    wall = time.time() - start
+    if status != 0:
+        sys.stderr.write(output)
+        sys.exit('SNAP failed on %s with status %d' % (deck, status))
+    result = {}
+    for metric, pattern in summary_patterns.items():
+        match = pattern.search(output)
+        if match is None:
+            sys.stderr.write(output)
+            sys.exit('No %s found in the SNAP summary for %s' % (metric, deck))
+        if metric in count_metrics or metric == 'time_us':
+            result[metric] = int(match.group(1))
+        else:
+            result[metric] = float(match.group(1))
+    result['peak_memory_kb'] = usage.ru_maxrss
+    result['wall_s'] = wall
+    return result
+
+def best_of(results):
+    # Keep the fastest run, the counts are identical between runs
+    best = min(results, key=lambda r: r['time_us'])
+    best = dict(best)
+    best['peak_memory_kb'] = max(r['peak_memory_kb'] for r in results)
+    best['repeats'] = len(results)
+    return best
+
+def compare(results, baseline, time_tolerance, memory_tolerance):
+    failures = []
+    for deck, result in sorted(results.items()):
+        if deck not in baseline:
+            print('  %-24s no baseline' % deck)
+            continue
+        expected = baseline[deck]
+        for metric in count_metrics:
+            if result[metric] != expected[metric]:
+                failures.append('%s: %s changed from %d to %d' %
+                    (deck, metric, expected[metric], result[metric]))
+        for metric in timing_metrics:
+            limit = expected[metric] * (1.0 + time_tolerance)
+            change = 100.0 * (result[metric] / expected[metric] - 1.0)
+            print('  %-24s %-18s %14.6g vs %14.6g (%+.1f%%)' %
+                  (deck, metric, result[metric], expected[metric], change))
+            if result[metric] > limit:
+                failures.append('%s: %s regressed by %.1f%% (tolerance %.1f%%)' %
+                    (deck, metric, change, 100.0 * time_tolerance))
+        limit = expected['peak_memory_kb'] * (1.0 + memory_tolerance)
+        if result['peak_memory_kb'] > limit:
+            failures.append('%s: peak memory grew from %d KB to %d KB' %
+                (deck, expected['peak_memory_kb'], result['peak_memory_kb']))
+    return failures
+
+def main():
+    script_dir = os.path.dirname(os.path.abspath(__file__))
+    parser = argparse.ArgumentParser(description='Benchmark SNAP input decks')
+    parser.add_argument('--snap', default=os.path.join(script_dir, 'snap'),
+                        help='path to the SNAP binary')
+    parser.add_argument('--launcher', default='',
+                        help='command to launch SNAP with (e.g. "mpirun -n 2")')
+    parser.add_argument('--input-dir',
+                        default=os.path.join(script_dir, '..', 'input'),
+                        help='directory containing the input decks')
+    parser.add_argument('--decks', nargs='+', default=['tiny'],
+                        help='deck names or prefixes to run (e.g. tiny_512 small)')
+    parser.add_argument('--repeat', type=int, default=3,
+                        help='runs of each deck, the fastest is kept')
+    parser.add_argument('--output', default='benchmark_results.json',
+                        help='JSON file to write the results to')
+    parser.add_argument('--baseline', default=None,
+                        help='JSON file of baseline results to compare against')
+    parser.add_argument('--update-baseline', action='store_true',
+                        help='write the results into the baseline instead')
+    parser.add_argument('--time-tolerance', type=float, default=0.10,
+                        help='allowed fractional slowdown for timing metrics')
+    parser.add_argument('--memory-tolerance', type=float, default=0.20,
+                        help='allowed fractional growth in peak memory')
+    parser.add_argument('snap_args', nargs=argparse.REMAINDER,
+                        help='arguments after -- are passed to SNAP')
+    args = parser.parse_args()
+
+    snap_args = args.snap_args
+    if snap_args and snap_args[0] == '--':
+        snap_args = snap_args[1:]
+    command = shlex.split(args.launcher) + [args.snap]
+    decks = find_decks(args.input_dir, args.decks)
+
+    results = {}
+    for deck in decks:
+        name = os.path.splitext(os.path.basename(deck))[0]
+        runs = [run_deck(command, deck, snap_args) for i in range(args.repeat)]
+        results[name] = best_of(runs)
+        print('%-24s %12d us  grind %10.4g ns  %d outer  %d inner  %d KB' %
+              (name, results[name]['time_us'],
+               results[name]['grind_inner_ns'], results[name]['outer_loops'],
+               results[name]['inner_loops'], results[name]['peak_memory_kb']))
+
+    report = { 'command' : ' '.join(command + ['<deck>'] + snap_args),
+               'results' : results }
+    with open(args.output, 'w') as f:
+        json.dump(report, f, indent=2, sort_keys=True)
+
+    if args.baseline is None:
+        return 0
+    if args.update_baseline:
+        baseline = {}
+        if os.path.exists(args.baseline):
+            with open(args.baseline) as f:
+                baseline = json.load(f)['results']
+        baseline.update(results)
+        with open(args.baseline, 'w') as f:
+            json.dump({ 'command' : report['command'], 'results' : baseline },
+                      f, indent=2, sort_keys=True)
+        print('Updated baseline %s' % args.baseline)
+        return 0
+    with open(args.baseline) as f:
+        baseline = json.load(f)['results']
+    print('Comparing against baseline %s' % args.baseline)
+    failures = compare(results, baseline,
+                       args.time_tolerance, args.memory_tolerance)
+    for failure in failures:
+        print('REGRESSION: ' + failure)
+    if failures:
+        return 1
+    print('No regressions')
+    return 0
+
+if __name__ == '__main__':
+    sys.exit(main())
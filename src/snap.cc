@@ -24,8 +24,14 @@
 #include "expxs.h"
 #include "mms.h"
 #include "convergence.h"
+#include "dsa.h"
+#include "gmres.h"
+#include "anderson.h"
+#include "eigen.h"
 
+#include <cmath>
 #include <cstdio>
+#include <cstring>
 
 #ifndef MIN
 #define MIN(x,y) (((x) < (y)) ? (x) : (y))
@@ -60,6 +66,28 @@ void Snap::setup(void)
                                             Point<3>(bf), DISJOINT_PARTITION);
     runtime->attach_name(spatial_ip, "Spatial Partition");
   }
+  // DSA needs each chunk plus a one cell halo in every active dimension,
+  // restriction clips the halo to the simulation bounds for us
+  if (use_dsa)
+  {
+    Matrix<3,3> transform;
+    for (int i = 0; i < 3; i++)
+      for (int j = 0; j < 3; j++)
+        transform[i][j] = 0;
+    transform[0][0] = nx_per_chunk;
+    transform[1][1] = ny_per_chunk;
+    transform[2][2] = nz_per_chunk;
+    const long long halo[3] = { 1, (num_dims > 1) ? 1 : 0, 
+                                    (num_dims > 2) ? 1 : 0 };
+    const long long lo[3] = { -halo[0], -halo[1], -halo[2] };
+    const long long hi[3] = { nx_per_chunk - 1 + halo[0], 
+                              ny_per_chunk - 1 + halo[1],
+                              nz_per_chunk - 1 + halo[2] };
+    ghost_ip = runtime->create_partition_by_restriction(ctx, simulation_is,
+        launch_bounds, transform, Rect<3>(Point<3>(lo), Point<3>(hi)),
+        ALIASED_KIND, GHOST_PARTITION);
+    runtime->attach_name(ghost_ip, "Ghost Partition");
+  }
   // The color space of the partition is also our launch bounds
   launch_bounds = 
     runtime->get_index_partition_color_space_name<3, long long,
@@ -98,6 +126,29 @@ void Snap::setup(void)
                                       Point<2>(bf), DISJOINT_PARTITION);
     runtime->attach_name(xz_flux_ip, "XZ Flux Partition");
   }
+  // Coarse mesh rebalance has a row of terms along x for each chunk, 
+  // blocking by the rows gives a partition with the colors of the chunks
+  if (coarse_rebalance)
+  {
+    const long long upper_leakage[3] = { nx_chunks * NUM_LEAKAGE_TERMS - 1,
+                                         ny_chunks - 1, nz_chunks - 1 };
+    leakage_is = runtime->create_index_space(ctx,
+          Rect<3>(Point<3>(zeroes), Point<3>(upper_leakage)));
+    runtime->attach_name(leakage_is, "Coarse Leakage");
+    const long long leakage_bf[3] = { NUM_LEAKAGE_TERMS, 1, 1 };
+    leakage_ip = runtime->create_partition_by_blockify(ctx, leakage_is,
+                                Point<3>(leakage_bf), DISJOINT_PARTITION);
+    runtime->attach_name(leakage_ip, "Coarse Leakage Partition");
+    const long long upper_balance[3] = { nx_chunks * NUM_BALANCE_TERMS - 1,
+                                         ny_chunks - 1, nz_chunks - 1 };
+    balance_is = runtime->create_index_space(ctx,
+          Rect<3>(Point<3>(zeroes), Point<3>(upper_balance)));
+    runtime->attach_name(balance_is, "Coarse Balance");
+    const long long balance_bf[3] = { NUM_BALANCE_TERMS, 1, 1 };
+    balance_ip = runtime->create_partition_by_blockify(ctx, balance_is,
+                                Point<3>(balance_bf), DISJOINT_PARTITION);
+    runtime->attach_name(balance_ip, "Coarse Balance Partition");
+  }
   // Make some of our other field spaces
   const long long nmat = (material_layout == HOMOGENEOUS_LAYOUT) ? 1 : 2;
   material_is = runtime->create_index_space(ctx,
@@ -221,6 +272,22 @@ void Snap::setup(void)
   }
 }
 
+//------------------------------------------------------------------------------
+static unsigned runahead_depth(int test, int expected, 
+                               unsigned default_depth, unsigned max_depth)
+//------------------------------------------------------------------------------
+{
+  // Number of convergence tests to have in flight after issuing the given
+  // one. Before the loop is expected to converge we can go as deep as it 
+  // takes to get there, close to it we only go one deep so that very little 
+  // predicated-off work gets issued. Without a prediction, or once it has
+  // turned out to be wrong, just use the tunable.
+  if ((expected < 0) || (test > expected))
+    return default_depth;
+  const unsigned remaining = (expected - test) + 1;
+  return (remaining < max_depth) ? remaining : max_depth;
+}
+
 //------------------------------------------------------------------------------
 void Snap::transport_solve(void)
 //------------------------------------------------------------------------------
@@ -296,6 +363,98 @@ void Snap::transport_solve(void)
     time_flux_odd[i] = new SnapArray<3>(simulation_is, spatial_ip, angle_fs,
                                         ctx, runtime, name_buffer);
   }
+  // Only necessary for DSA
+  SnapArray<3> *dsa_x = NULL, *dsa_r = NULL, *dsa_p = NULL, *dsa_ap = NULL;
+  if (use_dsa) {
+    dsa_x = new SnapArray<3>(simulation_is, spatial_ip, group_fs, 
+                             ctx, runtime, "dsa_x");
+    dsa_r = new SnapArray<3>(simulation_is, spatial_ip, group_fs, 
+                             ctx, runtime, "dsa_r");
+    dsa_p = new SnapArray<3>(simulation_is, spatial_ip, group_fs, 
+                             ctx, runtime, "dsa_p");
+    dsa_ap = new SnapArray<3>(simulation_is, spatial_ip, group_fs, 
+                              ctx, runtime, "dsa_ap");
+  }
+  // Only necessary for GMRES
+  SnapArray<3> *gmres_w = NULL;
+  std::vector<SnapArray<3>*> gmres_basis;
+  SnapArray<3> *gmres_zero_flux = NULL;
+  SnapArray<3> *gmres_flux_scratch[8];
+  if (use_gmres) {
+    gmres_w = new SnapArray<3>(simulation_is, spatial_ip, group_fs, 
+                               ctx, runtime, "gmres_w");
+    for (int i = 0; i < gmres_restart; i++) {
+      char name_buffer[64];
+      snprintf(name_buffer, 63, "gmres basis %d", i);
+      gmres_basis.push_back(new SnapArray<3>(simulation_is, spatial_ip, 
+                                      group_fs, ctx, runtime, name_buffer));
+    }
+    // Sweeps for GMRES products must not see the time source or 
+    // overwrite the outgoing angular fluxes of the real sweeps
+    if (time_dependent) {
+      gmres_zero_flux = new SnapArray<3>(simulation_is, spatial_ip, angle_fs,
+                                         ctx, runtime, "gmres zero flux");
+      for (int i = 0; i < 8; i++) {
+        char name_buffer[64];
+        snprintf(name_buffer, 63, "gmres flux scratch %d", i);
+        gmres_flux_scratch[i] = new SnapArray<3>(simulation_is, spatial_ip,
+                                      angle_fs, ctx, runtime, name_buffer);
+      }
+    }
+  }
+  // Only necessary for Anderson mixing
+  SnapArray<3> *anderson_f = NULL, *anderson_g = NULL;
+  if (anderson_depth > 0) {
+    anderson_f = new SnapArray<3>(simulation_is, spatial_ip, group_fs, 
+                                  ctx, runtime, "anderson_f");
+    anderson_g = new SnapArray<3>(simulation_is, spatial_ip, group_fs, 
+                                  ctx, runtime, "anderson_g");
+  }
+  std::vector<SnapArray<3>*> anderson_df, anderson_dg;
+  for (int i = 0; i < anderson_depth; i++) {
+    char name_buffer[64];
+    snprintf(name_buffer, 63, "anderson df %d", i);
+    anderson_df.push_back(new SnapArray<3>(simulation_is, spatial_ip, 
+                                    group_fs, ctx, runtime, name_buffer));
+    snprintf(name_buffer, 63, "anderson dg %d", i);
+    anderson_dg.push_back(new SnapArray<3>(simulation_is, spatial_ip, 
+                                    group_fs, ctx, runtime, name_buffer));
+  }
+  // Dot products between the residual differences stay valid until
+  // the difference is overwritten so keep them across outer iterations
+  std::vector<std::vector<Future> > anderson_gram(anderson_depth,
+                                    std::vector<Future>(anderson_depth));
+  // Only necessary for extrapolating the flux between time steps,
+  // a ring of the scalar fluxes at the end of the previous steps
+  std::vector<SnapArray<3>*> step_history;
+  for (int i = 0; i < extrapolation_order; i++) {
+    char name_buffer[64];
+    snprintf(name_buffer, 63, "step history %d", i);
+    step_history.push_back(new SnapArray<3>(simulation_is, spatial_ip, 
+                                    group_fs, ctx, runtime, name_buffer));
+  }
+  int steps_saved = 0, newest_step = 0;
+  // Only necessary for k-eigenvalue problems, flux0pp is the flux at
+  // the start of the current power iteration
+  const bool eigenvalue = (max_power_iters > 0);
+  SnapArray<1> *nusigf = NULL, *chi = NULL;
+  SnapArray<3> *flux0pp = NULL;
+  if (eigenvalue) {
+    nusigf = new SnapArray<1>(material_is, IndexPartition<1>(), group_fs,
+                              ctx, runtime, "nusigf");
+    chi = new SnapArray<1>(point_is, IndexPartition<1>(), group_fs, 
+                           ctx, runtime, "chi");
+    flux0pp = new SnapArray<3>(simulation_is, spatial_ip, group_fs, 
+                               ctx, runtime, "flux0pp");
+  }
+  // Only necessary for coarse mesh rebalance
+  SnapArray<3> *cmr_leakage = NULL, *cmr_balance = NULL;
+  if (coarse_rebalance) {
+    cmr_leakage = new SnapArray<3>(leakage_is, leakage_ip, group_fs,
+                                   ctx, runtime, "cmr_leakage");
+    cmr_balance = new SnapArray<3>(balance_is, balance_ip, group_fs,
+                                   ctx, runtime, "cmr_balance");
+  }
   // Only necessary for MMS
   SnapArray<3> *qim[8];
   SnapArray<3> ref_flux(simulation_is, spatial_ip, group_fs, 
@@ -341,6 +500,8 @@ void Snap::transport_solve(void)
     time_flux_even[i]->initialize();
     time_flux_odd[i]->initialize();
   } 
+  if (gmres_zero_flux != NULL)
+    gmres_zero_flux->initialize();
 
   // Launch some tasks to initialize the application data
   if (material_layout != HOMOGENEOUS_LAYOUT)
@@ -348,7 +509,8 @@ void Snap::transport_solve(void)
     InitMaterial init_material(*this, mat);
     init_material.dispatch(ctx, runtime);
   }
-  if (!do_mms)
+  // Eigenvalue problems have no fixed source, qi is the fission source
+  if (!do_mms && !eigenvalue)
   {
     InitSource init_source(*this, qi);
     init_source.dispatch(ctx, runtime);
@@ -369,6 +531,13 @@ void Snap::transport_solve(void)
 #endif
   initialize_scattering(sigt, siga, sigs, slgg);
   initialize_velocity(vel, vdelt);
+  if (eigenvalue) {
+    nusigf->initialize();
+    chi->initialize();
+    initialize_fission(siga, *nusigf, *chi);
+    // Power iterations start from a flat flux
+    flux0.initialize<double>(1.0);
+  }
 
   if (do_mms) {
     ref_flux.initialize();
@@ -396,20 +565,79 @@ void Snap::transport_solve(void)
   assert(inner_runahead > 0);
   const int energy_group_chunks = 
     sweep_energy_chunks_future.get_result<int>(true/*silence warnings*/);
+  const int num_group_chunks = 
+    (num_groups + energy_group_chunks - 1) / energy_group_chunks;
+#ifdef SNAP_SWEEP_EFFICIENCY
+  SweepEfficiency::set_group_chunks(num_group_chunks);
+#endif
+  // Fields of each energy group chunk for resetting the flux of 
+  // chunks that are still iterating in the inner loop
+  std::vector<std::set<FieldID> > group_chunk_fields(num_group_chunks);
+  for (int g = 0; g < num_groups; g++)
+    group_chunk_fields[g / energy_group_chunks].insert(
+                                          SNAP_ENERGY_GROUP_FIELD(g));
+  // Each GMRES cycle sweeps the group chunks again for every product
+  const int sweeps_per_inner = use_gmres ? (1 + gmres_restart) : 1;
   // Loop over time steps
   std::deque<Future> outer_converged_tests;
   std::deque<Future> inner_converged_tests;
+  // Index of the test that converged the last outer loop and the last 
+  // inner loop of each Gauss-Seidel pass, which converge differently
+  std::vector<int> expected_inner(gauss_seidel_groups ? num_group_chunks : 1,
+                                  -1);
+  int expected_outer = -1;
   // Use this for when predicates evaluate to false, tasks can then
   // return true to indicate convergence
   const Future true_future = Future::from_value<bool>(runtime, true);
+  // Max flux changes are only computed for the convergence history,
+  // zero is also what predicated-off DSA reductions return
+  const bool record_history = (history_prefix != NULL);
+  const Future zero_future = Future::from_value<double>(runtime, 0.0);
   // Use this for printing convergence and timing information
   // in a deferred execution environment with predication
   ConvergenceMonad convergence(ctx, runtime);
+  // Power iterations take the place of the time steps for k-eigenvalue
+  // problems, the eigenvalue and fission production are only futures
+  const int num_cycles = eigenvalue ? max_power_iters : num_steps;
+  Predicate power_pred = Predicate::TRUE_PRED;
+  std::deque<Future> power_converged_tests;
+  std::deque<Future> power_keff_changes;
+  // Power iterations converge once per run so there is no earlier loop
+  // to learn from, instead the prediction is extrapolated from the
+  // change in the eigenvalue of the tests that have been read
+  int expected_power = -1;
+  double last_keff_change = -1.0;
+  Future keff = Future::from_value<double>(runtime, 1.0);
+  Future fission_production;
+  if (eigenvalue) {
+    CalcFissionProduction production(*this, power_pred, flux0, mat, 
+                                     *nusigf, zero_future);
+    fission_production = production.dispatch<SumReduction>(ctx, runtime);
+  }
+#ifdef SNAP_OVERHEAD_BENCHMARK
+  OverheadBenchmark::begin_solve();
+#endif
   // Iterate over time steps
   bool even_time_step = false;
-  for (int cy = 0; cy < num_steps; ++cy)
+  for (int cy = 0; cy < num_cycles; ++cy)
   {
     even_time_step = !even_time_step;
+    SnapArray<3> *gmres_flux_in[8];
+    SnapArray<3> *gmres_flux_out[8];
+    if (use_gmres) {
+      for (int i = 0; i < 8; i++) {
+        if (time_dependent) {
+          gmres_flux_in[i] = gmres_zero_flux;
+          gmres_flux_out[i] = gmres_flux_scratch[i];
+        } else {
+          // vdelt is zero so these are never read
+          gmres_flux_in[i] = 
+            even_time_step ? time_flux_even[i] : time_flux_odd[i];
+          gmres_flux_out[i] = 
+            even_time_step ? time_flux_odd[i] : time_flux_even[i];
+        }
+      }
+    }
     // Some of this is a little weird, you can in theory lift some
     // of this out the time stepping loop because the mock velocity 
     // array and the material array aren't changing, but I think that 
@@ -465,80 +693,324 @@ void Snap::transport_solve(void)
         }
       }
     }
+    // Start the outer iterations from a better guess than the last step
+    if ((extrapolation_order > 0) && (cy > 0))
+      extrapolate_flux(flux0, step_history, steps_saved, newest_step);
+    // Each power iteration solves for the flux of the fission source 
+    // of the last one, less the part the Wielandt shift moves into 
+    // the outer source
+    if (eigenvalue) {
+      save_fluxes(power_pred, flux0, *flux0pp, energy_group_chunks);
+      CalcFissionSource fission_src(*this, power_pred, flux0, mat, *nusigf,
+                  *chi, qi, keff, false/*shifted*/, 0, num_groups - 1);
+      fission_src.dispatch(ctx, runtime);
+    }
     outer_converged_tests.clear();
-    Predicate outer_pred = Predicate::TRUE_PRED;
+    Predicate outer_pred = power_pred;
     Future timing_future_precondition;
+    // The mixing history starts over with each time step
+    int anderson_iteration = 0;
     // The outer solve loop    
     for (int otno = 0; otno < max_outer_iters; ++otno)
     {
-      // Do the outer source calculation 
-      // Note that this is the only task which actually has no
-      // group parallelism as it requires all the groups results
-      CalcOuterSource outer_src(*this, outer_pred, qi, slgg, mat, 
-                                q2grp0, q2grpm, flux0, fluxm);
-      outer_src.dispatch(ctx, runtime);
       // Save the fluxes
       save_fluxes(outer_pred, flux0, flux0po, energy_group_chunks);
-      // Do the inner solve
-      inner_converged_tests.clear();
-      Predicate inner_pred = outer_pred;
+      // Jacobi in energy does the outer source and inner solve of all the
+      // group chunks at once. Gauss-Seidel goes through the chunks in order
+      // so the outer source of each chunk sees the new fluxes of the chunks
+      // before it, which pays off when down-scattering dominates.
+      const int num_passes = gauss_seidel_groups ? num_group_chunks : 1;
       Future inner_converged;
-      // The inner solve loop
-      for (int inno=0; inno < max_inner_iters; ++inno)
+      PredicateLauncher passes_converged(true/*and predicate*/);
+      for (int pass = 0; pass < num_passes; pass++)
       {
-        // Do the inner source calculation
-        calculate_inner_source(inner_pred, s_xs, flux0, fluxm, q2grp0,
-                               q2grpm, qtot, energy_group_chunks);
-        // Save the fluxes
-        save_fluxes(inner_pred, flux0, flux0pi, energy_group_chunks);
-        flux0.initialize(inner_pred);
-        // Perform the sweeps
-        perform_sweeps(inner_pred, flux0, fluxm, qtot, vdelt, dinv, t_xs,
-                       even_time_step ? time_flux_even : time_flux_odd,
-                       even_time_step ? time_flux_odd : time_flux_even, 
-                       qim, flux_xy, flux_yz, flux_xz, energy_group_chunks); 
-        // Test for inner convergence
-        Predicate converged = test_inner_convergence(inner_pred, flux0, 
-                             flux0pi, true_future, energy_group_chunks);
-        inner_converged = runtime->get_predicate_future(ctx, converged);
-        convergence.bind_inner(inner_pred, inner_converged);
-#ifndef DISABLE_PREDICATION
-        inner_converged_tests.push_back(inner_converged);
-        // Update the next predicate
-        inner_pred = runtime->predicate_not(ctx, converged);
-        // See if we've run far enough ahead
-        if (inner_converged_tests.size() == inner_runahead)
+        if (gauss_seidel_groups) {
+          const int group_start = pass * energy_group_chunks;
+          int group_stop = group_start + energy_group_chunks - 1;
+          if (group_stop >= num_groups)
+            group_stop = num_groups - 1;
+          CalcOuterSource outer_src(*this, outer_pred, qi, slgg, mat, 
+              q2grp0, q2grpm, flux0, fluxm, group_start, group_stop);
+          outer_src.dispatch(ctx, runtime);
+        } else {
+          // Do the outer source calculation 
+          // Note that this is the only task which actually has no
+          // group parallelism as it requires all the groups results
+          CalcOuterSource outer_src(*this, outer_pred, qi, slgg, mat, 
+                                    q2grp0, q2grpm, flux0, fluxm);
+          outer_src.dispatch(ctx, runtime);
+        }
+        // The shifted fission source comes from the latest flux too
+        if (wielandt_shift > 0.0) {
+          const int group_start = 
+            gauss_seidel_groups ? (pass * energy_group_chunks) : 0;
+          int group_stop = gauss_seidel_groups ? 
+            (group_start + energy_group_chunks - 1) : (num_groups - 1);
+          if (group_stop >= num_groups)
+            group_stop = num_groups - 1;
+          CalcFissionSource fission_src(*this, outer_pred, flux0, mat, 
+              *nusigf, *chi, q2grp0, keff, true/*shifted*/, 
+              group_start, group_stop);
+          fission_src.dispatch(ctx, runtime);
+        }
+        // Do the inner solve
+        inner_converged_tests.clear();
+        Predicate inner_pred = outer_pred;
+        // Energy groups do not couple in the inner loop so each chunk of
+        // groups stops sweeping as soon as it converges by itself, chunks
+        // outside of a Gauss-Seidel pass get FALSE_PRED and are skipped
+        std::vector<Predicate> group_preds(num_group_chunks, 
+            gauss_seidel_groups ? Predicate::FALSE_PRED : outer_pred);
+        if (gauss_seidel_groups)
+          group_preds[pass] = outer_pred;
+        std::vector<Predicate> group_converged;
+        // The inner solve loop
+        for (int inno=0; inno < max_inner_iters; ++inno)
         {
-          Future f = inner_converged_tests.front();
-          inner_converged_tests.pop_front();
-          if (f.get_result<bool>(true/*silence warnings*/))
+#ifdef SNAP_OVERHEAD_BENCHMARK
+          OverheadBenchmark::begin_inner_iteration();
+#endif
+          // Do the inner source calculation
+          calculate_inner_source(group_preds, s_xs, flux0, fluxm, q2grp0,
+                                 q2grpm, qtot, energy_group_chunks);
+          // Save the fluxes
+          save_fluxes(group_preds, flux0, flux0pi, energy_group_chunks);
+          for (int chunk = 0; chunk < num_group_chunks; chunk++)
+          {
+            if (group_preds[chunk] == Predicate::FALSE_PRED)
+              continue;
+            flux0.initialize_fields(group_chunk_fields[chunk], 
+                                    group_preds[chunk]);
+            // The leakage has to come from the same sweeps as the flux
+            if (coarse_rebalance)
+              cmr_leakage->initialize_fields(group_chunk_fields[chunk],
+                                             group_preds[chunk]);
+          }
+          // Perform the sweeps
+          perform_sweeps(inner_pred, group_preds, flux0, fluxm, qtot, 
+                         vdelt, dinv, t_xs,
+                         even_time_step ? time_flux_even : time_flux_odd,
+                         even_time_step ? time_flux_odd : time_flux_even, 
+                         qim, flux_xy, flux_yz, flux_xz, energy_group_chunks,
+                         cmr_leakage); 
+          // Correct the scalar flux with a diffusion solve
+          if (use_dsa)
+            perform_dsa(group_preds, s_xs, t_xs, vdelt, flux0, flux0pi,
+                        *dsa_x, *dsa_r, *dsa_p, *dsa_ap, zero_future, 
+                        energy_group_chunks);
+          // Or replace the source iteration step with a GMRES cycle
+          if (use_gmres)
+            perform_gmres(inner_pred, group_preds, flux0, flux0pi, fluxm, 
+                          qtot, s_xs, vdelt, dinv, t_xs, gmres_flux_in, 
+                          gmres_flux_out, qim, flux_xy, flux_yz, flux_xz, 
+                          gmres_basis, *gmres_w, group_chunk_fields, 
+                          zero_future, energy_group_chunks);
+          // Test for inner convergence
+          std::vector<Future> max_changes;
+          Predicate converged = test_inner_convergence(group_preds, flux0, 
+                                flux0pi, zero_future, true_future, 
+                                energy_group_chunks, group_converged, 
+                                max_changes);
+          inner_converged = runtime->get_predicate_future(ctx, converged);
+          // Group chunks were swept if their predicates were true
+          std::vector<Future> chunks_swept;
+          std::vector<int> chunk_groups;
+          for (int chunk = 0; chunk < num_group_chunks; chunk++)
+          {
+            if (group_preds[chunk] == Predicate::FALSE_PRED)
+              continue;
+            chunks_swept.push_back(
+                runtime->get_predicate_future(ctx, group_preds[chunk]));
+            chunk_groups.push_back(sweeps_per_inner * 
+                                   group_chunk_fields[chunk].size());
+          }
+          if (record_history)
+            convergence.bind_inner(inner_pred, inner_converged, 
+                                   chunks_swept, chunk_groups, max_changes);
+          else
+            convergence.bind_inner(inner_pred, inner_converged,
+                                   chunks_swept, chunk_groups);
+#ifdef SNAP_OVERHEAD_BENCHMARK
+          OverheadBenchmark::end_inner_iteration();
+#endif
+#ifndef DISABLE_PREDICATION
+          inner_converged_tests.push_back(inner_converged);
+          // Update the next predicates
+          inner_pred = runtime->predicate_not(ctx, converged);
+          for (int chunk = 0; chunk < num_group_chunks; chunk++)
+          {
+            if (group_preds[chunk] == Predicate::FALSE_PRED)
+              continue;
+            group_preds[chunk] = 
+              runtime->predicate_not(ctx, group_converged[chunk]);
+          }
+          // See if we've run far enough ahead
+          const unsigned inner_depth = adaptive_runahead ? 
+            runahead_depth(inno, expected_inner[pass], inner_runahead, 
+                           max_inner_iters) : inner_runahead;
+          bool inner_done = false;
+          while (inner_converged_tests.size() >= inner_depth)
+          {
+            Future f = inner_converged_tests.front();
+            inner_converged_tests.pop_front();
+            if (f.get_result<bool>(true/*silence warnings*/)) {
+              // Inner loops of predicated-off outer iterations converge
+              // on their first test so those tell us nothing
+              const int test = inno - int(inner_converged_tests.size());
+              if (test > 0)
+                expected_inner[pass] = test;
+              inner_done = true;
+              break;
+            }
+          }
+          if (inner_done)
             break;
-        }
 #endif
+        }
+        if (gauss_seidel_groups)
+          passes_converged.add_predicate(
+              runtime->create_predicate(ctx, inner_converged));
       }
+      if (gauss_seidel_groups)
+        inner_converged = runtime->get_predicate_future(ctx,
+                      runtime->create_predicate(ctx, passes_converged));
+      // Rebalance the chunks with the leakage of the last sweeps
+      if (coarse_rebalance)
+        perform_coarse_rebalance(outer_pred, flux0, fluxm, qi, t_xs, s_xs,
+                                 mat, slgg, *cmr_leakage, *cmr_balance);
       // Test for outer convergence
       // Original SNAP says to skip this on the first iteration
-      if (otno == 0)
+      if (otno == 0) {
+        if (anderson_depth > 0)
+          perform_anderson(outer_pred, flux0, flux0po, *anderson_f, 
+                           *anderson_g, anderson_df, anderson_dg, 
+                           anderson_gram, anderson_iteration, zero_future);
         continue;
+      }
+      std::vector<Future> max_changes;
       Predicate converged = test_outer_convergence(outer_pred, flux0,
-           flux0po, inner_converged, true_future, energy_group_chunks);
+           flux0po, inner_converged, zero_future, true_future, 
+           energy_group_chunks, max_changes);
       Future outer_converged = runtime->get_predicate_future(ctx, converged);
-      convergence.bind_outer(outer_pred, outer_converged);
+      if (record_history)
+        convergence.bind_outer(outer_pred, outer_converged, max_changes);
+      else
+        convergence.bind_outer(outer_pred, outer_converged);
 #ifndef DISABLE_PREDICATION
       outer_converged_tests.push_back(outer_converged);
       // Update the next predicate
       outer_pred = runtime->predicate_not(ctx, converged);
-      // See if we've run far enough ahead
-      if (outer_converged_tests.size() == outer_runahead)
+      // See if we've run far enough ahead, the first outer iteration 
+      // does not have a test so the tests are numbered from the second
+      const unsigned outer_depth = adaptive_runahead ?
+        runahead_depth(otno - 1, expected_outer, outer_runahead, 
+                       max_outer_iters) : outer_runahead;
+      bool outer_done = false;
+      while (outer_converged_tests.size() >= outer_depth)
       {
         Future f = outer_converged_tests.front();
         outer_converged_tests.pop_front();
-        if (f.get_result<bool>(true/*silence warnings*/))
+        if (f.get_result<bool>(true/*silence warnings*/)) {
+          expected_outer = (otno - 1) - int(outer_converged_tests.size());
+          outer_done = true;
           break;
+        }
       }
+      if (outer_done)
+        break;
+#endif
+      // Mix the scalar flux for the next outer iteration, this is
+      // predicated on not having converged so the answer is untouched
+      if (anderson_depth > 0)
+        perform_anderson(outer_pred, flux0, flux0po, *anderson_f, *anderson_g,
+                         anderson_df, anderson_dg, anderson_gram, 
+                         anderson_iteration, zero_future);
+    }
+    if (!eigenvalue)
+      continue;
+    // Update the eigenvalue from the fission production of the new flux
+    CalcFissionProduction production(*this, power_pred, flux0, mat, 
+                                     *nusigf, fission_production);
+    Future new_production = production.dispatch<SumReduction>(ctx, runtime);
+    UpdateEigenvalue update_keff(power_pred, keff, fission_production, 
+                                 new_production);
+    const Future old_keff = keff;
+    {
+#ifdef SNAP_OVERHEAD_BENCHMARK
+      OverheadBenchmark::LaunchTimer timer(
+                                  OverheadBenchmark::SINGLE_TASK_LAUNCH);
 #endif
+      keff = runtime->execute_task(ctx, update_keff);
     }
+    fission_production = new_production;
+    // The power iterations have converged when both the flux and 
+    // the eigenvalue have stopped changing
+    std::vector<Future> max_changes;
+    Predicate flux_converged = test_outer_convergence(power_pred, flux0, 
+        *flux0pp, true_future, zero_future, true_future, energy_group_chunks, 
+        max_changes);
+    CalcEigenvalueChange keff_change(power_pred, old_keff, keff, zero_future);
+    Future dk, power_converged;
+    {
+#ifdef SNAP_OVERHEAD_BENCHMARK
+      OverheadBenchmark::LaunchTimer timer(
+                                  OverheadBenchmark::SINGLE_TASK_LAUNCH);
+#endif
+      dk = runtime->execute_task(ctx, keff_change);
+    }
+    CompareFluxChange compare_keff(power_pred, convergence_eps,
+        std::vector<Future>(1, dk), 
+        runtime->get_predicate_future(ctx, flux_converged), true_future);
+    {
+#ifdef SNAP_OVERHEAD_BENCHMARK
+      OverheadBenchmark::LaunchTimer timer(
+                                  OverheadBenchmark::SINGLE_TASK_LAUNCH);
+#endif
+      power_converged = runtime->execute_task(ctx, compare_keff);
+    }
+    Predicate converged = runtime->create_predicate(ctx, power_converged);
+    convergence.bind_eigenvalue(power_pred, power_converged, keff);
+#ifndef DISABLE_PREDICATION
+    power_converged_tests.push_back(power_converged);
+    power_keff_changes.push_back(dk);
+    power_pred = runtime->predicate_not(ctx, converged);
+    // Every power iteration is a whole solve so runahead like the outers
+    const unsigned power_depth = adaptive_runahead ?
+      runahead_depth(cy, expected_power, outer_runahead, 
+                     max_power_iters) : outer_runahead;
+    bool power_done = false;
+    while (power_converged_tests.size() >= power_depth)
+    {
+      Future f = power_converged_tests.front();
+      power_converged_tests.pop_front();
+      const double keff_change = power_keff_changes.front().get_result<double>(
+                                                  true/*silence warnings*/);
+      power_keff_changes.pop_front();
+      if (f.get_result<bool>(true/*silence warnings*/)) {
+        power_done = true;
+        break;
+      }
+      // The change in the eigenvalue shrinks by about the dominance ratio
+      // every power iteration, predicated-off iterations report no change
+      if (adaptive_runahead && (keff_change > 0.0)) {
+        if ((last_keff_change > 0.0) && (keff_change < last_keff_change)) {
+          const int test = cy - int(power_converged_tests.size());
+          const double remaining = MIN(double(max_power_iters),
+              log(convergence_eps / keff_change) / 
+              log(keff_change / last_keff_change));
+          expected_power = test + 
+            ((remaining > 1.0) ? int(ceil(remaining)) : 1);
+        }
+        last_keff_change = keff_change;
+      }
+    }
+    if (power_done)
+      break;
+#endif
   }
+#ifdef SNAP_OVERHEAD_BENCHMARK
+  OverheadBenchmark::end_solve();
+#endif
   if (do_mms) {
     MMSCompare compare_mms(*this, flux0, ref_flux); 
     Future f = compare_mms.dispatch<MMSReduction>(ctx, runtime);
@@ -565,6 +1037,40 @@ void Snap::transport_solve(void)
     for (int i = 0; i < 8; i++)
       delete qim[i];
   }
+  if (gmres_w != NULL)
+    delete gmres_w;
+  for (unsigned idx = 0; idx < gmres_basis.size(); idx++)
+    delete gmres_basis[idx];
+  for (unsigned idx = 0; idx < step_history.size(); idx++)
+    delete step_history[idx];
+  if (anderson_depth > 0) {
+    delete anderson_f;
+    delete anderson_g;
+  }
+  if (eigenvalue) {
+    delete nusigf;
+    delete chi;
+    delete flux0pp;
+  }
+  for (unsigned idx = 0; idx < anderson_df.size(); idx++) {
+    delete anderson_df[idx];
+    delete anderson_dg[idx];
+  }
+  if (use_dsa) {
+    delete dsa_x;
+    delete dsa_r;
+    delete dsa_p;
+    delete dsa_ap;
+  }
+  if (coarse_rebalance) {
+    delete cmr_leakage;
+    delete cmr_balance;
+  }
+  if (gmres_zero_flux != NULL) {
+    delete gmres_zero_flux;
+    for (int i = 0; i < 8; i++)
+      delete gmres_flux_scratch[i];
+  }
 }
 
 //------------------------------------------------------------------------------
@@ -738,15 +1244,66 @@ void Snap::initialize_velocity(const SnapArray<1> &vel,
   vdelt.unmap(vdelt_region);
 }
 
+//------------------------------------------------------------------------------
+void Snap::initialize_fission(const SnapArray<1> &siga, 
+                              const SnapArray<1> &nusigf,
+                              const SnapArray<1> &chi) const
+//------------------------------------------------------------------------------
+{
+  // Original SNAP has no fission data so make some up that scales with
+  // the absorption of each material, with all neutrons born fast
+  PhysicalRegion siga_region = siga.map();
+  PhysicalRegion nusigf_region = nusigf.map();
+  PhysicalRegion chi_region = chi.map();
+  siga_region.wait_until_valid(true/*ignore warnings*/);
+  nusigf_region.wait_until_valid(true/*ignore warnings*/);
+  chi_region.wait_until_valid(true/*ignore warnings*/);
+
+  // Fission spectrum halves with each group
+  std::vector<double> spectrum(num_groups);
+  double spectrum_total = 0.0, weight = 1.0;
+  for (int g = 0; g < num_groups; g++, weight *= 0.5) {
+    spectrum[g] = weight;
+    spectrum_total += weight;
+  }
+  const Point<1> dp(0);
+  for (int g = 0; g < num_groups; g++)
+  {
+    AccessorRW<double,1> fa_siga(siga_region, SNAP_ENERGY_GROUP_FIELD(g));
+    AccessorRW<double,1> fa_nusigf(nusigf_region, SNAP_ENERGY_GROUP_FIELD(g));
+    AccessorRW<double,1> fa_chi(chi_region, SNAP_ENERGY_GROUP_FIELD(g));
+    fa_nusigf[1] = 1.2 * fa_siga[1];
+    if (material_layout != HOMOGENEOUS_LAYOUT)
+      fa_nusigf[2] = 0.6 * fa_siga[2];
+    fa_chi[dp] = spectrum[g] / spectrum_total;
+  }
+
+  siga.unmap(siga_region);
+  nusigf.unmap(nusigf_region);
+  chi.unmap(chi_region);
+}
+
 //------------------------------------------------------------------------------
 void Snap::save_fluxes(const Predicate &pred, const SnapArray<3> &src, 
                        const SnapArray<3> &dst, int energy_group_chunks) const
 //------------------------------------------------------------------------------
+{
+  const int num_group_chunks = 
+    (num_groups + energy_group_chunks - 1) / energy_group_chunks;
+  save_fluxes(std::vector<Predicate>(num_group_chunks, pred), 
+              src, dst, energy_group_chunks);
+}
+
+//------------------------------------------------------------------------------
+void Snap::save_fluxes(const std::vector<Predicate> &group_preds,
+                       const SnapArray<3> &src, const SnapArray<3> &dst, 
+                       int energy_group_chunks) const
+//------------------------------------------------------------------------------
 {
   // Use this macro to disable index space copy launches
 #ifdef NO_INDEX_SPACE_COPIES
   // Build the CopyLauncher
-  CopyLauncher launcher(pred);
+  CopyLauncher launcher;
   launcher.add_copy_requirements(
       RegionRequirement(LogicalRegion::NO_REGION, READ_ONLY, 
                         EXCLUSIVE, src.get_region()),
@@ -759,8 +1316,11 @@ void Snap::save_fluxes(const Predicate &pred, const SnapArray<3> &src,
   RegionRequirement &dst_req = launcher.dst_requirements.back();
   std::set<FieldID>::const_iterator src_it = src_fields.begin();
   std::set<FieldID>::const_iterator dst_it = dst_fields.begin();
+  unsigned chunk = 0;
   while ((src_it != src_fields.end()) && (dst_it != dst_fields.end()))
   {
+    assert(chunk < group_preds.size());
+    launcher.predicate = group_preds[chunk++];
     src_req.privilege_fields.clear();
     src_req.instance_fields.clear();
     dst_req.privilege_fields.clear();
@@ -778,6 +1338,9 @@ void Snap::save_fluxes(const Predicate &pred, const SnapArray<3> &src,
       if (dst_it == dst_fields.end())
         break;
     }
+    // Skip chunks that are not part of this Gauss-Seidel pass
+    if (launcher.predicate == Predicate::FALSE_PRED)
+      continue;
     // Iterate over the sub-regions and issue copies for each separately
     for (GenericPointInRectIterator<3> color_it(launch_bounds); 
           color_it; color_it++)   
@@ -785,11 +1348,14 @@ void Snap::save_fluxes(const Predicate &pred, const SnapArray<3> &src,
       DomainPoint dp = DomainPoint::from_point<3>(color_it.p);
       src_req.region = src.get_subregion(dp);
       dst_req.region = dst.get_subregion(dp);
+#ifdef SNAP_OVERHEAD_BENCHMARK
+      OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::COPY_LAUNCH);
+#endif
       runtime->issue_copy_operation(ctx, launcher);
     }
   }
 #else
-  IndexCopyLauncher launcher(get_launch_bounds(), pred);
+  IndexCopyLauncher launcher(get_launch_bounds());
   launcher.add_copy_requirements(
       RegionRequirement(src.get_partition(), 0/*projection id*/, 
                         READ_ONLY, EXCLUSIVE, src.get_region()),
@@ -802,8 +1368,11 @@ void Snap::save_fluxes(const Predicate &pred, const SnapArray<3> &src,
   RegionRequirement &dst_req = launcher.dst_requirements.back();
   std::set<FieldID>::const_iterator src_it = src_fields.begin();
   std::set<FieldID>::const_iterator dst_it = dst_fields.begin();
+  unsigned chunk = 0;
   while ((src_it != src_fields.end()) && (dst_it != dst_fields.end()))
   {
+    assert(chunk < group_preds.size());
+    launcher.predicate = group_preds[chunk++];
     src_req.privilege_fields.clear();
     src_req.instance_fields.clear();
     dst_req.privilege_fields.clear();
@@ -821,13 +1390,19 @@ void Snap::save_fluxes(const Predicate &pred, const SnapArray<3> &src,
       if (dst_it == dst_fields.end())
         break;
     }
+    // Skip chunks that are not part of this Gauss-Seidel pass
+    if (launcher.predicate == Predicate::FALSE_PRED)
+      continue;
+#ifdef SNAP_OVERHEAD_BENCHMARK
+    OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::COPY_LAUNCH);
+#endif
     runtime->issue_copy_operation(ctx, launcher);
   }
 #endif
 }
 
 //------------------------------------------------------------------------------
-void Snap::calculate_inner_source(const Predicate &pred,
+void Snap::calculate_inner_source(const std::vector<Predicate> &group_preds,
                           const SnapArray<3> &s_xs, const SnapArray<3> &flux0, 
                           const SnapArray<3> &fluxm, const SnapArray<3> &q2grp0,
                           const SnapArray<3> &q2grpm, const SnapArray<3> &qtot, 
@@ -836,17 +1411,21 @@ void Snap::calculate_inner_source(const Predicate &pred,
 {
   for (int g = 0; g < num_groups; g += energy_group_chunks)
   {
+    if (group_preds[g / energy_group_chunks] == Predicate::FALSE_PRED)
+      continue;
     int group_stop = g + energy_group_chunks - 1;
     if (group_stop >= num_groups)
       group_stop = num_groups - 1;
-    CalcInnerSource inner_src(*this, pred, s_xs, flux0, fluxm,
-                              q2grp0, q2grpm, qtot, g, group_stop);
+    CalcInnerSource inner_src(*this, group_preds[g / energy_group_chunks], 
+                s_xs, flux0, fluxm, q2grp0, q2grpm, qtot, g, group_stop);
     inner_src.dispatch(ctx, runtime);
   }
 }
 
 //------------------------------------------------------------------------------
-void Snap::perform_sweeps(const Predicate &pred, const SnapArray<3> &flux,
+void Snap::perform_sweeps(const Predicate &pred, 
+                          const std::vector<Predicate> &group_preds,
+                          const SnapArray<3> &flux,
                           const SnapArray<3> &fluxm, const SnapArray<3> &qtot, 
                           const SnapArray<1> &vdelt, const SnapArray<3> &dinv, 
                           const SnapArray<3> &t_xs,SnapArray<3> *time_flux_in[8],
@@ -854,7 +1433,8 @@ void Snap::perform_sweeps(const Predicate &pred, const SnapArray<3> &flux,
                           const SnapArray<2> &flux_xy, 
                           const SnapArray<2> &flux_yz,
                           const SnapArray<2> &flux_xz, 
-                          int energy_group_chunks) const
+                          int energy_group_chunks,
+                          const SnapArray<3> *leakage) const
 //------------------------------------------------------------------------------
 {
   // Boundary fluxes always get initialized to zero before sweeps
@@ -871,41 +1451,69 @@ void Snap::perform_sweeps(const Predicate &pred, const SnapArray<3> &flux,
     // Then loop over the energy groups by chunks
     for (int group = 0; group < num_groups; group+=energy_group_chunks)
     {
+      if (group_preds[group / energy_group_chunks] == Predicate::FALSE_PRED)
+        continue;
       int group_stop = group + energy_group_chunks - 1;
       // Clamp to the upper bound
       if (group_stop >= num_groups)
         group_stop = num_groups-1;
       // Launch the sweep from this corner for the given set of fields
-      MiniKBATask mini_kba(*this, pred, flux, fluxm, 
+      MiniKBATask mini_kba(*this, group_preds[group / energy_group_chunks], 
+                           flux, fluxm, 
                            qtot, vdelt, dinv, t_xs, 
                            *time_flux_in[corner], *time_flux_out[corner],
                            *qim[corner], flux_xy, flux_yz, flux_xz,
-                           group, group_stop, corner, ghost_offsets);
+                           group, group_stop, corner, ghost_offsets, leakage);
       mini_kba.dispatch(ctx, runtime);
     }
   }
 }
 
 //------------------------------------------------------------------------------
-Predicate Snap::test_inner_convergence(const Predicate &inner_pred, 
-                                       const SnapArray<3> &flux0,
-                                       const SnapArray<3> &flux0pi, 
-                                       const Future &pred_false_result,
-                                       int energy_group_chunks) const
+Predicate Snap::test_inner_convergence(
+                                   const std::vector<Predicate> &group_preds,
+                                   const SnapArray<3> &flux0,
+                                   const SnapArray<3> &flux0pi, 
+                                   const Future &zero_future,
+                                   const Future &true_future,
+                                   int energy_group_chunks,
+                                   std::vector<Predicate> &group_converged,
+                                   std::vector<Future> &max_changes) const
 //------------------------------------------------------------------------------
 {
+  group_converged.clear();
+  max_changes.clear();
   PredicateLauncher launcher(true/*and predicate*/);
   // Iterate over the energy group chunks
   for (int group = 0; group < num_groups; group+=energy_group_chunks)
   {
+    const Predicate &group_pred = group_preds[group / energy_group_chunks];
+    // Chunks outside of a Gauss-Seidel pass do not hold anything up
+    if (group_pred == Predicate::FALSE_PRED) {
+      group_converged.push_back(Predicate::TRUE_PRED);
+      continue;
+    }
     int group_stop = group + energy_group_chunks - 1;
     // Clamp to the upper bound
     if (group_stop >= num_groups)
       group_stop = num_groups-1;
-    TestInnerConvergence inner_conv(*this, inner_pred, flux0, flux0pi,
-                                    pred_false_result, group, group_stop);
-    Future f = inner_conv.dispatch<AndReduction>(ctx, runtime);
-    launcher.add_predicate(runtime->create_predicate(ctx, f));
+    // Chunks that have already converged are predicated off, they
+    // report no change and keep returning true
+    TestInnerConvergence inner_conv(*this, group_pred, flux0, flux0pi,
+                                    zero_future, group, group_stop);
+    max_changes.push_back(inner_conv.dispatch<MaxReduction>(ctx, runtime));
+    CompareFluxChange compare(group_pred, convergence_eps, 
+        std::vector<Future>(1, max_changes.back()), true_future, true_future);
+    Future f;
+    {
+#ifdef SNAP_OVERHEAD_BENCHMARK
+      OverheadBenchmark::LaunchTimer timer(
+                                  OverheadBenchmark::SINGLE_TASK_LAUNCH);
+#endif
+      f = runtime->execute_task(ctx, compare);
+    }
+    group_converged.push_back(runtime->create_predicate(ctx, f));
+    launcher.add_predicate(group_converged.back());
   }
   return runtime->create_predicate(ctx, launcher);
 }
@@ -915,11 +1523,13 @@ Predicate Snap::test_outer_convergence(const Predicate &outer_pred,
                                        const SnapArray<3> &flux0,
                                        const SnapArray<3> &flux0po,
                                        const Future &inner_converged,
-                                       const Future &pred_false_result,
-                                       int energy_group_chunks) const
+                                       const Future &zero_future,
+                                       const Future &true_future,
+                                       int energy_group_chunks,
+                                       std::vector<Future> &max_changes) const
 //------------------------------------------------------------------------------
 {
-  PredicateLauncher launcher(true/*and predicate*/);
+  max_changes.clear();
   // Iterate over the energy group chunks
   for (int group = 0; group < num_groups; group+=energy_group_chunks)
   {
@@ -928,11 +1538,283 @@ Predicate Snap::test_outer_convergence(const Predicate &outer_pred,
     if (group_stop >= num_groups)
       group_stop = num_groups-1;
     TestOuterConvergence outer_conv(*this, outer_pred, flux0, flux0po,
-                inner_converged, pred_false_result, group, group_stop);
-    Future f = outer_conv.dispatch<AndReduction>(ctx, runtime);
-    launcher.add_predicate(runtime->create_predicate(ctx, f));
+                                    zero_future, group, group_stop);
+    max_changes.push_back(outer_conv.dispatch<MaxReduction>(ctx, runtime));
   }
-  return runtime->create_predicate(ctx, launcher);
+  // If the inner loop didn't converge, then we can't either
+  CompareFluxChange compare(outer_pred, 100.0 * convergence_eps, 
+                            max_changes, inner_converged, true_future);
+#ifdef SNAP_OVERHEAD_BENCHMARK
+  OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::SINGLE_TASK_LAUNCH);
+#endif
+  Future f = runtime->execute_task(ctx, compare);
+  return runtime->create_predicate(ctx, f);
+}
+
+//------------------------------------------------------------------------------
+void Snap::perform_dsa(const std::vector<Predicate> &group_preds,
+                       const SnapArray<3> &s_xs, const SnapArray<3> &t_xs,
+                       const SnapArray<1> &vdelt, const SnapArray<3> &flux0,
+                       const SnapArray<3> &flux0pi, const SnapArray<3> &dsa_x,
+                       const SnapArray<3> &dsa_r, const SnapArray<3> &dsa_p,
+                       const SnapArray<3> &dsa_ap, const Future &zero_future,
+                       int energy_group_chunks) const
+//------------------------------------------------------------------------------
+{
+  // Each chunk of groups gets its own CG which is predicated the same
+  // way as its sweeps. The iteration count is fixed so that we never
+  // block on a residual, the tasks just stop updating once it is small.
+  for (int group = 0; group < num_groups; group+=energy_group_chunks)
+  {
+    int group_stop = group + energy_group_chunks - 1;
+    // Clamp to the upper bound
+    if (group_stop >= num_groups)
+      group_stop = num_groups-1;
+    const Predicate &pred = group_preds[group / energy_group_chunks];
+    if (pred == Predicate::FALSE_PRED)
+      continue;
+    DSAInitialize initialize(*this, pred, s_xs, flux0, flux0pi, 
+                   dsa_x, dsa_r, dsa_p, zero_future, group, group_stop);
+    const Future rr0 = initialize.dispatch<SumReduction>(ctx, runtime);
+    Future rr = rr0;
+    for (int iter = 0; iter < dsa_iters; iter++)
+    {
+      DSAStencil stencil(*this, pred, dsa_p, t_xs, s_xs, dsa_ap, vdelt,
+                         zero_future, group, group_stop);
+      const Future pap = stencil.dispatch<SumReduction>(ctx, runtime);
+      DSAUpdate update(*this, pred, dsa_p, dsa_ap, dsa_x, dsa_r, 
+                       rr0, rr, pap, zero_future, group, group_stop);
+      const Future rr_new = update.dispatch<SumReduction>(ctx, runtime);
+      if ((iter + 1) < dsa_iters) {
+        DSADirection direction(*this, pred, dsa_r, dsa_p, rr0, rr, rr_new,
+                               group, group_stop);
+        direction.dispatch(ctx, runtime);
+      }
+      rr = rr_new;
+    }
+    DSACorrect correct(*this, pred, dsa_x, flux0, group, group_stop);
+    correct.dispatch(ctx, runtime);
+  }
+}
+
+//------------------------------------------------------------------------------
+void Snap::perform_gmres(const Predicate &pred, 
+                         const std::vector<Predicate> &group_preds,
+                         const SnapArray<3> &flux0, const SnapArray<3> &flux0pi,
+                         const SnapArray<3> &fluxm, const SnapArray<3> &qtot,
+                         const SnapArray<3> &s_xs, const SnapArray<1> &vdelt,
+                         const SnapArray<3> &dinv, const SnapArray<3> &t_xs,
+                         SnapArray<3> *time_flux_in[8], 
+                         SnapArray<3> *time_flux_out[8], SnapArray<3> *qim[8],
+                         const SnapArray<2> &flux_xy, 
+                         const SnapArray<2> &flux_yz,
+                         const SnapArray<2> &flux_xz,
+                         const std::vector<SnapArray<3>*> &basis,
+                         const SnapArray<3> &gmres_w,
+                     const std::vector<std::set<FieldID> > &group_chunk_fields,
+                         const Future &zero_future, 
+                         int energy_group_chunks) const
+//------------------------------------------------------------------------------
+{
+  // The source iteration sweep has already gone from flux0pi to flux0
+  // so their difference is the residual of the within-group problem
+  // at flux0pi, one restart cycle then replaces flux0 with the GMRES
+  // solution. Every matrix-vector product is a full set of sweeps over
+  // all the group chunks that are still iterating.
+  const int num_group_chunks = group_chunk_fields.size();
+  const int m = basis.size();
+  std::vector<std::vector<Future> > hessenberg(num_group_chunks);
+  for (int group = 0; group < num_groups; group+=energy_group_chunks)
+  {
+    int group_stop = group + energy_group_chunks - 1;
+    // Clamp to the upper bound
+    if (group_stop >= num_groups)
+      group_stop = num_groups-1;
+    const int chunk = group / energy_group_chunks;
+    if (group_preds[chunk] == Predicate::FALSE_PRED)
+      continue;
+    GMRESInitialize initialize(*this, group_preds[chunk], flux0, flux0pi,
+                               gmres_w, zero_future, group, group_stop);
+    const Future rr = initialize.dispatch<SumReduction>(ctx, runtime);
+    hessenberg[chunk].push_back(rr);
+    GMRESNormalize normalize(*this, group_preds[chunk], gmres_w, 
+                             *basis[0], rr, group, group_stop);
+    normalize.dispatch(ctx, runtime);
+  }
+  for (int j = 0; j < m; j++)
+  {
+    // The self-scattering source of v_j replaces qtot which gets
+    // recomputed by the next inner source calculation anyway
+    for (int group = 0; group < num_groups; group+=energy_group_chunks)
+    {
+      int group_stop = group + energy_group_chunks - 1;
+      if (group_stop >= num_groups)
+        group_stop = num_groups-1;
+      const int chunk = group / energy_group_chunks;
+      if (group_preds[chunk] == Predicate::FALSE_PRED)
+        continue;
+      GMRESSource source(*this, group_preds[chunk], s_xs, *basis[j], qtot,
+                         group, group_stop);
+      source.dispatch(ctx, runtime);
+      gmres_w.initialize_fields(group_chunk_fields[chunk], group_preds[chunk]);
+    }
+    perform_sweeps(pred, group_preds, gmres_w, fluxm, qtot, vdelt, dinv, 
+                   t_xs, time_flux_in, time_flux_out, qim, flux_xy, 
+                   flux_yz, flux_xz, energy_group_chunks);
+    // Classical Gram-Schmidt so the projections can all run at once
+    for (int group = 0; group < num_groups; group+=energy_group_chunks)
+    {
+      int group_stop = group + energy_group_chunks - 1;
+      if (group_stop >= num_groups)
+        group_stop = num_groups-1;
+      const int chunk = group / energy_group_chunks;
+      if (group_preds[chunk] == Predicate::FALSE_PRED)
+        continue;
+      std::vector<Future> dots(j+1);
+      for (int i = 0; i <= j; i++) {
+        GMRESDot dot(*this, group_preds[chunk], *basis[i], *basis[j], 
+                     gmres_w, zero_future, group, group_stop);
+        dots[i] = dot.dispatch<SumReduction>(ctx, runtime);
+      }
+      GMRESOrthogonalize orthogonalize(*this, group_preds[chunk], basis, j,
+                          gmres_w, dots, zero_future, group, group_stop);
+      const Future norm2 = orthogonalize.dispatch<SumReduction>(ctx, runtime);
+      hessenberg[chunk].insert(hessenberg[chunk].end(), 
+                               dots.begin(), dots.end());
+      hessenberg[chunk].push_back(norm2);
+      if ((j + 1) < m) {
+        GMRESNormalize normalize(*this, group_preds[chunk], gmres_w, 
+                                 *basis[j+1], norm2, group, group_stop);
+        normalize.dispatch(ctx, runtime);
+      }
+    }
+  }
+  for (int group = 0; group < num_groups; group+=energy_group_chunks)
+  {
+    int group_stop = group + energy_group_chunks - 1;
+    if (group_stop >= num_groups)
+      group_stop = num_groups-1;
+    const int chunk = group / energy_group_chunks;
+    if (group_preds[chunk] == Predicate::FALSE_PRED)
+      continue;
+    GMRESUpdate update(*this, group_preds[chunk], flux0pi, flux0, basis,
+                       hessenberg[chunk], group, group_stop);
+    update.dispatch(ctx, runtime);
+  }
+}
+
+//------------------------------------------------------------------------------
+void Snap::perform_anderson(const Predicate &pred, const SnapArray<3> &flux0,
+                            const SnapArray<3> &flux0po,
+                            const SnapArray<3> &anderson_f,
+                            const SnapArray<3> &anderson_g,
+                            const std::vector<SnapArray<3>*> &anderson_df,
+                            const std::vector<SnapArray<3>*> &anderson_dg,
+                            std::vector<std::vector<Future> > &gram,
+                            int &iteration, const Future &zero_future) const
+//------------------------------------------------------------------------------
+{
+  // The newest differences overwrite the oldest ones
+  const int depth = anderson_df.size();
+  const bool has_history = (iteration > 0);
+  const int slot = has_history ? ((iteration - 1) % depth) : 0;
+  AndersonResidual residual(*this, pred, flux0, flux0po, anderson_f, 
+                  anderson_g, *anderson_df[slot], *anderson_dg[slot], 
+                  has_history);
+  residual.dispatch(ctx, runtime);
+  iteration++;
+  if (!has_history)
+    return;
+  const int n = ((iteration - 1) < depth) ? (iteration - 1) : depth;
+  // Only the new difference needs dot products with the old ones
+  for (int i = 0; i < n; i++) {
+    AndersonDot dot(*this, pred, *anderson_df[slot], *anderson_df[i], 
+                    zero_future);
+    gram[slot][i] = dot.dispatch<SumReduction>(ctx, runtime);
+    gram[i][slot] = gram[slot][i];
+  }
+  std::vector<Future> normal_equations;
+  for (int i = 0; i < n; i++)
+    for (int j = i; j < n; j++)
+      normal_equations.push_back(gram[i][j]);
+  for (int i = 0; i < n; i++) {
+    AndersonDot dot(*this, pred, *anderson_df[i], anderson_f, zero_future);
+    normal_equations.push_back(dot.dispatch<SumReduction>(ctx, runtime));
+  }
+  std::vector<SnapArray<3>*> columns(anderson_dg.begin(), 
+                                     anderson_dg.begin() + n);
+  AndersonMix mix(*this, pred, flux0, columns, normal_equations);
+  mix.dispatch(ctx, runtime);
+}
+
+//------------------------------------------------------------------------------
+void Snap::extrapolate_flux(const SnapArray<3> &flux0,
+                            const std::vector<SnapArray<3>*> &step_history,
+                            int &steps_saved, int &newest_step) const
+//------------------------------------------------------------------------------
+{
+  // Weights of the last step and the ones before it for constant, 
+  // linear, and quadratic extrapolation with a fixed time step
+  static const double weights[3][3] = 
+    { { 1.0, 0.0, 0.0 }, { 2.0, -1.0, 0.0 }, { 3.0, -3.0, 1.0 } };
+  const int order = step_history.size();
+  // Use as many previous steps as we have up to the order
+  const int used = steps_saved;
+  assert(used <= order);
+  // The end of the last step goes in an empty slot or over the oldest
+  const int slot = (steps_saved < order) ? steps_saved : 
+                                           ((newest_step + 1) % order);
+  double save_weight = 0.0, prev_weight = 0.0;
+  const SnapArray<3> *prev = NULL;
+  if (steps_saved == order) {
+    // The oldest step we use is the one getting overwritten
+    save_weight = weights[used][used];
+    if (used > 1) {
+      prev = step_history[newest_step];
+      prev_weight = weights[used][1];
+    }
+  } else if (used > 0) {
+    prev = step_history[newest_step];
+    prev_weight = weights[used][1];
+  }
+  ExtrapolateFlux extrapolate(*this, flux0, *step_history[slot], prev,
+                              weights[used][0], save_weight, prev_weight);
+  extrapolate.dispatch(ctx, runtime);
+  newest_step = slot;
+  if (steps_saved < order)
+    steps_saved++;
+}
+
+//------------------------------------------------------------------------------
+void Snap::perform_coarse_rebalance(const Predicate &pred, 
+                                    const SnapArray<3> &flux0,
+                                    const SnapArray<3> &fluxm,
+                                    const SnapArray<3> &qi, 
+                                    const SnapArray<3> &t_xs,
+                                    const SnapArray<3> &s_xs,
+                                    const SnapArray<3> &mat,
+                                    const SnapArray<2> &slgg,
+                                    const SnapArray<3> &leakage,
+                                    const SnapArray<3> &balance) const
+//------------------------------------------------------------------------------
+{
+  // The sweeps already reduced the leakage out of every face of each 
+  // chunk, sum up the rest of the balance terms of each chunk
+  CalcCoarseBalance calc_balance(*this, pred, flux0, qi, t_xs, s_xs, 
+                                 mat, balance, slgg);
+  calc_balance.dispatch(ctx, runtime);
+  // The coarse system couples all the chunks so it is solved in one place
+  SolveCoarseRebalance solve(pred, leakage, balance);
+  {
+#ifdef SNAP_OVERHEAD_BENCHMARK
+    OverheadBenchmark::LaunchTimer timer(
+                                OverheadBenchmark::SINGLE_TASK_LAUNCH);
+#endif
+    runtime->execute_task(ctx, solve);
+  }
+  // Then scale the flux of each chunk by its factors
+  ApplyCoarseRebalance apply(*this, pred, flux0, fluxm, balance);
+  apply.dispatch(ctx, runtime);
 }
 
 //------------------------------------------------------------------------------
@@ -941,8 +1823,15 @@ Predicate Snap::test_outer_convergence(const Predicate &outer_pred,
                                      Context ctx, Runtime *runtime)
 //------------------------------------------------------------------------------
 {
-  printf("Welcome to Legion-SNAP!\n");
-  report_arguments();
+  // Only the first shard prints the banner when we are control replicated
+  if (task->get_shard_id() == 0) {
+    report_shard = true;
+    printf("Welcome to Legion-SNAP!\n");
+    report_arguments();
+  }
+#ifdef SNAP_SWEEP_EFFICIENCY
+  SweepEfficiency::set_shard(task->get_shard_id(), task->get_total_shards());
+#endif
   Snap snap(ctx, runtime); 
   snap.setup();
   snap.transport_solve();
@@ -970,6 +1859,20 @@ static void read_bool(FILE *f, const char *name, bool &result)
   result = (temp != 0);
 }
 
+static void read_optional_bool(FILE *f, const char *name, bool &result)
+{
+  // Keys that original SNAP does not know about are optional so that
+  // the stock input decks keep working, rewind if it is not there
+  char format[80];
+  sprintf(format,"  %s=%%d", name);
+  const long position = ftell(f);
+  int temp = 0;
+  if (fscanf(f, format, &temp) > 0)
+    result = (temp != 0);
+  else
+    assert(fseek(f, position, SEEK_SET) == 0);
+}
+
 static void read_double(FILE *f, const char *name, double &result)
 {
   char format[80];
@@ -1007,6 +1910,20 @@ int Snap::dump_kplane = 0;
 int Snap::dump_population = 0;
 bool Snap::minikba_sweep = true;
 bool Snap::single_angle_copy = true;
+bool Snap::gauss_seidel_groups = false;
+const char *Snap::history_prefix = NULL;
+bool Snap::use_dsa = false;
+int Snap::dsa_iters = 10;
+bool Snap::use_gmres = false;
+int Snap::gmres_restart = 10;
+int Snap::anderson_depth = 0;
+int Snap::extrapolation_order = 0;
+bool Snap::adaptive_runahead = false;
+bool Snap::coarse_rebalance = false;
+int Snap::max_power_iters = 0;
+double Snap::wielandt_shift = 0.0;
+bool Snap::report_shard = false;
+int Snap::report_node = 0;
 
 int Snap::num_corners = 1;
 int Snap::nx_per_chunk;
@@ -1128,6 +2045,7 @@ int Snap::lma[4];
     printf("Legion SNAP currently requires two copies of angle flux\n");
     exit(1);
   }
+  read_optional_bool(f, "gsgrp", gauss_seidel_groups);
   fclose(f);
   if (!minikba_sweep)
   {
@@ -1164,6 +2082,144 @@ int Snap::lma[4];
   nx_per_chunk = nx / nx_chunks;
   ny_per_chunk = ny / ny_chunks;
   nz_per_chunk = nz / nz_chunks;
+  // Look for our own flags after the input file, the runtime
+  // will ignore any flags that it doesn't recognize
+  for (int i = 2; i < argc; i++)
+  {
+    if (!strcmp(argv[i], "-history")) {
+      if (++i == argc) {
+        printf("ERROR: -history requires a file prefix\n");
+        exit(1);
+      }
+      history_prefix = argv[i];
+    } else if (!strcmp(argv[i], "-dsa")) {
+      use_dsa = true;
+    } else if (!strcmp(argv[i], "-dsa_iters")) {
+      if (++i == argc) {
+        printf("ERROR: -dsa_iters requires an iteration count\n");
+        exit(1);
+      }
+      dsa_iters = atoi(argv[i]);
+      if (dsa_iters < 1) {
+        printf("ERROR: -dsa_iters must be at least 1\n");
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "-gmres")) {
+      use_gmres = true;
+    } else if (!strcmp(argv[i], "-gmres_restart")) {
+      if (++i == argc) {
+        printf("ERROR: -gmres_restart requires a Krylov space size\n");
+        exit(1);
+      }
+      gmres_restart = atoi(argv[i]);
+      if (gmres_restart < 1) {
+        printf("ERROR: -gmres_restart must be at least 1\n");
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "-anderson")) {
+      if (++i == argc) {
+        printf("ERROR: -anderson requires a mixing depth\n");
+        exit(1);
+      }
+      anderson_depth = atoi(argv[i]);
+      if (anderson_depth < 1) {
+        printf("ERROR: -anderson must be at least 1\n");
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "-adaptive_runahead")) {
+      adaptive_runahead = true;
+    } else if (!strcmp(argv[i], "-cmr")) {
+      coarse_rebalance = true;
+    } else if (!strcmp(argv[i], "-keff")) {
+      if (++i == argc) {
+        printf("ERROR: -keff requires a number of power iterations\n");
+        exit(1);
+      }
+      max_power_iters = atoi(argv[i]);
+      if (max_power_iters < 1) {
+        printf("ERROR: -keff must be at least 1\n");
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "-wielandt")) {
+      if (++i == argc) {
+        printf("ERROR: -wielandt requires a shift\n");
+        exit(1);
+      }
+      wielandt_shift = atof(argv[i]);
+      if (wielandt_shift <= 0.0) {
+        printf("ERROR: -wielandt shift must be positive\n");
+        exit(1);
+      }
+    } else if (!strcmp(argv[i], "-extrapolate")) {
+      if (++i == argc) {
+        printf("ERROR: -extrapolate requires an order\n");
+        exit(1);
+      }
+      extrapolation_order = atoi(argv[i]);
+      if ((extrapolation_order < 1) || (extrapolation_order > 2)) {
+        printf("ERROR: -extrapolate must be 1 (linear) or 2 (quadratic)\n");
+        exit(1);
+      }
+    }
+  }
+  if (use_gmres)
+  {
+    // GMRES needs the sweep to be a linear operator on the scalar flux
+    if (flux_fixup) {
+      printf("ERROR: -gmres is not supported with fixup=1\n");
+      exit(1);
+    }
+    if (source_layout == MMS_SOURCE) {
+      printf("ERROR: -gmres is not supported with src_opt=3\n");
+      exit(1);
+    }
+    if (use_dsa) {
+      printf("ERROR: -gmres and -dsa are different inner solvers\n");
+      exit(1);
+    }
+  }
+  if ((extrapolation_order > 0) && !time_dependent) {
+    printf("ERROR: -extrapolate requires timedep=1\n");
+    exit(1);
+  }
+  if (max_power_iters > 0) {
+    if (time_dependent) {
+      printf("ERROR: -keff is not supported with timedep=1\n");
+      exit(1);
+    }
+    if (source_layout == MMS_SOURCE) {
+      printf("ERROR: -keff is not supported with src_opt=3\n");
+      exit(1);
+    }
+  }
+  if (wielandt_shift > 0.0) {
+    if (max_power_iters == 0) {
+      printf("ERROR: -wielandt requires -keff\n");
+      exit(1);
+    }
+    // The rebalance only knows about the fixed source
+    if (coarse_rebalance) {
+      printf("ERROR: -wielandt is not supported with -cmr\n");
+      exit(1);
+    }
+  }
+  // The rebalance takes the leakage of each chunk from the sweeps that 
+  // made the flux, which no longer holds if anything else changes the 
+  // flux, and it only balances the isotropic sources without time terms
+  if (coarse_rebalance) {
+    if (time_dependent) {
+      printf("ERROR: -cmr is not supported with timedep=1\n");
+      exit(1);
+    }
+    if (use_dsa || use_gmres) {
+      printf("ERROR: -cmr is not supported with -dsa or -gmres\n");
+      exit(1);
+    }
+    if (source_layout == MMS_SOURCE) {
+      printf("ERROR: -cmr is not supported with src_opt=3\n");
+      exit(1);
+    }
+  }
   compute_derived_globals();
 }
 
@@ -1377,6 +2433,35 @@ int Snap::lma[4];
       (dump_population == 1) ? "Final" : "No");
   printf("Mini-KBA Sweep: %s\n", minikba_sweep ? "Yes" : "No");
   printf("Single Angle Copy: %s\n", single_angle_copy ? "Yes" : "No");
+  printf("Outer Group Ordering: %s\n", 
+      gauss_seidel_groups ? "Gauss-Seidel" : "Jacobi");
+  printf("Convergence History: %s\n", 
+      (history_prefix != NULL) ? history_prefix : "No");
+  if (use_dsa)
+    printf("Diffusion Synthetic Acceleration: Yes (%d CG iterations)\n",
+           dsa_iters);
+  else
+    printf("Diffusion Synthetic Acceleration: No\n");
+  if (use_gmres)
+    printf("Inner Solver: GMRES (restart %d)\n", gmres_restart);
+  else
+    printf("Inner Solver: Source Iteration\n");
+  if (anderson_depth > 0)
+    printf("Outer Acceleration: Anderson (depth %d)\n", anderson_depth);
+  else
+    printf("Outer Acceleration: No\n");
+  printf("Runahead: %s\n", adaptive_runahead ? "Adaptive" : "Fixed");
+  printf("Time Step Extrapolation: %s\n", (extrapolation_order == 2) ? 
+      "Quadratic" : (extrapolation_order == 1) ? "Linear" : "No");
+  printf("Coarse Mesh Rebalance: %s\n", coarse_rebalance ? "Yes" : "No");
+  if (max_power_iters > 0) {
+    printf("k-Eigenvalue: Power Iteration (max %d)\n", max_power_iters);
+    if (wielandt_shift > 0.0)
+      printf("Wielandt Shift: %g\n", wielandt_shift);
+    else
+      printf("Wielandt Shift: No\n");
+  } else
+    printf("k-Eigenvalue: No\n");
 }
 
 //------------------------------------------------------------------------------
@@ -1385,6 +2470,8 @@ int Snap::lma[4];
 {
   TaskVariantRegistrar registrar(SNAP_TOP_LEVEL_TASK_ID, "snap_main_variant");
   registrar.add_constraint(ProcessorConstraint(Processor::LOC_PROC));
+  // Let the top-level task be control replicated across nodes
+  registrar.set_replicable();
   Runtime::preregister_task_variant<snap_top_level_task>(registrar,
                           Snap::task_names[SNAP_TOP_LEVEL_TASK_ID]);
   Runtime::set_top_level_task_id(SNAP_TOP_LEVEL_TASK_ID);
@@ -1417,6 +2504,29 @@ int Snap::lma[4];
   MMSInitTimeDependent::preregister_cpu_variants();
   MMSScale::preregister_cpu_variants();
   MMSCompare::preregister_cpu_variants();
+  CompareFluxChange::preregister_cpu_variants();
+  DSAInitialize::preregister_cpu_variants();
+  DSAStencil::preregister_cpu_variants();
+  DSAUpdate::preregister_cpu_variants();
+  DSADirection::preregister_cpu_variants();
+  DSACorrect::preregister_cpu_variants();
+  GMRESInitialize::preregister_cpu_variants();
+  GMRESNormalize::preregister_cpu_variants();
+  GMRESSource::preregister_cpu_variants();
+  GMRESDot::preregister_cpu_variants();
+  GMRESOrthogonalize::preregister_cpu_variants();
+  GMRESUpdate::preregister_cpu_variants();
+  AndersonResidual::preregister_cpu_variants();
+  AndersonDot::preregister_cpu_variants();
+  AndersonMix::preregister_cpu_variants();
+  ExtrapolateFlux::preregister_cpu_variants();
+  CalcCoarseBalance::preregister_cpu_variants();
+  SolveCoarseRebalance::preregister_cpu_variants();
+  ApplyCoarseRebalance::preregister_cpu_variants();
+  CalcFissionProduction::preregister_cpu_variants();
+  CalcFissionSource::preregister_cpu_variants();
+  UpdateEigenvalue::preregister_cpu_variants();
+  CalcEigenvalueChange::preregister_cpu_variants();
   ConvergenceMonad::preregister_cpu_variants();
   // Register projection functors for each corner
   Runtime::preregister_projection_functor(SNAP_XY_PROJECTION(true/*forward*/),
@@ -1431,11 +2541,35 @@ int Snap::lma[4];
             new FluxProjectionFunctor(XZ_PROJECTION, true/*forward*/));
   Runtime::preregister_projection_functor(SNAP_XZ_PROJECTION(false/*forward*/),
             new FluxProjectionFunctor(XZ_PROJECTION, false/*forward*/));
+  // Register the sharding functor for control replication
+  Runtime::preregister_sharding_functor(SPATIAL_SHARDING_ID,
+                                        new SnapShardingFunctor());
   // Finally register our reduction operators
   Runtime::register_reduction_op<AndReduction>(AndReduction::REDOP);
   Runtime::register_reduction_op<SumReduction>(SumReduction::REDOP);
+  Runtime::register_reduction_op<MaxReduction>(MaxReduction::REDOP);
   Runtime::register_reduction_op<TripleReduction>(TripleReduction::REDOP);
   Runtime::register_reduction_op<MMSReduction>(MMSReduction::REDOP);
+  // Any of the optional profiles are reported once the runtime has
+  // shut down, every process reports what ran on its own node
+#ifdef SNAP_SWEEP_ROOFLINE
+  atexit(MiniKBATask::report_sweep_roofline);
+#endif
+#ifdef SNAP_TASK_PROFILING
+  atexit(TaskProfiler::report);
+#endif
+#ifdef SNAP_TASK_TRACING
+  atexit(TaskTracer::write_trace);
+#endif
+#ifdef SNAP_PERF_COUNTERS
+  atexit(PerfCounters::report);
+#endif
+#ifdef SNAP_SWEEP_EFFICIENCY
+  atexit(SweepEfficiency::report);
+#endif
+#ifdef SNAP_OVERHEAD_BENCHMARK
+  atexit(OverheadBenchmark::report);
+#endif
 }
 
 //------------------------------------------------------------------------------
@@ -1443,6 +2577,9 @@ int Snap::lma[4];
                                          const std::set<Processor> &local_procs)
 //------------------------------------------------------------------------------
 {
+  // Remember which node this is so the reports at exit can say so
+  if (!local_procs.empty())
+    report_node = local_procs.begin()->address_space();
   Legion::Mapping::MapperRuntime *mapper_rt = runtime->get_mapper_runtime();
   for (std::set<Processor>::const_iterator it = local_procs.begin();
         it != local_procs.end(); it++)
@@ -1497,6 +2634,58 @@ int Snap::lma[4];
   return layout_id;
 }
 
+//------------------------------------------------------------------------------
+/*static*/ unsigned Snap::chunk_owner(const Point<3> &chunk, size_t num_owners)
+//------------------------------------------------------------------------------
+{
+  // Owners get contiguous blocks of chunks in linearized order so that
+  // each owner's chunks form a handful of rectangles (see owned_chunks)
+  // and neighboring chunks in a sweep are mostly on the same node
+  const long long total_chunks = (long long)nx_chunks * ny_chunks * nz_chunks;
+  const long long x = MAX(0LL, MIN((long long)chunk[0], nx_chunks-1LL));
+  const long long y = MAX(0LL, MIN((long long)chunk[1], ny_chunks-1LL));
+  const long long z = MAX(0LL, MIN((long long)chunk[2], nz_chunks-1LL));
+  const long long index = (z * ny_chunks + y) * nx_chunks + x;
+  return ((index * (long long)num_owners) / total_chunks);
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void Snap::owned_chunks(unsigned owner, size_t num_owners,
+                                   std::vector<Rect<3> > &rects)
+//------------------------------------------------------------------------------
+{
+  const long long total_chunks = (long long)nx_chunks * ny_chunks * nz_chunks;
+  const long long plane = (long long)nx_chunks * ny_chunks;
+  // The linearized chunks [start,stop) are the ones that chunk_owner
+  // assigns to this owner
+  long long start = ((long long)owner * total_chunks + num_owners - 1) / num_owners;
+  const long long stop = 
+    ((long long)(owner+1) * total_chunks + num_owners - 1) / num_owners;
+  // Break the range into at most five rectangles: a partial row, the 
+  // rest of a plane, whole planes, then rows and a row at the end
+  while (start < stop) {
+    const long long x = start % nx_chunks;
+    const long long y = (start / nx_chunks) % ny_chunks;
+    const long long z = start / plane;
+    if ((x != 0) || ((stop - start) < nx_chunks)) {
+      const long long row_stop = MIN(stop, start - x + nx_chunks);
+      rects.push_back(Rect<3>(Point<3>(x, y, z),
+                              Point<3>(x + (row_stop - start) - 1, y, z)));
+      start = row_stop;
+    } else if ((y != 0) || ((stop - start) < plane)) {
+      const long long rows = MIN((stop - start) / nx_chunks, ny_chunks - y);
+      rects.push_back(Rect<3>(Point<3>(0, y, z),
+                              Point<3>(nx_chunks-1, y + rows - 1, z)));
+      start += rows * nx_chunks;
+    } else {
+      const long long planes = (stop - start) / plane;
+      rects.push_back(Rect<3>(Point<3>(0, 0, z),
+                        Point<3>(nx_chunks-1, ny_chunks-1, z + planes - 1)));
+      start += planes * plane;
+    }
+  }
+}
+
 //------------------------------------------------------------------------------
 template<int DIM>
 SnapArray<DIM>::SnapArray(IndexSpace<DIM> is, IndexPartition<DIM> ip, 
@@ -1577,6 +2766,15 @@ LogicalRegion<DIM> SnapArray<DIM>::get_subregion(const Point<DIM> &color) const
 template<int DIM>
 void SnapArray<DIM>::initialize(Predicate pred) const
 //------------------------------------------------------------------------------
+{
+  initialize_fields(all_fields, pred);
+}
+
+//------------------------------------------------------------------------------
+template<int DIM>
+void SnapArray<DIM>::initialize_fields(const std::set<FieldID> &fields,
+                                       Predicate pred) const
+//------------------------------------------------------------------------------
 {
 #ifndef NO_INDEX_SPACE_FILLS
   // If we have partition it is better to do an index space fill for scalability
@@ -1585,14 +2783,20 @@ void SnapArray<DIM>::initialize(Predicate pred) const
     IndexFillLauncher launcher(color_space, lp, lr, 
                                TaskArgument(fill_buffer, field_size),
                                0/*identity*/, pred);
-    launcher.fields = all_fields;
+    launcher.fields = fields;
+#ifdef SNAP_OVERHEAD_BENCHMARK
+    OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::FILL_LAUNCH);
+#endif
     runtime->fill_fields(ctx, launcher);
   }
   else
 #endif
   {
     FillLauncher launcher(lr, lr, TaskArgument(fill_buffer, field_size), pred);
-    launcher.fields = all_fields;
+    launcher.fields = fields;
+#ifdef SNAP_OVERHEAD_BENCHMARK
+    OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::FILL_LAUNCH);
+#endif
     runtime->fill_fields(ctx, launcher);
   }
 }
@@ -1610,6 +2814,9 @@ void SnapArray<DIM>::initialize(T value, Predicate pred) const
                                TaskArgument(&value, sizeof(value)),
                                0/*identity*/, pred);
     launcher.fields = all_fields;
+#ifdef SNAP_OVERHEAD_BENCHMARK
+    OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::FILL_LAUNCH);
+#endif
     runtime->fill_fields(ctx, launcher);
   }
   else
@@ -1617,6 +2824,9 @@ void SnapArray<DIM>::initialize(T value, Predicate pred) const
   {
     FillLauncher launcher(lr, lr, TaskArgument(&value, sizeof(value)), pred);
     launcher.fields = all_fields;
+#ifdef SNAP_OVERHEAD_BENCHMARK
+    OverheadBenchmark::LaunchTimer timer(OverheadBenchmark::FILL_LAUNCH);
+#endif
     runtime->fill_fields(ctx, launcher);
   }
 }
@@ -1789,6 +2999,49 @@ void FluxProjectionFunctor::invert(Legion::LogicalRegion region,
   }
 }
 
+//------------------------------------------------------------------------------
+SnapShardingFunctor::SnapShardingFunctor(void)
+  : ShardingFunctor()
+//------------------------------------------------------------------------------
+{
+}
+
+//------------------------------------------------------------------------------
+Legion::ShardID SnapShardingFunctor::shard(const Legion::DomainPoint &point,
+                                           const Legion::Domain &full_space,
+                                           const size_t total_shards)
+//------------------------------------------------------------------------------
+{
+  // Spatial chunks go to the same shard as the node that the mapper
+  // assigns them to in global_cpu_mapping (the mapper puts shard i on
+  // the i-th address space)
+  if (point.get_dim() == 3)
+    return Snap::chunk_owner(Point<3>(point), total_shards);
+  // Everything else (e.g. fills of the ghost flux planes) is round 
+  // robin across the shards in linearized order
+  switch (point.get_dim())
+  {
+    case 1:
+      {
+        const Rect<1> bounds = full_space;
+        const Point<1> p = point;
+        return ((p[0] - bounds.lo[0]) % total_shards);
+      }
+    case 2:
+      {
+        const Rect<2> bounds = full_space;
+        const Point<2> p = point;
+        const long long index = (p[1] - bounds.lo[1]) * 
+          ((bounds.hi[0] - bounds.lo[0]) + 1) + (p[0] - bounds.lo[0]);
+        return (index % total_shards);
+      }
+    default:
+      break;
+  }
+  // Anything else goes on the first shard
+  return 0;
+}
+
 //------------------------------------------------------------------------------
 template<>
 /*static*/ void AndReduction::apply<true>(LHS &lhs, RHS rhs)
@@ -1873,6 +3126,56 @@ void SumReduction::fold<false>(RHS &rhs1, RHS rhs2)
   } while (!__sync_bool_compare_and_swap(target, oldval.as_int, newval.as_int));
 }
 
+const double MaxReduction::identity = 0.0;
+
+//------------------------------------------------------------------------------
+template <>
+void MaxReduction::apply<true>(LHS &lhs, RHS rhs) 
+//------------------------------------------------------------------------------
+{
+  if (rhs > lhs)
+    lhs = rhs;
+}
+
+//------------------------------------------------------------------------------
+template<>
+void MaxReduction::apply<false>(LHS &lhs, RHS rhs)
+//------------------------------------------------------------------------------
+{
+  volatile long *target = (volatile long *)&lhs;
+  union { long as_int; double as_float; } oldval, newval;
+  do {
+    oldval.as_int = *target;
+    if (oldval.as_float >= rhs)
+      return;
+    newval.as_float = rhs;
+  } while (!__sync_bool_compare_and_swap(target, oldval.as_int, newval.as_int));
+}
+
+//------------------------------------------------------------------------------
+template<>
+void MaxReduction::fold<true>(RHS &rhs1, RHS rhs2)
+//------------------------------------------------------------------------------
+{
+  if (rhs2 > rhs1)
+    rhs1 = rhs2;
+}
+
+//------------------------------------------------------------------------------
+template<>
+void MaxReduction::fold<false>(RHS &rhs1, RHS rhs2)
+//------------------------------------------------------------------------------
+{
+  volatile long *target = (volatile long *)&rhs1;
+  union { long as_int; double as_float; } oldval, newval;
+  do {
+    oldval.as_int = *target;
+    if (oldval.as_float >= rhs2)
+      return;
+    newval.as_float = rhs2;
+  } while (!__sync_bool_compare_and_swap(target, oldval.as_int, newval.as_int));
+}
+
 const MomentTriple TripleReduction::identity = MomentTriple();
 
 //------------------------------------------------------------------------------
@@ -28,6 +28,9 @@
 #include <cstdlib>
 #include <cassert>
 #include <cstring>
+#ifdef SNAP_MAPPER_PROFILING
+#include <mutex>
+#endif
 
 #ifndef SNAP_MAX_ENERGY_GROUPS
 #define SNAP_MAX_ENERGY_GROUPS            1024
@@ -137,8 +140,32 @@ public:
     MMS_INIT_TIME_DEPENDENT_TASK_ID,
     MMS_SCALE_TASK_ID,
     MMS_COMPARE_TASK_ID,
+    COMPARE_FLUX_CHANGE_TASK_ID,
+    DSA_INITIALIZE_TASK_ID,
+    DSA_STENCIL_TASK_ID,
+    DSA_UPDATE_TASK_ID,
+    DSA_DIRECTION_TASK_ID,
+    DSA_CORRECT_TASK_ID,
+    GMRES_INITIALIZE_TASK_ID,
+    GMRES_NORMALIZE_TASK_ID,
+    GMRES_SOURCE_TASK_ID,
+    GMRES_DOT_TASK_ID,
+    GMRES_ORTHOGONALIZE_TASK_ID,
+    GMRES_UPDATE_TASK_ID,
+    ANDERSON_RESIDUAL_TASK_ID,
+    ANDERSON_DOT_TASK_ID,
+    ANDERSON_MIX_TASK_ID,
+    EXTRAPOLATE_FLUX_TASK_ID,
+    CALC_COARSE_BALANCE_TASK_ID,
+    SOLVE_COARSE_REBALANCE_TASK_ID,
+    APPLY_COARSE_REBALANCE_TASK_ID,
+    CALC_FISSION_PRODUCTION_TASK_ID,
+    CALC_FISSION_SOURCE_TASK_ID,
+    UPDATE_EIGENVALUE_TASK_ID,
+    CALC_EIGENVALUE_CHANGE_TASK_ID,
     BIND_INNER_CONVERGENCE_TASK_ID,
     BIND_OUTER_CONVERGENCE_TASK_ID,
+    BIND_EIGENVALUE_TASK_ID,
     SUMMARY_TASK_ID,
     LAST_TASK_ID, // must be last
   };
@@ -160,8 +187,32 @@ public:
     "MMS_Init_Time Dependent",          \
     "MMS_Scale",                        \
     "MMS_Compare",                      \
+    "Compare_Flux_Change",              \
+    "DSA_Initialize",                   \
+    "DSA_Stencil",                      \
+    "DSA_Update",                       \
+    "DSA_Direction",                    \
+    "DSA_Correct",                      \
+    "GMRES_Initialize",                 \
+    "GMRES_Normalize",                  \
+    "GMRES_Source",                     \
+    "GMRES_Dot",                        \
+    "GMRES_Orthogonalize",              \
+    "GMRES_Update",                     \
+    "Anderson_Residual",                \
+    "Anderson_Dot",                     \
+    "Anderson_Mix",                     \
+    "Extrapolate_Flux",                 \
+    "Calc_Coarse_Balance",              \
+    "Solve_Coarse_Rebalance",           \
+    "Apply_Coarse_Rebalance",           \
+    "Calc_Fission_Production",          \
+    "Calc_Fission_Source",              \
+    "Update_Eigenvalue",                \
+    "Calc_Eigenvalue_Change",           \
     "Bind_Inner_Convergence",           \
     "Bind_Outer_Convergence",           \
+    "Bind_Eigenvalue",                  \
     "Summary"
   static const char* task_names[LAST_TASK_ID];
   enum MaterialLayout {
@@ -187,6 +238,7 @@ public:
     SUM_REDUCTION_ID = 2,
     TRIPLE_REDUCTION_ID = 3,
     MMS_REDUCTION_ID = 4,
+    MAX_REDUCTION_ID = 5,
   };
   enum SnapFieldID {
     FID_SINGLE = 0, // For field spaces with just one field
@@ -203,6 +255,26 @@ public:
   ((Snap::SnapFieldID)(Snap::FID_FLUX_START + (group * 8) + corner))
   enum SnapPartitionID {
     DISJOINT_PARTITION = 0,
+    GHOST_PARTITION = 1,
+  };
+  // The coarse mesh rebalance arrays have a row of points along x for 
+  // each chunk, one for each term of the balance of the chunk. Leakage
+  // is the partial current out of each face of the chunk.
+  enum CoarseLeakageTerm {
+    LEAKAGE_NEG_X = 0,
+    LEAKAGE_POS_X = 1,
+    LEAKAGE_NEG_Y = 2,
+    LEAKAGE_POS_Y = 3,
+    LEAKAGE_NEG_Z = 4,
+    LEAKAGE_POS_Z = 5,
+    NUM_LEAKAGE_TERMS = 6,
+  };
+  enum CoarseBalanceTerm {
+    BALANCE_REMOVAL = 0, // absorption and scattering out of the group
+    BALANCE_SOURCE = 1, // external source and scattering into the group
+    BALANCE_FLUX = 2,
+    BALANCE_FACTOR = 3, // written by the coarse solve
+    NUM_BALANCE_TERMS = 4,
   };
 #define SNAP_XY_PROJECTION(forward)        \
   ((Snap::SnapProjectionID)(Snap::XY_PROJECTION + (forward ? 0 : 1)))
@@ -217,6 +289,9 @@ public:
     // ...
     XZ_PROJECTION = YZ_PROJECTION + 2,
   };
+  enum SnapShardingID {
+    SPATIAL_SHARDING_ID = 1,
+  };
 public:
   Snap(Context c, Runtime *rt)
     : ctx(c), runtime(rt) { }
@@ -225,6 +300,8 @@ public:
     { return simulation_bounds; }
   inline const IndexSpace<3>& get_launch_bounds(void) const
     { return launch_bounds; }
+  inline const IndexPartition<3>& get_ghost_partition(void) const
+    { return ghost_ip; }
 public:
   void setup(void);
   void transport_solve(void);
@@ -232,26 +309,79 @@ protected:
   void initialize_scattering(const SnapArray<1> &sigt, const SnapArray<1> &siga,
                              const SnapArray<1> &sigs, const SnapArray<2> &slgg) const;
   void initialize_velocity(const SnapArray<1> &vel, const SnapArray<1> &vdelt) const;
+  void initialize_fission(const SnapArray<1> &siga, const SnapArray<1> &nusigf,
+                          const SnapArray<1> &chi) const;
   void save_fluxes(const Predicate &pred, const SnapArray<3> &src, 
                    const SnapArray<3> &dst, int energy_group_chunks) const;
-  void calculate_inner_source(const Predicate &pred, const SnapArray<3> &s_xs,
+  // Versions for the inner loop take one predicate per energy group chunk
+  // so that chunks stop iterating independently once they converge
+  void save_fluxes(const std::vector<Predicate> &group_preds, 
+                   const SnapArray<3> &src, const SnapArray<3> &dst, 
+                   int energy_group_chunks) const;
+  void calculate_inner_source(const std::vector<Predicate> &group_preds, 
+                              const SnapArray<3> &s_xs,
                               const SnapArray<3> &flux0, const SnapArray<3> &fluxm,
                               const SnapArray<3> &q2grp0, const SnapArray<3> &q2grpm,
                               const SnapArray<3> &qtot, int energy_group_chunks) const;
-  void perform_sweeps(const Predicate &pred, const SnapArray<3> &flux,
+  void perform_sweeps(const Predicate &pred, 
+                      const std::vector<Predicate> &group_preds, 
+                      const SnapArray<3> &flux,
                       const SnapArray<3> &fluxm, const SnapArray<3> &qtot, 
                       const SnapArray<1> &vdelt, const SnapArray<3> &dinv, 
                       const SnapArray<3> &t_xs, SnapArray<3> *time_flux_in[8], 
                       SnapArray<3> *time_flux_out[8], SnapArray<3> *qim[8],
                       const SnapArray<2> &flux_xy, const SnapArray<2> &flux_yz,
-                      const SnapArray<2> &flux_xz, int energy_group_chunks) const;
-  Predicate test_inner_convergence(const Predicate &pred, const SnapArray<3> &flux0,
-                      const SnapArray<3> &flux0pi, const Future &pred_false_result,
-                      int energy_group_chunks) const;
+                      const SnapArray<2> &flux_xz, int energy_group_chunks,
+                      const SnapArray<3> *leakage = NULL) const;
+  Predicate test_inner_convergence(const std::vector<Predicate> &group_preds,
+                      const SnapArray<3> &flux0, const SnapArray<3> &flux0pi, 
+                      const Future &zero_future, const Future &true_future,
+                      int energy_group_chunks,
+                      std::vector<Predicate> &group_converged,
+                      std::vector<Future> &max_changes) const;
   Predicate test_outer_convergence(const Predicate &pred, const SnapArray<3> &flux0,
                       const SnapArray<3> &flux0po, const Future &inner_converged,
-                      const Future &pred_false_result,
-                      int energy_group_chunks) const;
+                      const Future &zero_future, const Future &true_future,
+                      int energy_group_chunks,
+                      std::vector<Future> &max_changes) const;
+  void perform_dsa(const std::vector<Predicate> &group_preds,
+                   const SnapArray<3> &s_xs, const SnapArray<3> &t_xs,
+                   const SnapArray<1> &vdelt, const SnapArray<3> &flux0,
+                   const SnapArray<3> &flux0pi, const SnapArray<3> &dsa_x,
+                   const SnapArray<3> &dsa_r, const SnapArray<3> &dsa_p,
+                   const SnapArray<3> &dsa_ap, const Future &zero_future,
+                   int energy_group_chunks) const;
+  void perform_gmres(const Predicate &pred, 
+                     const std::vector<Predicate> &group_preds,
+                     const SnapArray<3> &flux0, const SnapArray<3> &flux0pi,
+                     const SnapArray<3> &fluxm, const SnapArray<3> &qtot,
+                     const SnapArray<3> &s_xs, const SnapArray<1> &vdelt, 
+                     const SnapArray<3> &dinv, const SnapArray<3> &t_xs, 
+                     SnapArray<3> *time_flux_in[8], 
+                     SnapArray<3> *time_flux_out[8], SnapArray<3> *qim[8],
+                     const SnapArray<2> &flux_xy, const SnapArray<2> &flux_yz,
+                     const SnapArray<2> &flux_xz, 
+                     const std::vector<SnapArray<3>*> &basis,
+                     const SnapArray<3> &gmres_w,
+                     const std::vector<std::set<FieldID> > &group_chunk_fields,
+                     const Future &zero_future, int energy_group_chunks) const;
+  void perform_anderson(const Predicate &pred, const SnapArray<3> &flux0,
+                        const SnapArray<3> &flux0po, 
+                        const SnapArray<3> &anderson_f,
+                        const SnapArray<3> &anderson_g,
+                        const std::vector<SnapArray<3>*> &anderson_df,
+                        const std::vector<SnapArray<3>*> &anderson_dg,
+                        std::vector<std::vector<Future> > &gram,
+                        int &iteration, const Future &zero_future) const;
+  void extrapolate_flux(const SnapArray<3> &flux0,
+                        const std::vector<SnapArray<3>*> &step_history,
+                        int &steps_saved, int &newest_step) const;
+  void perform_coarse_rebalance(const Predicate &pred, 
+                        const SnapArray<3> &flux0, const SnapArray<3> &fluxm,
+                        const SnapArray<3> &qi, const SnapArray<3> &t_xs,
+                        const SnapArray<3> &s_xs, const SnapArray<3> &mat,
+                        const SnapArray<2> &slgg, const SnapArray<3> &leakage,
+                        const SnapArray<3> &balance) const;
 private:
   const Context ctx;
   Runtime *const runtime;
@@ -262,6 +392,7 @@ private:
   IndexSpace<3> simulation_is;
   IndexSpace<3> launch_bounds;
   IndexPartition<3> spatial_ip;
+  IndexPartition<3> ghost_ip; // only made for DSA
   IndexSpace<1> material_is;
   IndexSpace<2> slgg_is;
   IndexSpace<1> point_is;
@@ -271,6 +402,10 @@ private:
   IndexPartition<2> yz_flux_ip;
   IndexSpace<2> xz_flux_is;
   IndexPartition<2> xz_flux_ip;
+  IndexSpace<3> leakage_is; // only made for CMR
+  IndexPartition<3> leakage_ip;
+  IndexSpace<3> balance_is;
+  IndexPartition<3> balance_ip;
 private:
   FieldSpace group_fs;
   FieldSpace flux_fs;
@@ -291,6 +426,11 @@ public:
                                   const std::set<Processor> &local_procs);
   static LayoutConstraintID get_soa_layout(void);
   static LayoutConstraintID get_reduction_layout(void);
+  // Which of num_owners nodes (or shards) owns a spatial chunk, points 
+  // outside the chunk grid go to the owner of the nearest chunk
+  static unsigned chunk_owner(const Point<3> &chunk, size_t num_owners);
+  static void owned_chunks(unsigned owner, size_t num_owners,
+                           std::vector<Rect<3> > &rects);
 public:
   // Configuration parameters read from input file
   static int num_dims; // originally ndimen 1-3
@@ -323,6 +463,25 @@ public:
   static int dump_population;  // originally popout
   static bool minikba_sweep; // originally swp_typ
   static bool single_angle_copy; // originally angcpy
+  static bool gauss_seidel_groups; // not in original SNAP, gsgrp
+public:
+  // Configuration parameters from the command line
+  static const char *history_prefix; // -history <prefix>, NULL if disabled
+  static bool use_dsa; // -dsa
+  static int dsa_iters; // -dsa_iters <n> CG iterations per DSA solve
+  static bool use_gmres; // -gmres
+  static int gmres_restart; // -gmres_restart <m> sweeps per GMRES cycle
+  static int anderson_depth; // -anderson <m> outer iterations mixed, 0 is off
+  static int extrapolation_order; // -extrapolate <1|2> time steps, 0 is off
+  static bool adaptive_runahead; // -adaptive_runahead
+  static bool coarse_rebalance; // -cmr
+  static int max_power_iters; // -keff <n> power iterations, 0 is fixed source
+  static double wielandt_shift; // -wielandt <shift> of k-eff, 0 is off
+public:
+  // Only the process running shard 0 prints the banner
+  static bool report_shard;
+  // Every process prints its own reports at exit labelled with its node
+  static int report_node;
 public: // derived
   static int num_corners; // orignally ncor
   static int nx_per_chunk;
@@ -356,6 +515,9 @@ public:
   public:
     SnapMapper(MapperRuntime *rt, Machine machine, Processor local,
                const char *mapper_name);
+#ifdef SNAP_MAPPER_PROFILING
+    virtual ~SnapMapper(void);
+#endif
   public:
     virtual void select_tunable_value(const MapperContext ctx,
                                       const Task& task,
@@ -382,8 +544,41 @@ public:
                           const Task &task,
                           const MapTaskInput &input,
                                 MapTaskOutput &output);
+    virtual void map_replicate_task(const MapperContext ctx,
+                                    const Task &task,
+                                    const MapTaskInput &input,
+                                    const MapTaskOutput &default_output,
+                                          MapReplicateTaskOutput &output);
+    virtual void select_sharding_functor(const MapperContext ctx,
+                          const Task &task,
+                          const SelectShardingFunctorInput &input,
+                                SelectShardingFunctorOutput &output);
+    virtual void select_sharding_functor(const MapperContext ctx,
+                          const Copy &copy,
+                          const SelectShardingFunctorInput &input,
+                                SelectShardingFunctorOutput &output);
+    virtual void select_sharding_functor(const MapperContext ctx,
+                          const Legion::Fill &fill,
+                          const SelectShardingFunctorInput &input,
+                                SelectShardingFunctorOutput &output);
   protected:
+    void deal_chunks(
+        const std::map<AddressSpace,std::vector<Processor> > &node_procs,
+        std::map<Point<3>,Processor> &mapping) const;
+    // Slices on one node are halved until they have at most this many points
+    static const size_t MAX_LEAF_SLICE_POINTS = 8;
+    void add_slice(const Task &task, const Rect<3> &rect,
+                   const std::map<Point<3>,Processor> &mapping,
+                   bool recurse, SliceTaskOutput &output);
     void update_variants(const MapperContext ctx);
+    VariantID select_sweep_variant(const MapperContext ctx);
+#ifndef DISABLE_CORNER_AFFINITY
+    Processor select_sweep_processor(const Task &task,
+                                     const std::vector<Processor> &procs) const;
+    static unsigned detect_cache_cores(void);
+  protected:
+    unsigned sweep_cache_cores; // cores per shared cache, 0 if unknown
+#endif
     void map_snap_array(const MapperContext ctx, 
                         LogicalRegion region, Memory target,
                         std::vector<PhysicalInstance> &instances);
@@ -393,6 +588,41 @@ public:
     Memory get_associated_framebuffer(Processor proc);
     Memory get_associated_zerocopy(Processor proc);
     void get_associated_procs(Processor proc, std::vector<Processor> &procs);
+#endif
+#ifdef SNAP_MAPPER_PROFILING
+  protected:
+    enum MapperCallKind {
+      MAP_TASK_CALL,
+      SLICE_TASK_CALL,
+      MAP_COPY_CALL,
+      LAST_MAPPER_CALL, // must be last
+    };
+    // Power-of-two buckets of nanoseconds
+    static const int MAPPER_LATENCY_BUCKETS = 40;
+    struct MapperCallProfile {
+    public:
+      MapperCallProfile(void);
+    public:
+      unsigned long long count, total_ns, min_ns, max_ns;
+      unsigned long long buckets[MAPPER_LATENCY_BUCKETS];
+      // Count of (processor,memory) decisions made by this call
+      std::map<std::pair<Processor,Memory>,unsigned long long> decisions;
+    };
+  protected:
+    // Copies and tasks that are not SNAP tasks get kinds of their own
+    static const unsigned COPY_PROFILE_KIND = LAST_TASK_ID;
+    static const unsigned OTHER_TASK_PROFILE_KIND = LAST_TASK_ID + 1;
+    static const unsigned NUM_PROFILE_KINDS = LAST_TASK_ID + 2;
+    static unsigned profile_kind(Legion::TaskID task_id);
+    void record_mapper_call(MapperCallKind call, unsigned kind,
+                            unsigned long long start_ns);
+    void record_mapper_decision(MapperCallKind call, unsigned kind,
+                                Processor proc, Memory memory);
+    void report_mapper_profile(void) const;
+  protected:
+    MapperCallProfile call_profiles[LAST_MAPPER_CALL][NUM_PROFILE_KINDS];
+    // Mapper calls for different tasks can run concurrently
+    mutable std::mutex profile_lock;
 #endif
   protected:
     bool has_variants;
@@ -410,11 +640,193 @@ public:
     std::map<Processor,std::vector<Processor> > associated_procs;
 #endif
   protected:
+    unsigned num_nodes;
+    std::vector<AddressSpace> node_spaces; // owner i is node_spaces[i]
     std::map<Point<3>,Processor> global_cpu_mapping;
     std::map<Point<3>,Processor> global_gpu_mapping;
   };
 };
 
+#ifdef SNAP_TASK_PROFILING
+// Wall times for every task run through snap_task_wrapper. Each thread
+// (and therefore each processor) records into its own counters so the
+// timing path never takes a lock. The counters are merged and reported 
+// as histograms for each kind of task when the process exits.
+class TaskProfiler {
+public:
+  // Log-linear buckets with 2^SUB_BUCKET_BITS buckets per power of two
+  static const int SUB_BUCKET_BITS = 3;
+  static const int NUM_BUCKETS = 64 << SUB_BUCKET_BITS;
+  struct TaskKindProfile {
+  public:
+    TaskKindProfile(void);
+  public:
+    void record(unsigned long long ns);
+    void merge(const TaskKindProfile &rhs);
+    unsigned long long percentile(double fraction) const;
+  public:
+    unsigned long long count, total_ns, min_ns, max_ns;
+    unsigned long long buckets[NUM_BUCKETS];
+  };
+  struct ThreadProfile {
+  public:
+    TaskKindProfile kinds[Snap::LAST_TASK_ID];
+  };
+public:
+  static void record_task(Snap::SnapTaskID task_id, 
+                          unsigned long long start_ns,
+                          unsigned long long stop_ns);
+  static void report(void);
+protected:
+  static ThreadProfile* get_thread_profile(void);
+  static int bucket_index(unsigned long long ns);
+  static unsigned long long bucket_midpoint(int index);
+};
+#endif
+
+#ifdef SNAP_TASK_TRACING
+// A lightweight timeline of every task run through snap_task_wrapper.
+// Events are buffered per thread and written out at exit as a Chrome
+// trace (snap_trace_<node>.json) that chrome://tracing or Perfetto
+// can load directly.
+class TaskTracer {
+public:
+  struct TraceEvent {
+  public:
+    Snap::SnapTaskID task_id;
+    Processor proc;
+    DomainPoint point;
+    // Energy groups and corners named by the task's fields, -1 if none
+    int group_start, group_stop;
+    int corner_start, corner_stop;
+    unsigned long long start_ns, stop_ns;
+  };
+public:
+  static void record_task(Snap::SnapTaskID task_id, const Task *task,
+                          Processor proc, unsigned long long start_ns,
+                          unsigned long long stop_ns);
+  static void write_trace(void);
+protected:
+  static std::vector<TraceEvent>* get_thread_events(void);
+};
+#endif
+
+#ifdef SNAP_PERF_COUNTERS
+// Hardware counters read with perf_event_open around every task run 
+// through snap_task_wrapper. Each thread opens its own counter group
+// and accumulates into its own totals, which are merged and reported 
+// for each kind of task when the process exits. There is no generic 
+// event for floating point work, so set SNAP_PERF_FP_EVENT to a raw
+// event config (e.g. 0x15c7 for FP_ARITH_INST_RETIRED on Intel) to
+// count it.
+class PerfCounters {
+public:
+  enum CounterKind {
+    CYCLES_COUNTER,
+    INSTRUCTIONS_COUNTER,
+    LLC_MISSES_COUNTER,
+    FP_OPS_COUNTER,
+    LAST_COUNTER,
+  };
+  struct Sample {
+  public:
+    unsigned long long values[LAST_COUNTER];
+  };
+  struct ThreadCounters {
+  public:
+    ThreadCounters(void);
+  public:
+    // Leader of the counter group or -1 if counters are unavailable
+    int group_fd;
+    // Position of each kind of counter in the group or -1
+    int positions[LAST_COUNTER];
+    unsigned num_counters;
+    unsigned long long tasks[Snap::LAST_TASK_ID];
+    unsigned long long totals[Snap::LAST_TASK_ID][LAST_COUNTER];
+  };
+public:
+  static void read_counters(Sample &sample);
+  static void record_task(Snap::SnapTaskID task_id, const Sample &start);
+  static void report(void);
+protected:
+  static ThreadCounters* get_thread_counters(void);
+};
+#endif
+
+#ifdef SNAP_SWEEP_EFFICIENCY
+// Busy and idle time of the processors running Mini-KBA sweeps. Every
+// sweep records its interval in a per-thread buffer. At exit the union
+// of the intervals on this process gives the sweep phases. Each
+// processor's busy time within those phases gives its efficiency, and
+// that is reported next to the theoretical KBA pipeline efficiency of
+// the chunks that this process's shard owns.
+class SweepEfficiency {
+public:
+  struct SweepInterval {
+  public:
+    Processor proc;
+    unsigned long long start_ns, stop_ns;
+  };
+public:
+  static void set_shard(unsigned shard, size_t num_shards);
+  static void set_group_chunks(int num_group_chunks);
+  static void record_sweep(Processor proc, unsigned long long start_ns,
+                           unsigned long long stop_ns);
+  // Fraction of time spent sweeping for the y x z columns of chunks 
+  // owned by a shard, each pipelining its x chunks x group chunk blocks
+  // through the KBA wavefront that crosses the shard's columns
+  static double theoretical_efficiency(int group_chunks, unsigned shard,
+                                       size_t num_shards, int &columns_y,
+                                       int &columns_z);
+  static void report(void);
+protected:
+  static std::vector<SweepInterval>* get_thread_intervals(void);
+};
+#endif
+
+#ifdef SNAP_OVERHEAD_BENCHMARK
+// Runtime overhead of the full task graph with the kernels compiled out
+// by NO_COMPUTE. Every index task, single task, copy and fill that the 
+// top-level task launches during the solve is counted by kind along 
+// with the time spent inside the runtime call that launches it, which 
+// is what the runtime charges the application to issue the task graph.
+// The issue time of each inner iteration and the point tasks run in 
+// snap_task_wrapper on this process are recorded too. Everything is 
+// reported when the process exits.
+class OverheadBenchmark {
+public:
+  enum LaunchKind {
+    INDEX_TASK_LAUNCH,
+    SINGLE_TASK_LAUNCH,
+    COPY_LAUNCH,
+    FILL_LAUNCH,
+    LAST_LAUNCH_KIND, // must be last
+  };
+  // Times one launch from its construction until it goes out of scope
+  class LaunchTimer {
+  public:
+    LaunchTimer(LaunchKind k)
+      : kind(k), start_ns(Realm::Clock::current_time_in_nanoseconds()) { }
+    ~LaunchTimer(void)
+    {
+      record_launch(kind, 
+          Realm::Clock::current_time_in_nanoseconds() - start_ns);
+    }
+  private:
+    const LaunchKind kind;
+    const unsigned long long start_ns;
+  };
+public:
+  static void begin_solve(void);
+  static void end_solve(void);
+  static void record_launch(LaunchKind kind, unsigned long long ns);
+  static void record_execution(void);
+  static void begin_inner_iteration(void);
+  static void end_inner_iteration(void);
+  static void report(void);
+};
+#endif
+
 template<typename T, Snap::SnapTaskID TASK_ID, int DIM=3> 
 class SnapTask : public IndexTaskLauncher {
 public:
@@ -429,23 +841,33 @@ public:
   { 
     log_snap.info("Dispatching Task %s (ID %d)", 
         Snap::task_names[TASK_ID], TASK_ID);
-    if (block) {
-      FutureMap fm = runtime->execute_index_space(ctx, *this);
+    FutureMap fm;
+    {
+#ifdef SNAP_OVERHEAD_BENCHMARK
+      OverheadBenchmark::LaunchTimer timer(
+                                  OverheadBenchmark::INDEX_TASK_LAUNCH);
+#endif
+      fm = runtime->execute_index_space(ctx, *this);
+    }
+    if (block)
       fm.wait_all_results(true/*silence warnings*/);
-    } else
-      runtime->execute_index_space(ctx, *this);
   }
   template<typename OP>
   Future dispatch(Context ctx, Runtime *runtime, bool block = false)
   {
     log_snap.info("Dispatching Task %s (ID %d) with Reduction %d", 
                   Snap::task_names[TASK_ID], TASK_ID, OP::REDOP);
-    if (block) {
-      Future f = runtime->execute_index_space(ctx, *this, OP::REDOP);
+    Future f;
+    {
+#ifdef SNAP_OVERHEAD_BENCHMARK
+      OverheadBenchmark::LaunchTimer timer(
+                                  OverheadBenchmark::INDEX_TASK_LAUNCH);
+#endif
+      f = runtime->execute_index_space(ctx, *this, OP::REDOP);
+    }
+    if (block)
       f.get_void_result(true/*silence warnings*/);
-      return f;
-    } else
-      return runtime->execute_index_space(ctx, *this, OP::REDOP);
+    return f;
   }
 public:
   static void preregister_all_variants(void)
@@ -457,26 +879,81 @@ public:
   {
     runtime->attach_name(TASK_ID, Snap::task_names[TASK_ID]);
   }
+protected:
+  // Logging and the optional profiling hooks around every task body
+  class TaskHooks {
+  public:
+    TaskHooks(const Task *t, Context c, Runtime *rt)
+      : task(t), ctx(c), runtime(rt)
+    {
+      log_snap.info("Running Task %s (UID %lld) on Processor " IDFMT "",
+          task->get_task_name(), task->get_unique_id(), 
+          runtime->get_executing_processor(ctx).id);
+#if defined(SNAP_TASK_PROFILING) || defined(SNAP_TASK_TRACING) || \
+    defined(SNAP_SWEEP_EFFICIENCY)
+      start = Realm::Clock::current_time_in_nanoseconds();
+#endif
+#ifdef SNAP_PERF_COUNTERS
+      PerfCounters::read_counters(perf_start);
+#endif
+    }
+    // Called once the task body has returned
+    void complete(void) const
+    {
+#ifdef SNAP_OVERHEAD_BENCHMARK
+      OverheadBenchmark::record_execution();
+#endif
+#ifdef SNAP_PERF_COUNTERS
+      PerfCounters::record_task(TASK_ID, perf_start);
+#endif
+#if defined(SNAP_TASK_PROFILING) || defined(SNAP_TASK_TRACING) || \
+    defined(SNAP_SWEEP_EFFICIENCY)
+      const unsigned long long stop = 
+        Realm::Clock::current_time_in_nanoseconds();
+#endif
+#ifdef SNAP_TASK_PROFILING
+      TaskProfiler::record_task(TASK_ID, start, stop);
+#endif
+#ifdef SNAP_TASK_TRACING
+      TaskTracer::record_task(TASK_ID, task, 
+          runtime->get_executing_processor(ctx), start, stop);
+#endif
+#ifdef SNAP_SWEEP_EFFICIENCY
+      if (TASK_ID == Snap::MINI_KBA_TASK_ID)
+        SweepEfficiency::record_sweep(runtime->get_executing_processor(ctx),
+                                      start, stop);
+#endif
+    }
+  private:
+    const Task *const task;
+    const Context ctx;
+    Runtime *const runtime;
+#if defined(SNAP_TASK_PROFILING) || defined(SNAP_TASK_TRACING) || \
+    defined(SNAP_SWEEP_EFFICIENCY)
+    unsigned long long start;
+#endif
+#ifdef SNAP_PERF_COUNTERS
+    PerfCounters::Sample perf_start;
+#endif
+  };
 public:
   template<void (*TASK_PTR)(const Task*,
       const std::vector<PhysicalRegion>&, Context, Runtime*)>
   static void snap_task_wrapper(const Task *task,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
   {
-    log_snap.info("Running Task %s (UID %lld) on Processor " IDFMT "",
-        task->get_task_name(), task->get_unique_id(), 
-        runtime->get_executing_processor(ctx).id);
+    TaskHooks hooks(task, ctx, runtime);
     (*TASK_PTR)(task, regions, ctx, runtime);
+    hooks.complete();
   }
   template<typename RET_T, RET_T (*TASK_PTR)(const Task*,
       const std::vector<PhysicalRegion>&, Context, Runtime*)>
   static RET_T snap_task_wrapper(const Task *task,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
   {
-    log_snap.info("Running Task %s (UID %lld) on Processor " IDFMT "",
-        task->get_task_name(), task->get_unique_id(), 
-        runtime->get_executing_processor(ctx).id);
+    TaskHooks hooks(task, ctx, runtime);
     RET_T result = (*TASK_PTR)(task, regions, ctx, runtime);
+    hooks.complete();
     return result;
   }
 protected:
@@ -485,11 +962,13 @@ protected:
       const std::vector<PhysicalRegion>&, Context, Runtime*)>
   static void register_cpu_variant(const ExecutionConstraintSet &execution_constraints,
                                    const TaskLayoutConstraintSet &layout_constraints,
-                                   bool leaf = false, bool inner = false)
+                                   bool leaf = false, bool inner = false,
+                                   Legion::VariantID vid = Legion::AUTO_GENERATE_ID,
+                                   const char *variant_kind = "CPU")
   {
     char variant_name[128];
-    strcpy(variant_name, "CPU ");
-    strncat(variant_name, Snap::task_names[TASK_ID], 123);
+    snprintf(variant_name, sizeof(variant_name), "%s %s", 
+             variant_kind, Snap::task_names[TASK_ID]);
     TaskVariantRegistrar registrar(TASK_ID, true/*global*/, variant_name);
     registrar.execution_constraints = execution_constraints;
     registrar.layout_constraints = layout_constraints;
@@ -498,17 +977,19 @@ protected:
     registrar.inner_variant = inner;
     Runtime::preregister_task_variant<
       SnapTask<T,TASK_ID>::template snap_task_wrapper<TASK_PTR> >(
-          registrar, Snap::task_names[TASK_ID]);
+          registrar, Snap::task_names[TASK_ID], vid);
   }
   template<typename RET_T, RET_T (*TASK_PTR)(const Task*,
       const std::vector<PhysicalRegion>&, Context, Runtime*)>
   static void register_cpu_variant(const ExecutionConstraintSet &execution_constraints,
                                    const TaskLayoutConstraintSet &layout_constraints,
-                                   bool leaf = false, bool inner = false)
+                                   bool leaf = false, bool inner = false,
+                                   Legion::VariantID vid = Legion::AUTO_GENERATE_ID,
+                                   const char *variant_kind = "CPU")
   {
     char variant_name[128];
-    strcpy(variant_name, "CPU ");
-    strncat(variant_name, Snap::task_names[TASK_ID], 123);
+    snprintf(variant_name, sizeof(variant_name), "%s %s", 
+             variant_kind, Snap::task_names[TASK_ID]);
     TaskVariantRegistrar registrar(TASK_ID, true/*global*/, variant_name);
     registrar.execution_constraints = execution_constraints;
     registrar.layout_constraints = layout_constraints;
@@ -517,7 +998,7 @@ protected:
     registrar.inner_variant = inner;
     Runtime::preregister_task_variant<RET_T,
       SnapTask<T,TASK_ID>::template snap_task_wrapper<RET_T,TASK_PTR> >(
-                                         registrar, Snap::task_names[TASK_ID]);
+          registrar, Snap::task_names[TASK_ID], vid);
   }
 protected:
   // For registering GPU variants
@@ -525,11 +1006,13 @@ protected:
       const std::vector<PhysicalRegion>&, Context, Runtime*)>
   static void register_gpu_variant(const ExecutionConstraintSet &execution_constraints,
                                    const TaskLayoutConstraintSet &layout_constraints,
-                                   bool leaf = false, bool inner = false)
+                                   bool leaf = false, bool inner = false,
+                                   Legion::VariantID vid = Legion::AUTO_GENERATE_ID,
+                                   const char *variant_kind = "GPU")
   {
     char variant_name[128];
-    strcpy(variant_name, "GPU ");
-    strncat(variant_name, Snap::task_names[TASK_ID], 123);
+    snprintf(variant_name, sizeof(variant_name), "%s %s", 
+             variant_kind, Snap::task_names[TASK_ID]);
     TaskVariantRegistrar registrar(TASK_ID, true/*global*/, variant_name);
     registrar.execution_constraints = execution_constraints;
     registrar.layout_constraints = layout_constraints;
@@ -538,17 +1021,19 @@ protected:
     registrar.inner_variant = inner;
     Runtime::preregister_task_variant<
       SnapTask<T,TASK_ID>::template snap_task_wrapper<TASK_PTR> >(
-          registrar, Snap::task_names[TASK_ID]);
+          registrar, Snap::task_names[TASK_ID], vid);
   }
   template<typename RET_T, RET_T (*TASK_PTR)(const Task*,
       const std::vector<PhysicalRegion>&, Context, Runtime*)>
   static void register_gpu_variant(const ExecutionConstraintSet &execution_constraints,
                                    const TaskLayoutConstraintSet &layout_constraints,
-                                   bool leaf = false, bool inner = false)
+                                   bool leaf = false, bool inner = false,
+                                   Legion::VariantID vid = Legion::AUTO_GENERATE_ID,
+                                   const char *variant_kind = "GPU")
   {
     char variant_name[128];
-    strcpy(variant_name, "GPU ");
-    strncat(variant_name, Snap::task_names[TASK_ID], 123);
+    snprintf(variant_name, sizeof(variant_name), "%s %s", 
+             variant_kind, Snap::task_names[TASK_ID]);
     TaskVariantRegistrar registrar(TASK_ID, true/*global*/, variant_name);
     registrar.execution_constraints = execution_constraints;
     registrar.layout_constraints = layout_constraints;
@@ -557,7 +1042,7 @@ protected:
     registrar.inner_variant = inner;
     Runtime::preregister_task_variant<RET_T,
       SnapTask<T,TASK_ID>::template snap_task_wrapper<RET_T,TASK_PTR> >(
-                                         registrar, Snap::task_names[TASK_ID]);
+          registrar, Snap::task_names[TASK_ID], vid);
   }
 };
 
@@ -578,6 +1063,8 @@ public:
   LogicalRegion<DIM> get_subregion(const Point<DIM> &color) const;
 public:
   void initialize(Predicate pred = Predicate::TRUE_PRED) const; 
+  void initialize_fields(const std::set<FieldID> &fields,
+                         Predicate pred = Predicate::TRUE_PRED) const;
   template<typename T>
   void initialize(T value, Predicate pred = Predicate::TRUE_PRED) const;
   PhysicalRegion map(void) const;
@@ -626,6 +1113,17 @@ public:
                                         fields.begin(), fields.end());
   }
   template<typename T>
+  inline void add_ghost_requirement(T &launcher, IndexPartition<DIM> ghost_ip,
+                  const std::vector<Snap::SnapFieldID> &fields) const
+  {
+    // Read-only view of each chunk plus its halo from an aliased partition
+    launcher.add_region_requirement(RegionRequirement(
+          runtime->get_logical_partition(lr, ghost_ip), 0/*proj id*/,
+          READ_ONLY, EXCLUSIVE, lr));
+    launcher.region_requirements.back().privilege_fields.insert(
+                                        fields.begin(), fields.end());
+  }
+  template<typename T>
   inline void add_region_requirement(PrivilegeMode priv,
                                      T &launcher) const
   {
@@ -683,6 +1181,15 @@ public:
   const bool forward;
 };
 
+class SnapShardingFunctor : public Legion::ShardingFunctor {
+public:
+  SnapShardingFunctor(void);
+public:
+  virtual Legion::ShardID shard(const Legion::DomainPoint &point,
+                                const Legion::Domain &full_space,
+                                const size_t total_shards);
+};
+
 class AndReduction {
 public:
   static const Snap::SnapReductionID REDOP = Snap::AND_REDUCTION_ID;
@@ -707,6 +1214,18 @@ public:
   template<bool EXCLUSIVE> static void fold(RHS &rhs1, RHS rhs2);
 };
 
+class MaxReduction {
+public:
+  static const Snap::SnapReductionID REDOP = Snap::MAX_REDUCTION_ID;
+public:
+  typedef double LHS;
+  typedef double RHS;
+  static const double identity;
+public:
+  template<bool EXCLUSIVE> static void apply(LHS &lhs, RHS rhs);
+  template<bool EXCLUSIVE> static void fold(RHS &rhs1, RHS rhs2);
+};
+
 class TripleReduction {
 public:
   static const Snap::SnapReductionID REDOP = Snap::TRIPLE_REDUCTION_ID;
@@ -20,8 +20,23 @@
 #include "sweep.h"
 
 #include <stdlib.h>
+#include <atomic>
 #include <x86intrin.h>
 
+// The vector sweeps are always compiled, even when the rest of this file
+// isn't built for those instruction sets, so that one binary can pick
+// the best sweep on each node at run time (see SnapMapper::update_variants)
+#ifdef __SSE4_1__
+#define SNAP_SSE_TARGET
+#else
+#define SNAP_SSE_TARGET __attribute__((target("sse4.1")))
+#endif
+#ifdef __AVX__
+#define SNAP_AVX_TARGET
+#else
+#define SNAP_AVX_TARGET __attribute__((target("avx")))
+#endif
+
 extern Legion::Logger log_snap;
 
 //------------------------------------------------------------------------------
@@ -35,7 +50,8 @@ MiniKBATask::MiniKBATask(const Snap &snap, const Predicate &pred,
                          const SnapArray<2> &flux_yz, 
                          const SnapArray<2> &flux_xz,
                          int group_start, int group_stop, int corner, 
-                         const int ghost_offsets[3])
+                         const int ghost_offsets[3], 
+                         const SnapArray<3> *leakage)
   : SnapTask<MiniKBATask, Snap::MINI_KBA_TASK_ID>(
       snap, snap.get_launch_bounds(), pred),
     mini_kba_args(MiniKBAArgs(corner, group_start, group_stop))
@@ -82,6 +98,16 @@ MiniKBATask::MiniKBATask(const Snap &snap, const Predicate &pred,
         SNAP_XZ_PROJECTION(corner & 0x2));
     // This one last since it's not a projection requirement
     vdelt.add_region_requirement(READ_ONLY, *this, group_field);
+    // Coarse mesh rebalance wants the partial currents out of each chunk
+    if (leakage != NULL) {
+#ifndef SNAP_USE_RELAXED_COHERENCE
+      leakage->add_projection_requirement(*this, Snap::SUM_REDUCTION_ID, 
+                                          group_field);
+#else
+      leakage->add_projection_requirement(READ_WRITE, *this, group_field);
+      region_requirements.back().prop = SIMULTANEOUS;
+#endif
+    }
   } else {
     std::vector<Snap::SnapFieldID> group_fields((group_stop - group_start) + 1);
     for (int group = group_start; group <= group_stop; group++)
@@ -125,6 +151,16 @@ MiniKBATask::MiniKBATask(const Snap &snap, const Predicate &pred,
         SNAP_XZ_PROJECTION(corner & 0x2));
     // This one last since it's not a projection requirement
     vdelt.add_region_requirement(READ_ONLY, *this, group_fields);
+    // Coarse mesh rebalance wants the partial currents out of each chunk
+    if (leakage != NULL) {
+#ifndef SNAP_USE_RELAXED_COHERENCE
+      leakage->add_projection_requirement(*this, Snap::SUM_REDUCTION_ID, 
+                                          group_fields);
+#else
+      leakage->add_projection_requirement(READ_WRITE, *this, group_fields);
+      region_requirements.back().prop = SIMULTANEOUS;
+#endif
+    }
   }
 }
 
@@ -132,13 +168,6 @@ MiniKBATask::MiniKBATask(const Snap &snap, const Predicate &pred,
 /*static*/ void MiniKBATask::preregister_cpu_variants(void)
 //------------------------------------------------------------------------------
 {
-  ExecutionConstraintSet execution_constraints;
-  // Need x86 CPU with SSE or AVX instructions
-#ifdef __AVX__
-  execution_constraints.add_constraint(ISAConstraint(X86_ISA | AVX_ISA));
-#else
-  execution_constraints.add_constraint(ISAConstraint(X86_ISA | SSE_ISA));
-#endif
   TaskLayoutConstraintSet layout_constraints;
   // Most requirements are normal SOA, the others are reductions
   layout_constraints.add_layout_constraint(0/*index*/,
@@ -162,20 +191,37 @@ MiniKBATask::MiniKBATask(const Snap &snap, const Predicate &pred,
   for (unsigned idx = 4; idx < 12; idx++)
     layout_constraints.add_layout_constraint(idx/*index*/,
                                              Snap::get_soa_layout());
-#if defined(BOUNDS_CHECKS) || defined(PRIVILEGE_CHECKS)
-  register_cpu_variant<cpu_implementation>(execution_constraints,
-                                           layout_constraints,
-                                           true/*leaf*/);
-#else
-#ifdef __AVX__
-  register_cpu_variant<avx_implementation>(execution_constraints,
-                                           layout_constraints,
-                                           true/*leaf*/);
-#else
-  register_cpu_variant<sse_implementation>(execution_constraints,
-                                           layout_constraints,
-                                           true/*leaf*/);
-#endif
+  // Register all the CPU variants and let the mapper pick the best 
+  // one for each node based on its ISA and the number of angles
+  {
+    ExecutionConstraintSet execution_constraints;
+    // Need x86 CPU
+    execution_constraints.add_constraint(ISAConstraint(X86_ISA));
+    register_cpu_variant<cpu_implementation>(execution_constraints,
+                                             layout_constraints,
+                                             true/*leaf*/, false/*inner*/,
+                                             CPU_VARIANT_ID, "CPU");
+  }
+  // The vector variants read and write through raw pointers
+#if !defined(BOUNDS_CHECKS) && !defined(PRIVILEGE_CHECKS)
+  {
+    ExecutionConstraintSet execution_constraints;
+    // Need x86 CPU with SSE instructions
+    execution_constraints.add_constraint(ISAConstraint(X86_ISA | SSE_ISA));
+    register_cpu_variant<sse_implementation>(execution_constraints,
+                                             layout_constraints,
+                                             true/*leaf*/, false/*inner*/,
+                                             SSE_VARIANT_ID, "SSE");
+  }
+  {
+    ExecutionConstraintSet execution_constraints;
+    // Need x86 CPU with AVX instructions
+    execution_constraints.add_constraint(ISAConstraint(X86_ISA | AVX_ISA));
+    register_cpu_variant<avx_implementation>(execution_constraints,
+                                             layout_constraints,
+                                             true/*leaf*/, false/*inner*/,
+                                             AVX_VARIANT_ID, "AVX");
+  }
 #endif
 }
 
@@ -211,7 +257,8 @@ MiniKBATask::MiniKBATask(const Snap &snap, const Predicate &pred,
                                              Snap::get_soa_layout());
   register_gpu_variant<gpu_implementation>(execution_constraints,
                                            layout_constraints,
-                                           true/*leaf*/);
+                                           true/*leaf*/, false/*inner*/,
+                                           GPU_VARIANT_ID);
 }
 
 static inline Point<2> ghostx_point(const Point<3> &local_point)
@@ -238,6 +285,106 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
   return ghost;
 }
 
+static inline double face_current(const AccessorRW<double,2> &fa_ghost,
+                                   const Rect<2> &face, const double *wcos,
+                                   const double h)
+{
+  // After the sweep the ghost planes of the chunk hold the angular flux
+  // that left through its face, (h/2) w cos psi is the partial current
+  // per cell in the units of the balance equation
+  double current = 0.0;
+  for (int j = face.lo[1]; j <= face.hi[1]; j++)
+    for (int i = face.lo[0]; i <= face.hi[0]; i++) {
+      const double *psi = fa_ghost.ptr(Point<2>(i, j));
+      for (int ang = 0; ang < Snap::num_angles; ang++)
+        current += wcos[ang] * psi[ang];
+    }
+  return 0.5 * h * current;
+}
+
+static void fold_face_leakage(const Task *task, 
+                              const MiniKBATask::MiniKBAArgs &args,
+                              const Rect<3> &bounds,
+                              const std::vector<PhysicalRegion> &regions,
+                              Context ctx, Runtime *runtime)
+{
+  Domain<3> leakage_dom = runtime->get_index_space_domain(ctx,
+          IndexSpace<3>(task->regions[12].region.get_index_space()));
+  const size_t angle_buffer_size = Snap::num_angles * sizeof(double);
+  const Rect<2> face_x(ghostx_point(bounds.lo), ghostx_point(bounds.hi));
+  const Rect<2> face_y(ghosty_point(bounds.lo), ghosty_point(bounds.hi));
+  const Rect<2> face_z(ghostz_point(bounds.lo), ghostz_point(bounds.hi));
+  // The corner says which faces this sweep leaves the chunk through
+  Point<3> point_x = leakage_dom.bounds.lo;
+  point_x[0] += (args.corner & 0x1) ? Snap::LEAKAGE_POS_X : Snap::LEAKAGE_NEG_X;
+  Point<3> point_y = leakage_dom.bounds.lo;
+  point_y[0] += (args.corner & 0x2) ? Snap::LEAKAGE_POS_Y : Snap::LEAKAGE_NEG_Y;
+  Point<3> point_z = leakage_dom.bounds.lo;
+  point_z[0] += (args.corner & 0x4) ? Snap::LEAKAGE_POS_Z : Snap::LEAKAGE_NEG_Z;
+  for (int group = args.group_start; group <= args.group_stop; group++) {
+    const Snap::SnapFieldID flux_field = 
+      SNAP_FLUX_GROUP_FIELD(group, args.corner);
+    AccessorRW<double,2> fa_ghostz(regions[8], flux_field, angle_buffer_size);
+    AccessorRW<double,2> fa_ghostx(regions[9], flux_field, angle_buffer_size);
+    AccessorRW<double,2> fa_ghosty(regions[10], flux_field, angle_buffer_size);
+    AccessorRW<double,3> fa_leakage(regions[12], 
+                                    SNAP_ENERGY_GROUP_FIELD(group));
+    const double current_x = 
+      face_current(fa_ghostx, face_x, Snap::wmu, Snap::hi);
+    const double current_y = 
+      face_current(fa_ghosty, face_y, Snap::weta, Snap::hj);
+    const double current_z = 
+      face_current(fa_ghostz, face_z, Snap::wxi, Snap::hk);
+#ifndef SNAP_USE_RELAXED_COHERENCE
+    SumReduction::fold<true/*exclusive*/>(fa_leakage[point_x], current_x);
+    SumReduction::fold<true/*exclusive*/>(fa_leakage[point_y], current_y);
+    SumReduction::fold<true/*exclusive*/>(fa_leakage[point_z], current_z);
+#else
+    SumReduction::apply<false/*exclusive*/>(fa_leakage[point_x], current_x);
+    SumReduction::apply<false/*exclusive*/>(fa_leakage[point_y], current_y);
+    SumReduction::apply<false/*exclusive*/>(fa_leakage[point_z], current_z);
+#endif
+  }
+}
+
+template<typename VEC_T>
+static void initialize_group_accessors(const MiniKBATask::MiniKBAArgs &args,
+                     const std::vector<PhysicalRegion> &regions,
+                     std::vector<MiniKBATask::MiniKBAGroup<VEC_T> > &groups)
+{
+  const size_t angle_buffer_size = Snap::num_angles * sizeof(double);
+  groups.resize((args.group_stop - args.group_start) + 1);
+  for (int group = args.group_start; group <= args.group_stop; group++) {
+    MiniKBATask::MiniKBAGroup<VEC_T> &accessors = 
+      groups[group - args.group_start];
+    const Snap::SnapFieldID group_field = SNAP_ENERGY_GROUP_FIELD(group);
+    accessors.qtot = AccessorRO<MomentQuad,3>(regions[0], group_field);
+    accessors.flux = AccessorRW<double,3>(regions[1], group_field);
+    if (Snap::source_layout == Snap::MMS_SOURCE) {
+      accessors.qim = 
+        AccessorRO<VEC_T,3>(regions[2], group_field, angle_buffer_size);
+      accessors.fluxm = AccessorRW<MomentTriple,3>(regions[3], group_field);
+    }
+    accessors.dinv = 
+      AccessorRO<VEC_T,3>(regions[4], group_field, angle_buffer_size);
+    accessors.time_flux_in = 
+      AccessorRO<VEC_T,3>(regions[5], group_field, angle_buffer_size);
+    accessors.time_flux_out = 
+      AccessorWO<VEC_T,3>(regions[6], group_field, angle_buffer_size);
+    accessors.t_xs = AccessorRO<double,3>(regions[7], group_field);
+    // Ghost regions
+    const Snap::SnapFieldID flux_field = 
+      SNAP_FLUX_GROUP_FIELD(group, args.corner);
+    accessors.ghostz = 
+      AccessorRW<VEC_T,2>(regions[8], flux_field, angle_buffer_size);
+    accessors.ghostx = 
+      AccessorRW<VEC_T,2>(regions[9], flux_field, angle_buffer_size);
+    accessors.ghosty = 
+      AccessorRW<VEC_T,2>(regions[10], flux_field, angle_buffer_size);
+    accessors.vdelt = AccessorRO<double,1>(regions[11], group_field)[0];
+  }
+}
+
 //------------------------------------------------------------------------------
 /*static*/ void MiniKBATask::cpu_implementation(const Task *task,
       const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime)
@@ -255,14 +402,35 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
   Domain<3> dom = runtime->get_index_space_domain(ctx, 
           IndexSpace<3>(task->regions[0].region.get_index_space()));
 
+  std::vector<MiniKBAGroup<double> > groups;
+  initialize_group_accessors(*args, regions, groups);
+#ifdef SNAP_SWEEP_ROOFLINE
+  const unsigned long long start = Realm::Clock::current_time_in_nanoseconds();
+#endif
+  cpu_sweep(*args, dom.bounds, &groups[0]);
+#ifdef SNAP_SWEEP_ROOFLINE
+  record_sweep(CPU_VARIANT_ID, dom.bounds, groups.size(),
+               Realm::Clock::current_time_in_nanoseconds() - start);
+#endif
+  // Only there when the outer loop does coarse mesh rebalance
+  if (task->regions.size() > 12)
+    fold_face_leakage(task, *args, dom.bounds, regions, ctx, runtime);
+#endif
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void MiniKBATask::cpu_sweep(const MiniKBAArgs &args,
+                          const Rect<3> &bounds, const MiniKBAGroup<double> *groups)
+//------------------------------------------------------------------------------
+{
   // Figure out the origin point based on which corner we are
-  const bool stride_x_positive = ((args->corner & 0x1) != 0);
-  const bool stride_y_positive = ((args->corner & 0x2) != 0);
-  const bool stride_z_positive = ((args->corner & 0x4) != 0);
+  const bool stride_x_positive = ((args.corner & 0x1) != 0);
+  const bool stride_y_positive = ((args.corner & 0x2) != 0);
+  const bool stride_z_positive = ((args.corner & 0x4) != 0);
   const Point<3> origin( 
-    (stride_x_positive ? dom.bounds.lo[0] : dom.bounds.hi[0]),
-    (stride_y_positive ? dom.bounds.lo[1] : dom.bounds.hi[1]),
-    (stride_z_positive ? dom.bounds.lo[2] : dom.bounds.hi[2]));
+    (stride_x_positive ? bounds.lo[0] : bounds.hi[0]),
+    (stride_y_positive ? bounds.lo[1] : bounds.hi[1]),
+    (stride_z_positive ? bounds.lo[2] : bounds.hi[2]));
 
   // Local arrays
   const size_t angle_buffer_size = Snap::num_angles * sizeof(double);
@@ -296,41 +464,30 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
   // prefetchers and likely result in overall better performance
   // because the very small 2x2x2 size will be too small to warm up
   // the prefetchers and they will be confused by the access pattern
-  const int x_range = (dom.bounds.hi[0] - dom.bounds.lo[0]) + 1; 
-  const int y_range = (dom.bounds.hi[1] - dom.bounds.lo[1]) + 1;
-  const int z_range = (dom.bounds.hi[2] - dom.bounds.lo[2]) + 1;
+  const int x_range = (bounds.hi[0] - bounds.lo[0]) + 1; 
+  const int y_range = (bounds.hi[1] - bounds.lo[1]) + 1;
+  const int z_range = (bounds.hi[2] - bounds.lo[2]) + 1;
   double *yflux_pencil = (double*)malloc(x_range * angle_buffer_size);
   double *zflux_plane  = (double*)malloc(y_range * x_range * angle_buffer_size);
 
   // We could abstract these things into functions, but C++ compilers
   // get angsty about pointers and marking everything with restrict
   // is super annoying so just do all the inlining for the compiler
-  for (int group = args->group_start; group <= args->group_stop; group++) {
+  for (int group = args.group_start; group <= args.group_stop; group++) {
     // Get all the accessors for this energy group
-    AccessorRO<MomentQuad,3> fa_qtot(regions[0], SNAP_ENERGY_GROUP_FIELD(group));
-    AccessorRW<double,3> fa_flux(regions[1], SNAP_ENERGY_GROUP_FIELD(group));
-    AccessorRO<double,3> fa_qim;
-    AccessorRW<MomentTriple,3> fa_fluxm;
-    if (Snap::source_layout == Snap::MMS_SOURCE) {
-      fa_qim = AccessorRO<double,3>(regions[2], SNAP_ENERGY_GROUP_FIELD(group), angle_buffer_size);
-      fa_fluxm = AccessorRW<MomentTriple,3>(regions[3], SNAP_ENERGY_GROUP_FIELD(group));
-    }
-    
-    AccessorRO<double,3> fa_dinv(regions[4], SNAP_ENERGY_GROUP_FIELD(group), angle_buffer_size);
-    AccessorRO<double,3> fa_time_flux_in(regions[5], SNAP_ENERGY_GROUP_FIELD(group), angle_buffer_size);
-    AccessorWO<double,3> fa_time_flux_out(regions[6], SNAP_ENERGY_GROUP_FIELD(group), angle_buffer_size);
-    AccessorRO<double,3> fa_t_xs(regions[7], SNAP_ENERGY_GROUP_FIELD(group));
-
-    // Ghost regions
-    AccessorRW<double,2> fa_ghostz(regions[8], 
-        SNAP_FLUX_GROUP_FIELD(group, args->corner), angle_buffer_size);
-    AccessorRW<double,2> fa_ghostx(regions[9],
-        SNAP_FLUX_GROUP_FIELD(group, args->corner), angle_buffer_size);
-    AccessorRW<double,2> fa_ghosty(regions[10],
-        SNAP_FLUX_GROUP_FIELD(group, args->corner), angle_buffer_size);
-
-    const double vdelt = AccessorRO<double,1>(regions[11],
-                          SNAP_ENERGY_GROUP_FIELD(group))[0];
+    const MiniKBAGroup<double> &accessors = groups[group - args.group_start];
+    const AccessorRO<MomentQuad,3> &fa_qtot = accessors.qtot;
+    const AccessorRW<double,3> &fa_flux = accessors.flux;
+    const AccessorRO<double,3> &fa_qim = accessors.qim;
+    const AccessorRW<MomentTriple,3> &fa_fluxm = accessors.fluxm;
+    const AccessorRO<double,3> &fa_dinv = accessors.dinv;
+    const AccessorRO<double,3> &fa_time_flux_in = accessors.time_flux_in;
+    const AccessorWO<double,3> &fa_time_flux_out = accessors.time_flux_out;
+    const AccessorRO<double,3> &fa_t_xs = accessors.t_xs;
+    const AccessorRW<double,2> &fa_ghostz = accessors.ghostz;
+    const AccessorRW<double,2> &fa_ghostx = accessors.ghostx;
+    const AccessorRW<double,2> &fa_ghosty = accessors.ghosty;
+    const double vdelt = accessors.vdelt;
     
     // Now we do the sweeps over the points
     for (int z = 0; z < z_range; z++) {
@@ -357,8 +514,8 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
             psi[ang] = quad[0];
           if (Snap::num_moments > 1) {
             const int corner_offset = 
-              args->corner * Snap::num_angles * Snap::num_moments;
-            for (unsigned l = 1; 1 < Snap::num_moments; l++) {
+              args.corner * Snap::num_angles * Snap::num_moments;
+            for (int l = 1; l < Snap::num_moments; l++) {
               const int moment_offset = corner_offset + l * Snap::num_angles;
               for (int ang = 0; ang < Snap::num_angles; ang++) {
                 psi[ang] += Snap::ec[moment_offset+ang] * quad[l];
@@ -576,7 +733,7 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
             MomentTriple triple;
             for (int l = 1; l < Snap::num_moments; l++) {
               unsigned offset = l * Snap::num_angles + 
-                args->corner * Snap::num_angles * Snap::num_moments;
+                args.corner * Snap::num_angles * Snap::num_moments;
               total = 0.0;
               for (int ang = 0; ang < Snap::num_angles; ang++) {
                 total += Snap::ec[offset+ang] * psi[ang]; 
@@ -612,7 +769,6 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
   free(fx_hv_t);
   free(yflux_pencil);
   free(zflux_plane);
-#endif
 }
 
 //------------------------------------------------------------------------------
@@ -632,15 +788,36 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
   Domain<3> dom = runtime->get_index_space_domain(ctx, 
           IndexSpace<3>(task->regions[0].region.get_index_space()));
 
+  std::vector<MiniKBAGroup<__m128d> > groups;
+  initialize_group_accessors(*args, regions, groups);
+#ifdef SNAP_SWEEP_ROOFLINE
+  const unsigned long long start = Realm::Clock::current_time_in_nanoseconds();
+#endif
+  sse_sweep(*args, dom.bounds, &groups[0]);
+#ifdef SNAP_SWEEP_ROOFLINE
+  record_sweep(SSE_VARIANT_ID, dom.bounds, groups.size(),
+               Realm::Clock::current_time_in_nanoseconds() - start);
+#endif
+  // Only there when the outer loop does coarse mesh rebalance
+  if (task->regions.size() > 12)
+    fold_face_leakage(task, *args, dom.bounds, regions, ctx, runtime);
+#endif
+}
+
+//------------------------------------------------------------------------------
+/*static*/ SNAP_SSE_TARGET void MiniKBATask::sse_sweep(const MiniKBAArgs &args,
+                          const Rect<3> &bounds, const MiniKBAGroup<__m128d> *groups)
+//------------------------------------------------------------------------------
+{
   // Figure out the origin point based on which corner we are
-  const bool stride_x_positive = ((args->corner & 0x1) != 0);
-  const bool stride_y_positive = ((args->corner & 0x2) != 0);
-  const bool stride_z_positive = ((args->corner & 0x4) != 0);
+  const bool stride_x_positive = ((args.corner & 0x1) != 0);
+  const bool stride_y_positive = ((args.corner & 0x2) != 0);
+  const bool stride_z_positive = ((args.corner & 0x4) != 0);
   // Convert to local coordinates
   const Point<3> origin(
-   (stride_x_positive ? dom.bounds.lo[0] : dom.bounds.hi[0]),
-   (stride_y_positive ? dom.bounds.lo[1] : dom.bounds.hi[1]),
-   (stride_z_positive ? dom.bounds.lo[2] : dom.bounds.hi[2]));
+   (stride_x_positive ? bounds.lo[0] : bounds.hi[0]),
+   (stride_y_positive ? bounds.lo[1] : bounds.hi[1]),
+   (stride_z_positive ? bounds.lo[2] : bounds.hi[2]));
 
   // Local arrays
   assert((Snap::num_angles % 2) == 0);
@@ -661,38 +838,27 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
   const __m128d tolr = _mm_set1_pd(1.0e-12);
 
   // See note in the CPU implementation about why we do things this way
-  const int x_range = (dom.bounds.hi[0] - dom.bounds.lo[0]) + 1; 
-  const int y_range = (dom.bounds.hi[1] - dom.bounds.lo[1]) + 1;
-  const int z_range = (dom.bounds.hi[2] - dom.bounds.lo[2]) + 1;
+  const int x_range = (bounds.hi[0] - bounds.lo[0]) + 1; 
+  const int y_range = (bounds.hi[1] - bounds.lo[1]) + 1;
+  const int z_range = (bounds.hi[2] - bounds.lo[2]) + 1;
   __m128d *yflux_pencil = (__m128d*)malloc(x_range * angle_buffer_size);
   __m128d *zflux_plane  = (__m128d*)malloc(y_range * x_range * angle_buffer_size);
 
-  for (int group = args->group_start; group <= args->group_stop; group++) {
+  for (int group = args.group_start; group <= args.group_stop; group++) {
     // Get all the accessors for this energy group
-    AccessorRO<MomentQuad,3> fa_qtot(regions[0], SNAP_ENERGY_GROUP_FIELD(group));
-    AccessorRW<double,3> fa_flux(regions[1], SNAP_ENERGY_GROUP_FIELD(group));
-    AccessorRO<__m128d,3> fa_qim;
-    AccessorRW<MomentTriple,3> fa_fluxm;
-    if (Snap::source_layout == Snap::MMS_SOURCE) {
-      fa_qim = AccessorRO<__m128d,3>(regions[2], SNAP_ENERGY_GROUP_FIELD(group), num_vec_angles * sizeof(__m128d));
-      fa_fluxm = AccessorRW<MomentTriple,3>(regions[3], SNAP_ENERGY_GROUP_FIELD(group));
-    }
-    
-    AccessorRO<__m128d,3> fa_dinv(regions[4], SNAP_ENERGY_GROUP_FIELD(group), num_vec_angles * sizeof(__m128d));
-    AccessorRO<__m128d,3> fa_time_flux_in(regions[5], SNAP_ENERGY_GROUP_FIELD(group), num_vec_angles * sizeof(__m128d));
-    AccessorWO<__m128d,3> fa_time_flux_out(regions[6], SNAP_ENERGY_GROUP_FIELD(group), num_vec_angles * sizeof(__m128d));
-    AccessorRO<double,3> fa_t_xs(regions[7], SNAP_ENERGY_GROUP_FIELD(group));
-
-    // Ghost regions
-    AccessorRW<__m128d,2> fa_ghostz(regions[8], 
-        SNAP_FLUX_GROUP_FIELD(group, args->corner), num_vec_angles * sizeof(__m128d));
-    AccessorRW<__m128d,2> fa_ghostx(regions[9],
-        SNAP_FLUX_GROUP_FIELD(group, args->corner), num_vec_angles * sizeof(__m128d));
-    AccessorRW<__m128d,2> fa_ghosty(regions[10],
-        SNAP_FLUX_GROUP_FIELD(group, args->corner), num_vec_angles * sizeof(__m128d));
-
-    const double vdelt = AccessorRO<double,1>(regions[11],
-                          SNAP_ENERGY_GROUP_FIELD(group))[0];
+    const MiniKBAGroup<__m128d> &accessors = groups[group - args.group_start];
+    const AccessorRO<MomentQuad,3> &fa_qtot = accessors.qtot;
+    const AccessorRW<double,3> &fa_flux = accessors.flux;
+    const AccessorRO<__m128d,3> &fa_qim = accessors.qim;
+    const AccessorRW<MomentTriple,3> &fa_fluxm = accessors.fluxm;
+    const AccessorRO<__m128d,3> &fa_dinv = accessors.dinv;
+    const AccessorRO<__m128d,3> &fa_time_flux_in = accessors.time_flux_in;
+    const AccessorWO<__m128d,3> &fa_time_flux_out = accessors.time_flux_out;
+    const AccessorRO<double,3> &fa_t_xs = accessors.t_xs;
+    const AccessorRW<__m128d,2> &fa_ghostz = accessors.ghostz;
+    const AccessorRW<__m128d,2> &fa_ghostx = accessors.ghostx;
+    const AccessorRW<__m128d,2> &fa_ghosty = accessors.ghosty;
+    const double vdelt = accessors.vdelt;
 
     for (int z = 0; z < z_range; z++) {
       for (int y = 0; y < y_range; y++) {
@@ -718,7 +884,7 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
             psi[ang] = _mm_set1_pd(quad[0]);
           if (Snap::num_moments > 1) {
             const int corner_offset = 
-              args->corner * Snap::num_angles * Snap::num_moments;
+              args.corner * Snap::num_angles * Snap::num_moments;
             for (int l = 1; l < Snap::num_moments; l++) {
               const int moment_offset = corner_offset + l * Snap::num_angles;
               for (int ang = 0; ang < num_vec_angles; ang++) {
@@ -989,7 +1155,7 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
             MomentTriple triple;
             for (int l = 1; l < Snap::num_moments; l++) {
               unsigned offset = l * Snap::num_angles + 
-                args->corner * Snap::num_angles * Snap::num_moments;
+                args.corner * Snap::num_angles * Snap::num_moments;
               vec_total = _mm_set1_pd(0.0);
               for (int ang = 0; ang < num_vec_angles; ang++)
                 vec_total = _mm_add_pd(vec_total, _mm_mul_pd(psi[ang],
@@ -1020,10 +1186,8 @@ static inline Point<2> ghostz_point(const Point<3> &local_point)
   free(fx_hv_t);
   free(yflux_pencil);
   free(zflux_plane);
-#endif
 }
 
-#ifdef __AVX__
 static inline void ignore_result(int arg) { }
 
 inline __m256d* malloc_avx_aligned(size_t size)
@@ -1050,15 +1214,36 @@ inline __m256d* malloc_avx_aligned(size_t size)
   Domain<3> dom = runtime->get_index_space_domain(ctx, 
           IndexSpace<3>(task->regions[0].region.get_index_space()));
 
+  std::vector<MiniKBAGroup<__m256d> > groups;
+  initialize_group_accessors(*args, regions, groups);
+#ifdef SNAP_SWEEP_ROOFLINE
+  const unsigned long long start = Realm::Clock::current_time_in_nanoseconds();
+#endif
+  avx_sweep(*args, dom.bounds, &groups[0]);
+#ifdef SNAP_SWEEP_ROOFLINE
+  record_sweep(AVX_VARIANT_ID, dom.bounds, groups.size(),
+               Realm::Clock::current_time_in_nanoseconds() - start);
+#endif
+  // Only there when the outer loop does coarse mesh rebalance
+  if (task->regions.size() > 12)
+    fold_face_leakage(task, *args, dom.bounds, regions, ctx, runtime);
+#endif
+}
+
+//------------------------------------------------------------------------------
+/*static*/ SNAP_AVX_TARGET void MiniKBATask::avx_sweep(const MiniKBAArgs &args,
+                          const Rect<3> &bounds, const MiniKBAGroup<__m256d> *groups)
+//------------------------------------------------------------------------------
+{
   // Figure out the origin point based on which corner we are
-  const bool stride_x_positive = ((args->corner & 0x1) != 0);
-  const bool stride_y_positive = ((args->corner & 0x2) != 0);
-  const bool stride_z_positive = ((args->corner & 0x4) != 0);
+  const bool stride_x_positive = ((args.corner & 0x1) != 0);
+  const bool stride_y_positive = ((args.corner & 0x2) != 0);
+  const bool stride_z_positive = ((args.corner & 0x4) != 0);
   // Convert to local coordinates
   const Point<3> origin( 
-    (stride_x_positive ? dom.bounds.lo[0] : dom.bounds.hi[0]),
-    (stride_y_positive ? dom.bounds.lo[1] : dom.bounds.hi[1]),
-    (stride_z_positive ? dom.bounds.lo[2] : dom.bounds.hi[2]));
+    (stride_x_positive ? bounds.lo[0] : bounds.hi[0]),
+    (stride_y_positive ? bounds.lo[1] : bounds.hi[1]),
+    (stride_z_positive ? bounds.lo[2] : bounds.hi[2]));
 
   // Local arrays
   assert((Snap::num_angles % 4) == 0);
@@ -1078,39 +1263,28 @@ inline __m256d* malloc_avx_aligned(size_t size)
 
   const __m256d tolr = _mm256_set1_pd(1.0e-12);
 
-  const int x_range = (dom.bounds.hi[0] - dom.bounds.lo[0]) + 1; 
-  const int y_range = (dom.bounds.hi[1] - dom.bounds.lo[1]) + 1;
-  const int z_range = (dom.bounds.hi[2] - dom.bounds.lo[2]) + 1;
+  const int x_range = (bounds.hi[0] - bounds.lo[0]) + 1; 
+  const int y_range = (bounds.hi[1] - bounds.lo[1]) + 1;
+  const int z_range = (bounds.hi[2] - bounds.lo[2]) + 1;
   // See note in the CPU implementation about why we do things this way
   __m256d *yflux_pencil = malloc_avx_aligned(x_range * angle_buffer_size);
   __m256d *zflux_plane  = malloc_avx_aligned(y_range * x_range * angle_buffer_size); 
 
-  for (int group = args->group_start; group <= args->group_stop; group++) {
+  for (int group = args.group_start; group <= args.group_stop; group++) {
     // Get all the accessors for this energy group
-    AccessorRO<MomentQuad,3> fa_qtot(regions[0], SNAP_ENERGY_GROUP_FIELD(group));
-    AccessorRW<double,3> fa_flux(regions[1], SNAP_ENERGY_GROUP_FIELD(group));
-    AccessorRO<__m256d,3> fa_qim;
-    AccessorRW<MomentTriple,3> fa_fluxm;
-    if (Snap::source_layout == Snap::MMS_SOURCE) {
-      fa_qim = AccessorRO<__m256d,3>(regions[2], SNAP_ENERGY_GROUP_FIELD(group), num_vec_angles * sizeof(__m256d));
-      fa_fluxm = AccessorRW<MomentTriple,3>(regions[3], SNAP_ENERGY_GROUP_FIELD(group));
-    }
-    
-    AccessorRO<__m256d,3> fa_dinv(regions[4], SNAP_ENERGY_GROUP_FIELD(group), num_vec_angles * sizeof(__m256d));
-    AccessorRO<__m256d,3> fa_time_flux_in(regions[5], SNAP_ENERGY_GROUP_FIELD(group), num_vec_angles * sizeof(__m256d));
-    AccessorWO<__m256d,3> fa_time_flux_out(regions[6], SNAP_ENERGY_GROUP_FIELD(group), num_vec_angles * sizeof(__m256d));
-    AccessorRO<double,3> fa_t_xs(regions[7], SNAP_ENERGY_GROUP_FIELD(group));
-
-    // Ghost regions
-    AccessorRW<__m256d,2> fa_ghostz(regions[8], 
-        SNAP_FLUX_GROUP_FIELD(group, args->corner), num_vec_angles * sizeof(__m256d));
-    AccessorRW<__m256d,2> fa_ghostx(regions[9],
-        SNAP_FLUX_GROUP_FIELD(group, args->corner), num_vec_angles * sizeof(__m256d));
-    AccessorRW<__m256d,2> fa_ghosty(regions[10],
-        SNAP_FLUX_GROUP_FIELD(group, args->corner), num_vec_angles * sizeof(__m256d));
-
-    const double vdelt = AccessorRO<double,1>(regions[11],
-                          SNAP_ENERGY_GROUP_FIELD(group))[0];
+    const MiniKBAGroup<__m256d> &accessors = groups[group - args.group_start];
+    const AccessorRO<MomentQuad,3> &fa_qtot = accessors.qtot;
+    const AccessorRW<double,3> &fa_flux = accessors.flux;
+    const AccessorRO<__m256d,3> &fa_qim = accessors.qim;
+    const AccessorRW<MomentTriple,3> &fa_fluxm = accessors.fluxm;
+    const AccessorRO<__m256d,3> &fa_dinv = accessors.dinv;
+    const AccessorRO<__m256d,3> &fa_time_flux_in = accessors.time_flux_in;
+    const AccessorWO<__m256d,3> &fa_time_flux_out = accessors.time_flux_out;
+    const AccessorRO<double,3> &fa_t_xs = accessors.t_xs;
+    const AccessorRW<__m256d,2> &fa_ghostz = accessors.ghostz;
+    const AccessorRW<__m256d,2> &fa_ghostx = accessors.ghostx;
+    const AccessorRW<__m256d,2> &fa_ghosty = accessors.ghosty;
+    const double vdelt = accessors.vdelt;
 
     for (int z = 0; z < z_range; z++) {
       for (int y = 0; y < y_range; y++) {
@@ -1136,7 +1310,7 @@ inline __m256d* malloc_avx_aligned(size_t size)
             psi[ang] = _mm256_set1_pd(quad[0]);
           if (Snap::num_moments > 1) {
             const int corner_offset = 
-              args->corner * Snap::num_angles * Snap::num_moments;
+              args.corner * Snap::num_angles * Snap::num_moments;
             for (int l = 1; l < Snap::num_moments; l++) {
               const int moment_offset = corner_offset + l * Snap::num_angles;
               for (int ang = 0; ang < num_vec_angles; ang++) {
@@ -1482,7 +1656,7 @@ inline __m256d* malloc_avx_aligned(size_t size)
             MomentTriple triple;
             for (int l = 1; l < Snap::num_moments; l++) {
               unsigned offset = l * Snap::num_angles + 
-                args->corner * Snap::num_angles * Snap::num_moments;
+                args.corner * Snap::num_angles * Snap::num_moments;
               vec_total = _mm256_set1_pd(0.0);
               for (int ang = 0; ang < num_vec_angles; ang++)
                 vec_total = _mm256_add_pd(vec_total, _mm256_mul_pd(psi[ang],
@@ -1516,9 +1690,102 @@ inline __m256d* malloc_avx_aligned(size_t size)
   free(fx_hv_t);
   free(yflux_pencil);
   free(zflux_plane);
-#endif
 }
-#endif // __AVX__
+
+//------------------------------------------------------------------------------
+/*static*/ void MiniKBATask::sweep_model(const Rect<3> &chunk, int num_groups,
+                                         double &bytes, double &flops)
+//------------------------------------------------------------------------------
+{
+  const double cells = double(chunk.hi[0] - chunk.lo[0] + 1) *
+    double(chunk.hi[1] - chunk.lo[1] + 1) * double(chunk.hi[2] - chunk.lo[2] + 1);
+  const double angle_bytes = Snap::num_angles * sizeof(double);
+  // Every cell reads dinv and qtot and updates its scalar flux
+  double cell_bytes = angle_bytes + sizeof(MomentQuad) + 2 * sizeof(double);
+  if (Snap::flux_fixup)
+    cell_bytes += sizeof(double)/*t_xs*/;
+  if (Snap::source_layout == Snap::MMS_SOURCE)
+    cell_bytes += angle_bytes/*qim*/;
+  if (Snap::num_moments > 1)
+    cell_bytes += 2 * sizeof(MomentTriple);
+  if (Snap::time_dependent)
+    cell_bytes += 2 * angle_bytes/*time flux in and out*/;
+  // The ghost faces are read on the way in and written on the way out
+  // while all the inner faces stay in the pencil and plane buffers
+  const double face_cells = 
+    double(chunk.hi[1] - chunk.lo[1] + 1) * double(chunk.hi[2] - chunk.lo[2] + 1) +
+    double(chunk.hi[0] - chunk.lo[0] + 1) * double(chunk.hi[2] - chunk.lo[2] + 1) +
+    double(chunk.hi[0] - chunk.lo[0] + 1) * double(chunk.hi[1] - chunk.lo[1] + 1);
+  bytes = num_groups * (cells * cell_bytes + face_cells * 2 * angle_bytes);
+  // Per angle: three incoming face terms (2 mul + 1 add each), the dinv 
+  // scale, three outgoing extrapolations (mul + sub each), and the 
+  // weighted scalar flux, plus a multiply-add for each higher moment
+  // in both the source and the flux moments. The fixup is data 
+  // dependent so it is not counted and the model is a lower bound.
+  double angle_flops = 9 + 1 + 6 + 2 + 4 * (Snap::num_moments - 1);
+  if (Snap::source_layout == Snap::MMS_SOURCE)
+    angle_flops += 1;
+  if (Snap::time_dependent)
+    angle_flops += 4;
+  flops = num_groups * cells * Snap::num_angles * angle_flops;
+}
+
+#ifdef SNAP_SWEEP_ROOFLINE
+// Per-process totals of each CPU sweep variant for the roofline report
+static const int NUM_CPU_SWEEPS = 
+  MiniKBATask::GPU_VARIANT_ID - MiniKBATask::CPU_VARIANT_ID;
+static std::atomic<unsigned long long> sweep_launches[NUM_CPU_SWEEPS];
+static std::atomic<unsigned long long> sweep_elapsed_ns[NUM_CPU_SWEEPS];
+static std::atomic<unsigned long long> sweep_bytes[NUM_CPU_SWEEPS];
+static std::atomic<unsigned long long> sweep_flops[NUM_CPU_SWEEPS];
+
+//------------------------------------------------------------------------------
+/*static*/ void MiniKBATask::record_sweep(MiniKBAVariantID variant,
+                                          const Rect<3> &chunk, int num_groups,
+                                          unsigned long long elapsed_ns)
+//------------------------------------------------------------------------------
+{
+  double bytes, flops;
+  sweep_model(chunk, num_groups, bytes, flops);
+  const int index = variant - CPU_VARIANT_ID;
+  sweep_launches[index]++;
+  sweep_elapsed_ns[index] += elapsed_ns;
+  sweep_bytes[index] += (unsigned long long)bytes;
+  sweep_flops[index] += (unsigned long long)flops;
+}
+
+//------------------------------------------------------------------------------
+/*static*/ void MiniKBATask::report_sweep_roofline(void)
+//------------------------------------------------------------------------------
+{
+  // The runtime and its loggers are gone by now so just use stdio
+  static const char *const variant_names[NUM_CPU_SWEEPS] =
+    { "CPU", "SSE", "AVX" };
+  bool header = false;
+  for (int index = 0; index < NUM_CPU_SWEEPS; index++) {
+    const unsigned long long launches = sweep_launches[index];
+    if (launches == 0)
+      continue;
+    if (!header) {
+      printf("Mini-KBA Sweep Roofline for Node %d "
+             "(modelled traffic over measured time)\n", Snap::report_node);
+      printf("  %-8s %10s %12s %12s %14s %10s %10s %10s\n", "Variant",
+             "Launches", "Time (ms)", "GB", "GFLOP", "GB/s", "GFLOP/s",
+             "Flops/B");
+      header = true;
+    }
+    const double ns = sweep_elapsed_ns[index];
+    const double bytes = sweep_bytes[index];
+    const double flops = sweep_flops[index];
+    printf("  %-8s %10llu %12.3f %12.3f %14.3f %10.3f %10.3f %10.3f\n",
+           variant_names[index], launches, 1e-6 * ns, 1e-9 * bytes, 
+           1e-9 * flops, bytes / ns, flops / ns, flops / bytes);
+  }
+  if (header)
+    fflush(stdout);
+}
+#endif // SNAP_SWEEP_ROOFLINE
+
 
 #ifdef USE_GPU_KERNELS
 extern void run_gpu_sweep(const Point<3> origin, 
@@ -22,9 +22,20 @@
 #include "snap.h"
 #include "legion.h"
 
+#include <x86intrin.h>
+
 class MiniKBATask : public SnapTask<MiniKBATask, Snap::MINI_KBA_TASK_ID> {
 public:
   static const int NON_GHOST_REQUIREMENTS = 3;
+public:
+  // All the variants are registered with fixed IDs so
+  // the mapper can choose between the CPU variants
+  enum MiniKBAVariantID {
+    CPU_VARIANT_ID = 1,
+    SSE_VARIANT_ID = 2,
+    AVX_VARIANT_ID = 3,
+    GPU_VARIANT_ID = 4,
+  };
 public:
   struct MiniKBAArgs {
   public:
@@ -35,6 +46,23 @@ public:
     int group_start;
     int group_stop; // inclusive
   };
+public:
+  // The accessors for one energy group of a sweep where VEC_T is the
+  // type each variant uses for its per-angle fluxes
+  template<typename VEC_T>
+  struct MiniKBAGroup {
+  public:
+    AccessorRO<MomentQuad,3> qtot;
+    AccessorRW<double,3> flux;
+    AccessorRO<VEC_T,3> qim;
+    AccessorRW<MomentTriple,3> fluxm;
+    AccessorRO<VEC_T,3> dinv;
+    AccessorRO<VEC_T,3> time_flux_in;
+    AccessorWO<VEC_T,3> time_flux_out;
+    AccessorRO<double,3> t_xs;
+    AccessorRW<VEC_T,2> ghostz, ghostx, ghosty;
+    double vdelt;
+  };
 public:
   MiniKBATask(const Snap &snap, const Predicate &pred, 
               const SnapArray<3> &flux, const SnapArray<3> &fluxm,
@@ -45,7 +73,8 @@ public:
               const SnapArray<3> &qim, const SnapArray<2> &flux_xy,
               const SnapArray<2> &flux_yz, const SnapArray<2> &flux_xz,
               int group_start, int group_stop, int corner, 
-              const int ghost_offsets[3]);
+              const int ghost_offsets[3], 
+              const SnapArray<3> *leakage = NULL);
 public:
   MiniKBAArgs mini_kba_args;
 public:
@@ -60,6 +89,27 @@ public:
      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
   static void gpu_implementation(const Task *task,
      const std::vector<PhysicalRegion> &regions, Context ctx, Runtime *runtime);
+public:
+  // The sweep kernels behind the CPU variants, these take one set of 
+  // accessors per group so they can also be driven without the runtime
+  static void cpu_sweep(const MiniKBAArgs &args, const Rect<3> &bounds,
+                        const MiniKBAGroup<double> *groups);
+  static void sse_sweep(const MiniKBAArgs &args, const Rect<3> &bounds,
+                        const MiniKBAGroup<__m128d> *groups);
+  static void avx_sweep(const MiniKBAArgs &args, const Rect<3> &bounds,
+                        const MiniKBAGroup<__m256d> *groups);
+public:
+  // Analytic model of the bytes moved and flops performed to sweep
+  // one corner of a chunk for a number of groups
+  static void sweep_model(const Rect<3> &chunk, int num_groups,
+                          double &bytes, double &flops);
+#ifdef SNAP_SWEEP_ROOFLINE
+  // Measured CPU sweep times are compared against the model and 
+  // reported at exit
+  static void record_sweep(MiniKBAVariantID variant, const Rect<3> &chunk,
+                           int num_groups, unsigned long long elapsed_ns);
+  static void report_sweep_roofline(void);
+#endif
 };
 
 #endif // __SWEEP_H__
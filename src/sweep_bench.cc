@@ -0,0 +1,354 @@
+/* Copyright 2017 NVIDIA Corporation
+ *
+ * The U.S. Department of Energy funded the development of this software
+ * under subcontract B609478 with Lawrence Livermore National Security, LLC
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+// A standalone benchmark for the CPU Mini-KBA sweep kernels. This
+// drives MiniKBATask::{cpu,sse,avx}_sweep directly on synthetic arrays
+// for a single chunk without starting the Legion runtime or reading
+// an input deck, so it is quick and deterministic for kernel tuning.
+//
+// Usage: sweep_bench [-nx 16] [-ny 16] [-nz 16] [-nang 32] [-ng 8]
+//                    [-nmom 4] [-iters 10] [-fixup] [-mms] [-timedep]
+//                    [-variant all|cpu|sse|avx]
+
+#include "snap.h"
+#include "sweep.h"
+
+#include <chrono>
+
+enum BenchVariant {
+  BENCH_CPU = 0,
+  BENCH_SSE = 1,
+  BENCH_AVX = 2,
+  BENCH_ALL = 3,
+};
+
+static const char *const variant_names[BENCH_ALL] = { "cpu", "sse", "avx" };
+
+// A synthetic array of one field laid out with x fastest like the SOA
+// instances that the mapper makes for the real sweep
+template<int DIM>
+class BenchArray {
+public:
+  BenchArray(const Point<DIM> &extents, size_t field_size)
+    : elem_size(field_size)
+  {
+    size_t volume = 1;
+    for (int i = 0; i < DIM; i++) {
+      strides[i] = volume * elem_size;
+      volume *= extents[i];
+    }
+    bytes = volume * elem_size;
+    // Aligned for the AVX kernel
+    ignore_result(posix_memalign(&base, 32, bytes));
+    memset(base, 0, bytes);
+  }
+  ~BenchArray(void) { free(base); }
+public:
+  template<typename ACC>
+  void bind(ACC &acc) const
+  {
+    acc.accessor.base = reinterpret_cast<uintptr_t>(base);
+    acc.accessor.strides = strides;
+  }
+  template<typename T>
+  T* ptr(void) const { return reinterpret_cast<T*>(base); }
+  void clear(void) { memset(base, 0, bytes); }
+protected:
+  static inline void ignore_result(int arg) { }
+public:
+  const size_t elem_size;
+  size_t bytes;
+  Point<DIM> strides;
+  void *base;
+};
+
+// All the arrays for one energy group
+struct BenchGroup {
+public:
+  BenchGroup(int nx, int ny, int nz)
+    : qtot(Point<3>(nx,ny,nz), sizeof(MomentQuad)),
+      flux(Point<3>(nx,ny,nz), sizeof(double)),
+      qim(Point<3>(nx,ny,nz), Snap::num_angles * sizeof(double)),
+      fluxm(Point<3>(nx,ny,nz), sizeof(MomentTriple)),
+      dinv(Point<3>(nx,ny,nz), Snap::num_angles * sizeof(double)),
+      time_flux_in(Point<3>(nx,ny,nz), Snap::num_angles * sizeof(double)),
+      time_flux_out(Point<3>(nx,ny,nz), Snap::num_angles * sizeof(double)),
+      t_xs(Point<3>(nx,ny,nz), sizeof(double)),
+      ghostz(Point<2>(nx,ny), Snap::num_angles * sizeof(double)),
+      ghostx(Point<2>(ny,nz), Snap::num_angles * sizeof(double)),
+      ghosty(Point<2>(nx,nz), Snap::num_angles * sizeof(double)),
+      vdelt(0.0) { }
+public:
+  template<typename VEC_T>
+  void bind(MiniKBATask::MiniKBAGroup<VEC_T> &accessors) const
+  {
+    qtot.bind(accessors.qtot);
+    flux.bind(accessors.flux);
+    qim.bind(accessors.qim);
+    fluxm.bind(accessors.fluxm);
+    dinv.bind(accessors.dinv);
+    time_flux_in.bind(accessors.time_flux_in);
+    time_flux_out.bind(accessors.time_flux_out);
+    t_xs.bind(accessors.t_xs);
+    ghostz.bind(accessors.ghostz);
+    ghostx.bind(accessors.ghostx);
+    ghosty.bind(accessors.ghosty);
+    accessors.vdelt = vdelt;
+  }
+  void reset(void)
+  {
+    flux.clear();
+    fluxm.clear();
+    ghostz.clear();
+    ghostx.clear();
+    ghosty.clear();
+  }
+public:
+  BenchArray<3> qtot, flux, qim, fluxm, dinv;
+  BenchArray<3> time_flux_in, time_flux_out, t_xs;
+  BenchArray<2> ghostz, ghostx, ghosty;
+  double vdelt;
+};
+
+static void initialize_group(BenchGroup &group, int index, size_t cells)
+{
+  // Deterministic values loosely shaped like a real problem
+  const double sigma = 1.0 + 0.01 * index;
+  group.vdelt = Snap::time_dependent ? 1.0 / (2.0 + index) : 0.0;
+  MomentQuad *qtot = group.qtot.ptr<MomentQuad>();
+  double *t_xs = group.t_xs.ptr<double>();
+  double *dinv = group.dinv.ptr<double>();
+  double *qim = group.qim.ptr<double>();
+  double *time_flux_in = group.time_flux_in.ptr<double>();
+  for (size_t cell = 0; cell < cells; cell++) {
+    qtot[cell] = MomentQuad(1.0, 0.1, 0.01, 0.001);
+    t_xs[cell] = sigma;
+    for (int ang = 0; ang < Snap::num_angles; ang++) {
+      const size_t offset = cell * Snap::num_angles + ang;
+      dinv[offset] = 1.0 / (sigma + group.vdelt + Snap::mu[ang] * Snap::hi +
+                            Snap::eta[ang] * Snap::hj + Snap::xi[ang] * Snap::hk);
+      qim[offset] = 0.5;
+      time_flux_in[offset] = 0.25;
+    }
+  }
+}
+
+static double flux_checksum(const std::vector<BenchGroup*> &groups,
+                            size_t cells)
+{
+  double sum = 0.0;
+  for (unsigned g = 0; g < groups.size(); g++) {
+    const double *flux = groups[g]->flux.ptr<double>();
+    for (size_t cell = 0; cell < cells; cell++)
+      sum += flux[cell];
+  }
+  return sum;
+}
+
+static bool variant_supported(BenchVariant variant)
+{
+  switch (variant)
+  {
+    case BENCH_CPU:
+      return true;
+    case BENCH_SSE:
+      return __builtin_cpu_supports("sse4.1") && ((Snap::num_angles % 2) == 0);
+    case BENCH_AVX:
+      return __builtin_cpu_supports("avx") && ((Snap::num_angles % 4) == 0);
+    default:
+      assert(false);
+  }
+  return false;
+}
+
+// Pick the kernel from the type of the per-angle fluxes
+static inline void sweep_corner(const MiniKBATask::MiniKBAArgs &args,
+        const Rect<3> &bounds, const MiniKBATask::MiniKBAGroup<double> *groups)
+{
+  MiniKBATask::cpu_sweep(args, bounds, groups);
+}
+
+static inline void sweep_corner(const MiniKBATask::MiniKBAArgs &args,
+        const Rect<3> &bounds, const MiniKBATask::MiniKBAGroup<__m128d> *groups)
+{
+  MiniKBATask::sse_sweep(args, bounds, groups);
+}
+
+static inline void sweep_corner(const MiniKBATask::MiniKBAArgs &args,
+        const Rect<3> &bounds, const MiniKBATask::MiniKBAGroup<__m256d> *groups)
+{
+  MiniKBATask::avx_sweep(args, bounds, groups);
+}
+
+template<typename VEC_T>
+static void benchmark_variant(BenchVariant variant, int iterations,
+                              const Rect<3> &bounds, size_t cells,
+                              const std::vector<BenchGroup*> &groups)
+{
+  std::vector<MiniKBATask::MiniKBAGroup<VEC_T> > accessors(groups.size());
+  for (unsigned g = 0; g < groups.size(); g++)
+    groups[g]->bind(accessors[g]);
+  // Use the same analytic model as the roofline report for the task
+  double corner_bytes, corner_flops;
+  MiniKBATask::sweep_model(bounds, Snap::num_groups,
+                           corner_bytes, corner_flops);
+  const double sweep_bytes = 8.0 * corner_bytes;
+  const double sweep_flops = 8.0 * corner_flops;
+  const double sweep_unknowns = 8.0 * Snap::num_groups *
+    double(cells) * Snap::num_angles;
+
+  double total_ns = 0.0, min_ns = 0.0, checksum = 0.0;
+  // One untimed warm up pass to fault in all the pages
+  for (int it = -1; it < iterations; it++) {
+    for (unsigned g = 0; g < groups.size(); g++)
+      groups[g]->reset();
+    const std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+    // One sweep is all eight corners for every group
+    for (int corner = 0; corner < 8; corner++)
+      sweep_corner(MiniKBATask::MiniKBAArgs(corner, 0, Snap::num_groups-1),
+                   bounds, &accessors[0]);
+    const std::chrono::steady_clock::time_point stop =
+      std::chrono::steady_clock::now();
+    if (it < 0) {
+      checksum = flux_checksum(groups, cells);
+      continue;
+    }
+    const double ns =
+      std::chrono::duration<double,std::nano>(stop - start).count();
+    total_ns += ns;
+    if ((it == 0) || (ns < min_ns))
+      min_ns = ns;
+  }
+  const double mean_ns = total_ns / iterations;
+  printf("%-8s %12.3f %12.3f %14.4f %14.4f %12.3f %12.3f %22.15e\n",
+         variant_names[variant], 1e-6 * mean_ns, 1e-6 * min_ns,
+         mean_ns / sweep_unknowns, min_ns / sweep_unknowns,
+         sweep_bytes / min_ns/*bytes per ns is GB/s*/, 
+         sweep_flops / min_ns, checksum);
+}
+
+int main(int argc, char **argv)
+{
+  int nx = 16, ny = 16, nz = 16;
+  int iterations = 10;
+  BenchVariant which = BENCH_ALL;
+  Snap::num_angles = 32;
+  Snap::num_groups = 8;
+  Snap::num_moments = 4;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-nx") && ((i+1) < argc))
+      nx = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-ny") && ((i+1) < argc))
+      ny = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-nz") && ((i+1) < argc))
+      nz = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-nang") && ((i+1) < argc))
+      Snap::num_angles = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-ng") && ((i+1) < argc))
+      Snap::num_groups = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-nmom") && ((i+1) < argc))
+      Snap::num_moments = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-iters") && ((i+1) < argc))
+      iterations = atoi(argv[++i]);
+    else if (!strcmp(argv[i], "-fixup"))
+      Snap::flux_fixup = true;
+    else if (!strcmp(argv[i], "-mms"))
+      Snap::source_layout = Snap::MMS_SOURCE;
+    else if (!strcmp(argv[i], "-timedep"))
+      Snap::time_dependent = true;
+    else if (!strcmp(argv[i], "-variant") && ((i+1) < argc)) {
+      i++;
+      if (!strcmp(argv[i], "all"))
+        which = BENCH_ALL;
+      else if (!strcmp(argv[i], "cpu"))
+        which = BENCH_CPU;
+      else if (!strcmp(argv[i], "sse"))
+        which = BENCH_SSE;
+      else if (!strcmp(argv[i], "avx"))
+        which = BENCH_AVX;
+      else {
+        printf("Unknown sweep variant %s\n", argv[i]);
+        exit(1);
+      }
+    } else {
+      printf("Unknown argument %s\n", argv[i]);
+      exit(1);
+    }
+  }
+  assert((nx > 0) && (ny > 0) && (nz > 0) && (iterations > 0));
+  assert((1 <= Snap::num_moments) && (Snap::num_moments <= 4));
+  assert((1 <= Snap::num_groups) && (Snap::num_groups <= SNAP_MAX_ENERGY_GROUPS));
+  assert(1 <= Snap::num_angles);
+  // The benchmark sweeps a single chunk
+  Snap::num_dims = 3;
+  Snap::nx = Snap::nx_per_chunk = nx;
+  Snap::ny = Snap::ny_per_chunk = ny;
+  Snap::nz = Snap::nz_per_chunk = nz;
+  Snap::nx_chunks = Snap::ny_chunks = Snap::nz_chunks = 1;
+  Snap::num_corners = 8;
+  Snap::total_sim_time = Snap::time_dependent ? 1.0 : 0.0;
+  Snap::compute_derived_globals();
+
+  const size_t cells = size_t(nx) * ny * nz;
+  const Rect<3> bounds(Point<3>(0,0,0), Point<3>(nx-1,ny-1,nz-1));
+  std::vector<BenchGroup*> groups(Snap::num_groups);
+  for (int g = 0; g < Snap::num_groups; g++) {
+    groups[g] = new BenchGroup(nx, ny, nz);
+    initialize_group(*groups[g], g, cells);
+  }
+
+  printf("Mini-KBA sweep benchmark: %dx%dx%d cells, %d angles, %d groups, "
+         "%d moments%s%s%s, %d iterations\n", nx, ny, nz, Snap::num_angles,
+         Snap::num_groups, Snap::num_moments,
+         Snap::flux_fixup ? ", fixup" : "",
+         (Snap::source_layout == Snap::MMS_SOURCE) ? ", MMS" : "",
+         Snap::time_dependent ? ", time dependent" : "", iterations);
+  printf("%-8s %12s %12s %14s %14s %12s %12s %22s\n", "Variant",
+         "Mean (ms)", "Min (ms)", "Grind (ns)", "Min Grind (ns)", "GB/s",
+         "GFLOP/s", "Flux Checksum");
+  for (int v = BENCH_CPU; v < BENCH_ALL; v++) {
+    const BenchVariant variant = (BenchVariant)v;
+    if ((which != BENCH_ALL) && (which != variant))
+      continue;
+    if (!variant_supported(variant)) {
+      printf("%-8s unsupported for %d angles on this processor\n",
+             variant_names[variant], Snap::num_angles);
+      continue;
+    }
+    switch (variant)
+    {
+      case BENCH_CPU:
+        benchmark_variant<double>(variant, iterations, bounds, cells, groups);
+        break;
+      case BENCH_SSE:
+        benchmark_variant<__m128d>(variant, iterations, bounds, cells, groups);
+        break;
+      case BENCH_AVX:
+        benchmark_variant<__m256d>(variant, iterations, bounds, cells, groups);
+        break;
+      default:
+        assert(false);
+    }
+  }
+
+  for (int g = 0; g < Snap::num_groups; g++)
+    delete groups[g];
+  return 0;
+}
+